@@ -0,0 +1,196 @@
+/*
+	parallel_decode: Decode a seekable file in parallel chunks and stitch the output.
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	The file is scanned once to get a full frame index. That index is split into
+	chunks at frame boundaries and each chunk is decoded by its own thread on its
+	own handle, sharing a copy of the index. Each handle begins decoding some
+	frames ahead of its chunk (libmpg123 takes care of that for seeks, see
+	MPG123_PREFRAMES) to refill the layer III bit reservoir and the overlap
+	state. The result is written out in order and is identical to plain serial
+	decoding.
+*/
+
+#include <mpg123.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct chunk
+{
+	const char *path;
+	off_t *offsets; /* shared full index */
+	size_t fill;
+	off_t begin;    /* output sample range */
+	off_t end;      /* < 0: until end of track */
+	long preframes;
+	unsigned char *data;
+	size_t bytes;
+	int err;
+};
+
+static int framesize = 0;
+
+static void* decode_chunk(void *arg)
+{
+	struct chunk *c = arg;
+	mpg123_handle *mh;
+	size_t bufsize;
+	int err = MPG123_OK;
+
+	c->data = NULL;
+	c->bytes = 0;
+	mh = mpg123_new(NULL, &err);
+	if(mh == NULL)
+	{
+		c->err = err;
+		return NULL;
+	}
+	mpg123_param(mh, MPG123_PREFRAMES, c->preframes, 0.);
+	if(  (err = mpg123_open(mh, c->path)) != MPG123_OK
+	  || (err = mpg123_set_index(mh, c->offsets, 1, c->fill)) != MPG123_OK
+	  || mpg123_seek(mh, c->begin, SEEK_SET) != c->begin )
+	{
+		c->err = mpg123_errcode(mh);
+		mpg123_delete(mh);
+		return NULL;
+	}
+	bufsize = c->end >= 0 ? (size_t)(c->end-c->begin)*framesize : mpg123_outblock(mh);
+	c->data = malloc(bufsize);
+	while(c->data != NULL)
+	{
+		size_t done = 0;
+		if(c->bytes == bufsize)
+		{
+			unsigned char *nd;
+			if(c->end >= 0)
+				break;
+			nd = realloc(c->data, bufsize*2);
+			if(nd == NULL)
+				break;
+			c->data = nd;
+			bufsize *= 2;
+		}
+		err = mpg123_read(mh, c->data+c->bytes, bufsize-c->bytes, &done);
+		c->bytes += done;
+		if(err == MPG123_NEW_FORMAT)
+			continue;
+		if(err != MPG123_OK)
+			break;
+	}
+	c->err = (err == MPG123_DONE || err == MPG123_OK) && c->data != NULL
+	?	MPG123_OK
+	:	mpg123_errcode(mh);
+	mpg123_delete(mh);
+	return NULL;
+}
+
+/*
+	Frames to decode ahead of the chunk start: The frame right before needs
+	a complete bit reservoir (up to 511 bytes back), the one before that
+	completes the overlap and synth filter state. Frame bodies are estimated
+	from the index with a generous allowance for header and side info.
+*/
+static long chunk_preframes(off_t *offsets, size_t frame)
+{
+	long pre = 2;
+	off_t body = 0;
+	while(body < 511 && (size_t)pre < frame)
+	{
+		++pre;
+		body += offsets[frame-pre+2] - offsets[frame-pre+1] - 38;
+	}
+	return pre;
+}
+
+int main(int argc, char **argv)
+{
+	mpg123_handle *mh;
+	off_t *offsets;
+	off_t step;
+	size_t fill;
+	long rate;
+	int channels, encoding;
+	int threads, i;
+	struct chunk *chunks;
+	pthread_t *tids;
+	FILE *out;
+	int ret = 0;
+
+	if(argc != 4)
+	{
+		fprintf(stderr, "\nI will decode an MPEG audio file using multiple threads.\n");
+		fprintf(stderr, "\nUsage: %s <threads> <mpeg audio file> <raw output file>\n\n", argv[0]);
+		return -1;
+	}
+	threads = atoi(argv[1]);
+	if(threads < 1)
+		threads = 1;
+	mpg123_init();
+	mh = mpg123_new(NULL, NULL);
+	mpg123_param(mh, MPG123_INDEX_SIZE, -1000, 0.);
+	if(  mpg123_open(mh, argv[2]) != MPG123_OK
+	  || mpg123_scan(mh) != MPG123_OK
+	  || mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK
+	  || mpg123_index(mh, &offsets, &step, &fill) != MPG123_OK )
+	{
+		fprintf(stderr, "Trouble with %s: %s\n", argv[2], mpg123_strerror(mh));
+		return -1;
+	}
+	if(step != 1)
+	{
+		fprintf(stderr, "Need a full frame index, got step %li.\n", (long)step);
+		return -1;
+	}
+	framesize = channels*mpg123_encsize(encoding);
+	if((size_t)threads > fill)
+		threads = (int)fill;
+	fprintf(stderr, "Decoding %lu frames in %i chunks.\n", (unsigned long)fill, threads);
+
+	chunks = malloc(sizeof(struct chunk)*threads);
+	tids = malloc(sizeof(pthread_t)*threads);
+	if(chunks == NULL || tids == NULL)
+		return -1;
+	/* Chunk borders in output samples, as found by seeking to the first frame. */
+	for(i=0; i<threads; ++i)
+	{
+		size_t frame = fill/threads*i;
+		chunks[i].path = argv[2];
+		chunks[i].offsets = offsets;
+		chunks[i].fill = fill;
+		chunks[i].preframes = chunk_preframes(offsets, frame);
+		chunks[i].begin = i ? mpg123_seek_frame(mh, (off_t)frame, SEEK_SET) : 0;
+		if(chunks[i].begin >= 0 && i)
+			chunks[i].begin = mpg123_tell(mh);
+		chunks[i].end = -1;
+		if(i)
+			chunks[i-1].end = chunks[i].begin;
+	}
+	for(i=0; i<threads; ++i)
+		pthread_create(&tids[i], NULL, decode_chunk, &chunks[i]);
+
+	out = fopen(argv[3], "wb");
+	for(i=0; i<threads; ++i)
+	{
+		pthread_join(tids[i], NULL);
+		if(chunks[i].err != MPG123_OK)
+		{
+			fprintf(stderr, "Chunk %i failed: %s\n", i, mpg123_plain_strerror(chunks[i].err));
+			ret = -1;
+		}
+		else if(out != NULL)
+			fwrite(chunks[i].data, 1, chunks[i].bytes, out);
+		free(chunks[i].data);
+	}
+	if(out != NULL)
+		fclose(out);
+	free(tids);
+	free(chunks);
+	mpg123_close(mh);
+	mpg123_delete(mh);
+	mpg123_exit();
+	return ret;
+}
@@ -12,6 +12,7 @@ my @instances =
 ,	asmdir => 'src/libmpg123'
 ,	headers => [qw(
 		compat/compat
+		libmpg123/counters
 		libmpg123/decode
 		libmpg123/dither
 		libmpg123/frame
@@ -25,10 +26,13 @@ my @instances =
 		libmpg123/mpg123lib_intern
 		libmpg123/optimize
 		libmpg123/parse
+		libmpg123/pcmcache
 		libmpg123/reader
 		libout123/module
 		libout123/buffer
 		libout123/xfermem
+		libout123/threadbuf
+		libout123/tee
 		libout123/wav
 		libout123/out123_int
 		libout123/stringlists
@@ -18,6 +18,7 @@
 #define win32_utf8_wide INT123_win32_utf8_wide
 #define unintr_write INT123_unintr_write
 #define unintr_read INT123_unintr_read
+#define counter_clock INT123_counter_clock
 #define ntom_set_ntom INT123_ntom_set_ntom
 #define synth_1to1 INT123_synth_1to1
 #define synth_1to1_dither INT123_synth_1to1_dither
@@ -140,23 +141,39 @@
 #define dct36_avx INT123_dct36_avx
 #define dct36_neon INT123_dct36_neon
 #define dct36_neon64 INT123_dct36_neon64
+#define conv_s32_to_u32_x86_64 INT123_conv_s32_to_u32_x86_64
+#define conv_s16_to_f32_x86_64 INT123_conv_s16_to_f32_x86_64
+#define conv_s16_to_s32_x86_64 INT123_conv_s16_to_s32_x86_64
+#define conv_s32_to_24_x86_64 INT123_conv_s32_to_24_x86_64
 #define synth_ntom_set_step INT123_synth_ntom_set_step
 #define ntom_val INT123_ntom_val
 #define ntom_frame_outsamples INT123_ntom_frame_outsamples
 #define ntom_frmouts INT123_ntom_frmouts
 #define ntom_ins2outs INT123_ntom_ins2outs
 #define ntom_frameoff INT123_ntom_frameoff
+#define resample_setup INT123_resample_setup
+#define resample_free INT123_resample_free
+#define resample_decode INT123_resample_decode
+#define resample_preframes INT123_resample_preframes
+#define resample_frame_outsamples INT123_resample_frame_outsamples
+#define resample_frmouts INT123_resample_frmouts
+#define resample_ins2outs INT123_resample_ins2outs
+#define resample_frameoff INT123_resample_frameoff
+#define resample_dot_x86_64 INT123_resample_dot_x86_64
+#define analysis_decode INT123_analysis_decode
+#define analysis_store INT123_analysis_store
+#define analysis_free INT123_analysis_free
+#define loudness_new INT123_loudness_new
+#define loudness_del INT123_loudness_del
+#define loudness_frame INT123_loudness_frame
+#define loudness_finish INT123_loudness_finish
 #define init_layer3 INT123_init_layer3
-#define init_layer3_gainpow2 INT123_init_layer3_gainpow2
 #define init_layer3_stuff INT123_init_layer3_stuff
 #define init_layer12 INT123_init_layer12
-#define init_layer12_table INT123_init_layer12_table
 #define init_layer12_stuff INT123_init_layer12_stuff
 #define prepare_decode_tables INT123_prepare_decode_tables
 #define make_decode_tables INT123_make_decode_tables
 #define make_decode_tables_mmx INT123_make_decode_tables_mmx
-#define init_layer3_gainpow2_mmx INT123_init_layer3_gainpow2_mmx
-#define init_layer12_table_mmx INT123_init_layer12_table_mmx
 #define make_conv16to8_table INT123_make_conv16to8_table
 #define do_layer3 INT123_do_layer3
 #define do_layer2 INT123_do_layer2
@@ -173,6 +190,7 @@
 #define frame_reset INT123_frame_reset
 #define frame_buffers_reset INT123_frame_buffers_reset
 #define frame_exit INT123_frame_exit
+#define frame_resident_bytes INT123_frame_resident_bytes
 #define frame_index_find INT123_frame_index_find
 #define frame_index_setup INT123_frame_index_setup
 #define do_volume INT123_do_volume
@@ -210,6 +228,8 @@
 #define fi_add INT123_fi_add
 #define fi_set INT123_fi_set
 #define fi_reset INT123_fi_reset
+#define fi_point_add INT123_fi_point_add
+#define fi_find INT123_fi_find
 #define double_to_long_rounded INT123_double_to_long_rounded
 #define scale_rounded INT123_scale_rounded
 #define decode_update INT123_decode_update
@@ -218,6 +238,7 @@
 #define bytes_to_samples INT123_bytes_to_samples
 #define outblock_bytes INT123_outblock_bytes
 #define postprocess_buffer INT123_postprocess_buffer
+#define planar_store INT123_planar_store
 #define frame_cpu_opt INT123_frame_cpu_opt
 #define set_synth_functions INT123_set_synth_functions
 #define dectype INT123_dectype
@@ -234,17 +255,35 @@
 #define compute_bpf INT123_compute_bpf
 #define time_to_frame INT123_time_to_frame
 #define get_songlen INT123_get_songlen
+#define pcmcache_init INT123_pcmcache_init
+#define pcmcache_identify INT123_pcmcache_identify
+#define pcmcache_frame INT123_pcmcache_frame
+#define pcmcache_fetch INT123_pcmcache_fetch
+#define pcmcache_store INT123_pcmcache_store
+#define pcmcache_seek INT123_pcmcache_seek
+#define pcmcache_done INT123_pcmcache_done
+#define pcmcache_close INT123_pcmcache_close
+#define pcmcache_mem INT123_pcmcache_mem
 #define bc_prepare INT123_bc_prepare
 #define bc_cleanup INT123_bc_cleanup
 #define bc_poolsize INT123_bc_poolsize
 #define bc_fill INT123_bc_fill
+#define bc_mem INT123_bc_mem
 #define open_stream INT123_open_stream
 #define open_stream_handle INT123_open_stream_handle
 #define open_feed INT123_open_feed
 #define feed_more INT123_feed_more
+#define feed_more_ref INT123_feed_more_ref
 #define feed_forget INT123_feed_forget
 #define feed_set_pos INT123_feed_set_pos
 #define open_bad INT123_open_bad
+#define ahead_new INT123_ahead_new
+#define ahead_del INT123_ahead_del
+#define ahead_read INT123_ahead_read
+#define ahead_seek INT123_ahead_seek
+#define ahead_fill INT123_ahead_fill
+#define ahead_stalls INT123_ahead_stalls
+#define ahead_mem INT123_ahead_mem
 #define open_module INT123_open_module
 #define close_module INT123_close_module
 #define list_modules INT123_list_modules
@@ -266,6 +305,7 @@
 #define buffer_drop INT123_buffer_drop
 #define buffer_write INT123_buffer_write
 #define buffer_fill INT123_buffer_fill
+#define buffer_latency INT123_buffer_latency
 #define read_buf INT123_read_buf
 #define xfer_write_string INT123_xfer_write_string
 #define xfer_read_string INT123_xfer_read_string
@@ -280,6 +320,28 @@
 #define xfermem_writer_block INT123_xfermem_writer_block
 #define xfermem_write INT123_xfermem_write
 #define xfermem_done INT123_xfermem_done
+#define threadbuf_init INT123_threadbuf_init
+#define threadbuf_exit INT123_threadbuf_exit
+#define threadbuf_sync_param INT123_threadbuf_sync_param
+#define threadbuf_open INT123_threadbuf_open
+#define threadbuf_encodings INT123_threadbuf_encodings
+#define threadbuf_formats INT123_threadbuf_formats
+#define threadbuf_start INT123_threadbuf_start
+#define threadbuf_ndrain INT123_threadbuf_ndrain
+#define threadbuf_stop INT123_threadbuf_stop
+#define threadbuf_close INT123_threadbuf_close
+#define threadbuf_continue INT123_threadbuf_continue
+#define threadbuf_drain INT123_threadbuf_drain
+#define threadbuf_pause INT123_threadbuf_pause
+#define threadbuf_drop INT123_threadbuf_drop
+#define threadbuf_write INT123_threadbuf_write
+#define threadbuf_fill INT123_threadbuf_fill
+#define threadbuf_space INT123_threadbuf_space
+#define threadbuf_underruns INT123_threadbuf_underruns
+#define threadbuf_latency INT123_threadbuf_latency
+#define tee_open INT123_tee_open
+#define tee_stats INT123_tee_stats
+#define tee_buffered INT123_tee_buffered
 #define au_open INT123_au_open
 #define cdr_open INT123_cdr_open
 #define raw_open INT123_raw_open
@@ -293,6 +355,8 @@
 #define raw_formats INT123_raw_formats
 #define wav_formats INT123_wav_formats
 #define wav_drain INT123_wav_drain
+#define audible_time INT123_audible_time
+#define audible_frames INT123_audible_frames
 #define write_parameters INT123_write_parameters
 #define read_parameters INT123_read_parameters
 #define stringlists_add INT123_stringlists_add
@@ -0,0 +1,423 @@
+/*
+	analysis: decoding to subband samples or spectra, without synthesis
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	Loudness meters, fingerprinting and silence detection do not need PCM.
+	The layer decoders hand each set of 32 subband samples to the synth
+	functions, so for the subband domain these are simply replaced by ones
+	that store the samples. Layer III stops even earlier for its spectrum,
+	before alias reduction and the hybrid filterbank (see do_layer3()).
+
+	The loudness scan of mpg123_scan() works on the subbands for layer I
+	and II. The filterbank keeps the signal energy (times 32 for the 32
+	subband values of 32 output samples), so the mean square of the PCM is
+	the mean of summed squared subbands per time slot. The K-weighting of
+	ITU-R BS.1770 becomes one factor per band, its power response averaged
+	over the band. Gating over 400 ms blocks in 100 ms steps is as in EBU
+	R128. For the peak, the sum of subband magnitudes in a time slot is
+	taken as what the synthesis can make of them, including peaks between
+	the samples. The window overlap of neighbouring slots makes this an
+	estimate, not a bound.
+
+	Layer III is measured on the spectrum, skipping the hybrid filterbank as
+	well, the bigger part of the remaining work. The alias butterflies are
+	rotations and the sine-windowed MDCT is a lapped orthogonal transform,
+	so a granule's lines carry the energy of its 18 time slots of subband
+	samples: 9 times the squared lines for long blocks, 3 times for the
+	short ones (mpg123's unnormalized transforms of 18 and 6 lines). Each
+	line gets the weighting at its own frequency, finer than per subband.
+	For the peak, a subband's magnitude is taken as the amplitude of a sine
+	with the energy of its lines.
+*/
+
+#include "mpg123lib_intern.h"
+#include "debug.h"
+
+/* ReplayGain 2.0 reference level, in LUFS. */
+#define LOUDNESS_REFERENCE -18.
+/* Steps of 100 ms per gating block. */
+#define LOUDNESS_STEPS 4
+/* Points per band for averaging the weighting filter response. */
+#define LOUDNESS_POINTS 8
+
+struct loudness
+{
+	long rate; /* the weights are for that */
+	double weight[SBLIMIT];
+	double long_weight[SBLIMIT*SSLIMIT];  /* times 9, see above */
+	double short_weight[SBLIMIT*SSLIMIT]; /* times 3, indexed like lines */
+	double *energy; /* weighted, summed over channels, per step */
+	long *slots;    /* time slots of 32 samples per step */
+	size_t size;
+	size_t step;    /* the current one */
+	long pos;       /* samples into the current step, times 10 */
+	double peak;
+};
+
+void analysis_store(mpg123_handle *fr, real *in, int n, int channels)
+{
+	float *out = fr->an.data + fr->an.fill;
+	int i;
+	if(fr->an.fill + n > ANALYSIS_VALUES)
+	{
+		if(NOQUIET) error("analysis data does not fit, should not happen");
+		return;
+	}
+	for(i=0; i<n; ++i)
+		out[i] = (float)REAL_TO_DOUBLE(in[i]) * fr->an.scale;
+	fr->an.fill += n;
+	fr->an.width = n;
+	fr->an.channels = channels;
+}
+
+static int analysis_mono(real *bandPtr, mpg123_handle *fr)
+{
+	analysis_store(fr, bandPtr, SBLIMIT, 1);
+	return 0;
+}
+
+static int analysis_stereo(real *bandPtr_l, real *bandPtr_r, mpg123_handle *fr)
+{
+	analysis_store(fr, bandPtr_l, SBLIMIT, 2);
+	analysis_store(fr, bandPtr_r, SBLIMIT, 2);
+	return 0;
+}
+
+int analysis_decode(mpg123_handle *fr, int what)
+{
+	func_synth_mono synth_mono = fr->synth_mono;
+	func_synth_stereo synth_stereo = fr->synth_stereo;
+	int sblimit = fr->down_sample_sblimit;
+
+	if(fr->an.data == NULL)
+	{
+		fr->an.data = malloc(sizeof(float)*ANALYSIS_VALUES);
+		if(fr->an.data == NULL)
+		{
+			fr->err = MPG123_OUT_OF_MEM;
+			return -1;
+		}
+	}
+	fr->an.what = what;
+	fr->an.fill = 0;
+	fr->an.width = 0;
+	fr->an.channels = 0;
+	fr->an.scale = 1.f;
+#ifdef OPT_MMXORSSE
+	/* These tables carry the scale for 16 bit output, unless downsampling. */
+	if(fr->make_decode_tables == make_decode_tables_mmx && !fr->p.down_sample)
+		fr->an.scale = 1.f/16384;
+#endif
+	/* All of the band, whatever the output rate. */
+	fr->down_sample_sblimit = SBLIMIT;
+	fr->synth_mono = analysis_mono;
+	fr->synth_stereo = analysis_stereo;
+
+	(fr->do_layer)(fr);
+
+	fr->synth_mono = synth_mono;
+	fr->synth_stereo = synth_stereo;
+	fr->down_sample_sblimit = sblimit;
+	fr->an.what = 0;
+	debug3("analysis: %lu values, width %i, channels %i"
+	,	(unsigned long)fr->an.fill, fr->an.width, fr->an.channels);
+	return 0;
+}
+
+void analysis_free(mpg123_handle *fr)
+{
+	if(fr->an.data != NULL)
+	{
+		free(fr->an.data);
+		fr->an.data = NULL;
+	}
+}
+
+/* Power response of a biquad at angular frequency w. */
+static double biquad_power(const double *b, const double *a, double w)
+{
+	double bre = b[0] + b[1]*cos(w) + b[2]*cos(2*w);
+	double bim = b[1]*sin(w) + b[2]*sin(2*w);
+	double are = a[0] + a[1]*cos(w) + a[2]*cos(2*w);
+	double aim = a[1]*sin(w) + a[2]*sin(2*w);
+	return (bre*bre+bim*bim)/(are*are+aim*aim);
+}
+
+/* The K-weighting pre-filter (high shelf) and RLB high pass for any rate,
+   from the analog prototypes matching the 48 kHz coefficients of BS.1770. */
+static void loudness_weights(struct loudness *ld, long rate)
+{
+	double shelf_b[3], shelf_a[3], pass_b[3], pass_a[3];
+	double K, Q, Vh, Vb, a0;
+	int i, j;
+
+	K  = tan(M_PI*1681.974450955533/rate);
+	Q  = 0.7071752369554196;
+	Vh = pow(10., 3.999843853973347/20.);
+	Vb = pow(Vh, 0.4996667741545416);
+	a0 = 1. + K/Q + K*K;
+	shelf_b[0] = (Vh + Vb*K/Q + K*K)/a0;
+	shelf_b[1] = 2.*(K*K - Vh)/a0;
+	shelf_b[2] = (Vh - Vb*K/Q + K*K)/a0;
+	shelf_a[0] = 1.;
+	shelf_a[1] = 2.*(K*K - 1.)/a0;
+	shelf_a[2] = (1. - K/Q + K*K)/a0;
+
+	K  = tan(M_PI*38.13547087602444/rate);
+	Q  = 0.5003270373238773;
+	a0 = 1. + K/Q + K*K;
+	pass_b[0] = 1.;
+	pass_b[1] = -2.;
+	pass_b[2] = 1.;
+	pass_a[0] = 1.;
+	pass_a[1] = 2.*(K*K - 1.)/a0;
+	pass_a[2] = (1. - K/Q + K*K)/a0;
+
+#define K_POWER(w) \
+	(biquad_power(shelf_b, shelf_a, (w))*biquad_power(pass_b, pass_a, (w)))
+	for(i=0; i<SBLIMIT; ++i)
+	{
+		double sum = 0.;
+		for(j=0; j<LOUDNESS_POINTS; ++j)
+			sum += K_POWER(M_PI*(i+(j+0.5)/LOUDNESS_POINTS)/SBLIMIT);
+		ld->weight[i] = sum/LOUDNESS_POINTS;
+	}
+	/* Short block lines come in threes, one for each window, of 192. */
+	for(i=0; i<SBLIMIT*SSLIMIT; ++i)
+	{
+		ld->long_weight[i]  = 9.*K_POWER(M_PI*(i+0.5)/(SBLIMIT*SSLIMIT));
+		ld->short_weight[i] = 3.*K_POWER(M_PI*(i/3+0.5)/(SBLIMIT*SSLIMIT/3));
+	}
+#undef K_POWER
+	ld->rate = rate;
+}
+
+struct loudness *loudness_new(void)
+{
+	struct loudness *ld = malloc(sizeof(*ld));
+	if(ld == NULL)
+		return NULL;
+	ld->size = 1024; /* 100 seconds */
+	ld->energy = malloc(sizeof(double)*ld->size);
+	ld->slots  = malloc(sizeof(long)*ld->size);
+	if(ld->energy == NULL || ld->slots == NULL)
+	{
+		loudness_del(ld);
+		return NULL;
+	}
+	ld->rate = 0;
+	ld->step = 0;
+	ld->energy[0] = 0.;
+	ld->slots[0] = 0;
+	ld->pos = 0;
+	ld->peak = 0.;
+	return ld;
+}
+
+void loudness_del(struct loudness *ld)
+{
+	if(ld == NULL)
+		return;
+	if(ld->energy != NULL)
+		free(ld->energy);
+	if(ld->slots != NULL)
+		free(ld->slots);
+	free(ld);
+}
+
+/* Account for one time slot of 32 samples. */
+static int loudness_slot(struct loudness *ld, double energy, long rate)
+{
+	ld->energy[ld->step] += energy;
+	++ld->slots[ld->step];
+	ld->pos += 10*SBLIMIT;
+	if(ld->pos >= rate)
+	{
+		ld->pos -= rate;
+		if(++ld->step == ld->size)
+		{
+			double *energy = safe_realloc(ld->energy, sizeof(double)*2*ld->size);
+			long *slots;
+			if(energy == NULL)
+				return -1;
+			ld->energy = energy;
+			slots = safe_realloc(ld->slots, sizeof(long)*2*ld->size);
+			if(slots == NULL)
+				return -1;
+			ld->slots = slots;
+			ld->size *= 2;
+		}
+		ld->energy[ld->step] = 0.;
+		ld->slots[ld->step] = 0;
+	}
+	return 0;
+}
+
+static int loudness_subbands(struct loudness *ld, mpg123_handle *fr, long rate)
+{
+	const float *data = fr->an.data;
+	size_t i;
+	int ch, k;
+
+	for(i=0; i+fr->an.channels*SBLIMIT <= fr->an.fill; i+=fr->an.channels*SBLIMIT)
+	{
+		double energy = 0.;
+		for(ch=0; ch<fr->an.channels; ++ch)
+		{
+			const float *band = data + i + ch*SBLIMIT;
+			double peak = 0.;
+			for(k=0; k<SBLIMIT; ++k)
+			{
+				energy += ld->weight[k]*band[k]*band[k];
+				peak += fabs(band[k]);
+			}
+			if(peak > ld->peak)
+				ld->peak = peak;
+		}
+		if(loudness_slot(ld, energy, rate))
+			return -1;
+	}
+	return 0;
+}
+
+/* Layer III granules, spread evenly over their time slots. */
+static int loudness_spectrum(struct loudness *ld, mpg123_handle *fr, long rate)
+{
+	const float *data = fr->an.data;
+	size_t block = 0;
+	size_t i;
+	int ch, sb, k;
+
+	for(i=0; i+fr->an.channels*SBLIMIT*SSLIMIT <= fr->an.fill; i+=fr->an.channels*SBLIMIT*SSLIMIT)
+	{
+		double energy = 0.;
+		for(ch=0; ch<fr->an.channels; ++ch, ++block)
+		{
+			const float *line = data + i + ch*SBLIMIT*SSLIMIT;
+			int longlines = fr->an.longlines[block];
+			double peak = 0.;
+			for(sb=0; sb<SBLIMIT; ++sb)
+			{
+				double *weight;
+				double sum = 0.;
+				int n = sb*SSLIMIT;
+				weight = n < longlines ? ld->long_weight : ld->short_weight;
+				for(k=n; k<n+SSLIMIT; ++k)
+				{
+					double square = (double)line[k]*line[k];
+					sum += square;
+					energy += weight[k]*square;
+				}
+				/* Mean square of the slots is 9 or 3 times the sum over 18. */
+				peak += sqrt(n < longlines ? sum : sum/3.);
+			}
+			if(peak > ld->peak)
+				ld->peak = peak;
+		}
+		for(k=0; k<SSLIMIT; ++k)
+			if(loudness_slot(ld, energy/SSLIMIT, rate))
+				return -1;
+	}
+	return 0;
+}
+
+/* Analyse the frame that has just been read. */
+int loudness_frame(struct loudness *ld, mpg123_handle *fr)
+{
+	long rate = frame_freq(fr);
+	int single = fr->single;
+	int what = fr->lay == 3 ? MPG123_ANALYSIS_SPECTRUM : MPG123_ANALYSIS_SUBBANDS;
+	int b;
+
+	if(rate != ld->rate)
+		loudness_weights(ld, rate);
+	/* Loudness is about both channels, whatever the output is. */
+	if(fr->stereo == 2)
+		fr->single = SINGLE_STEREO;
+	b = analysis_decode(fr, what);
+	fr->single = single;
+	if(b != 0)
+		return -1;
+	return what == MPG123_ANALYSIS_SPECTRUM
+	?	loudness_spectrum(ld, fr, rate)
+	:	loudness_subbands(ld, fr, rate);
+}
+
+/* Mean square of a gating block of steps [first, first+count). */
+static double block_power(struct loudness *ld, size_t first, size_t count)
+{
+	double energy = 0.;
+	long slots = 0;
+	size_t i;
+	for(i=first; i<first+count; ++i)
+	{
+		energy += ld->energy[i];
+		slots  += ld->slots[i];
+	}
+	return slots ? energy/slots : 0.;
+}
+
+#define POWER_LOUDNESS(z) (-0.691 + 10.*log10(z))
+
+/* Integrated loudness and peak into the handle, also as RVA value if there
+   is none from tags. */
+void loudness_finish(struct loudness *ld, mpg123_handle *fr)
+{
+	/* Only complete steps, unless there is not even one block of them. */
+	size_t steps = ld->step;
+	size_t count = LOUDNESS_STEPS;
+	size_t blocks, i;
+	double sum = 0., threshold;
+	size_t n = 0;
+
+	if(steps < LOUDNESS_STEPS)
+	{
+		steps = ld->step+1;
+		count = steps;
+	}
+	blocks = steps-count+1;
+	/* Absolute gate at -70 LUFS, then relative one 10 LU below that mean. */
+	threshold = pow(10., (-70.+0.691)/10.);
+	for(i=0; i<blocks; ++i)
+	{
+		double z = block_power(ld, i, count);
+		if(z > threshold)
+		{
+			sum += z;
+			++n;
+		}
+	}
+	if(n)
+	{
+		threshold = sum/n*pow(10., -10./10.);
+		sum = 0.;
+		n = 0;
+		for(i=0; i<blocks; ++i)
+		{
+			double z = block_power(ld, i, count);
+			if(z > threshold)
+			{
+				sum += z;
+				++n;
+			}
+		}
+	}
+	fr->loud.valid = 1;
+	fr->loud.peak = ld->peak;
+	if(!n)
+	{
+		fr->loud.integrated = -HUGE_VAL;
+		return;
+	}
+	fr->loud.integrated = POWER_LOUDNESS(sum/n);
+	debug3("loudness: %g LUFS over %lu blocks, peak %g"
+	,	fr->loud.integrated, (unsigned long)n, fr->loud.peak);
+	if(fr->rva.level[0] == -1)
+	{
+		fr->rva.level[0] = 0;
+		fr->rva.gain[0] = (float)(LOUDNESS_REFERENCE - fr->loud.integrated);
+		fr->rva.peak[0] = (float)fr->loud.peak;
+	}
+}
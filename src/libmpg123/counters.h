@@ -0,0 +1,52 @@
+/*
+	counters: optional per-handle counters for decoder profiling
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	Enabled with --enable-counters (DECODER_COUNTERS), otherwise the macros
+	below vanish and no field is added to the handle.
+	Stage timing works by stamping the start of a stage and adding the
+	elapsed time to the named stage at its end, also starting the next one.
+	There is only one stamp, stages are not to be nested.
+*/
+
+#ifndef MPG123_COUNTERS_H
+#define MPG123_COUNTERS_H
+
+/* Monotonic time in seconds, also for the batch statistics. */
+double counter_clock(void);
+
+#ifdef DECODER_COUNTERS
+
+struct decoder_counters
+{
+	off_t frames;       /* frames parsed */
+	off_t resync_bytes; /* bytes skipped looking for a frame */
+	off_t copy_bytes;   /* bytes copied out of the feeder buffer or converted after synth */
+	long reinits;       /* decoder updates, by decode_update() */
+	double stamp;       /* start of the current stage */
+	double parse_time;
+	double dequant_time;
+	double hybrid_time;
+	double synth_time;
+};
+
+#define COUNTER_ADD(fr, name, n)    ((fr)->counters.name += (n))
+#define COUNTER_START(fr)           ((fr)->counters.stamp = counter_clock())
+#define COUNTER_STAGE(fr, name) \
+	do { \
+		double counter_now = counter_clock(); \
+		(fr)->counters.name += counter_now - (fr)->counters.stamp; \
+		(fr)->counters.stamp = counter_now; \
+	} while(0)
+
+#else
+
+#define COUNTER_ADD(fr, name, n) do {} while(0)
+#define COUNTER_START(fr)        do {} while(0)
+#define COUNTER_STAGE(fr, name)  do {} while(0)
+
+#endif
+
+#endif
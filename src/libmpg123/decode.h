@@ -33,6 +33,11 @@
 void ntom_set_ntom(mpg123_handle *fr, off_t num);
 #endif
 
+/* With floating point decoding, the polyphase resampler takes over from NtoM. */
+#if !defined(NO_NTOM) && !defined(NO_REAL) && !defined(NO_SYNTH32) && !defined(REAL_IS_FIXED)
+#define RESAMPLER
+#endif
+
 /* Let's collect all possible synth functions here, for an overview.
    If they are actually defined and used depends on preprocessor machinery.
    See synth.c and optimize.h for that, also some special C and assembler files. */
@@ -213,6 +218,12 @@ void dct36_avx     (real *,real *,real *,real *,real *);
 void dct36_neon    (real *,real *,real *,real *,real *);
 void dct36_neon64  (real *,real *,real *,real *,real *);
 
+/* In-place output format conversions for postprocess_buffer(). */
+void conv_s32_to_u32_x86_64(unsigned char *buf, size_t count);
+void conv_s16_to_f32_x86_64(unsigned char *buf, size_t count);
+void conv_s16_to_s32_x86_64(unsigned char *buf, size_t count, uint32_t flip);
+void conv_s32_to_24_x86_64 (unsigned char *buf, size_t count, uint32_t flip);
+
 /* Tools for NtoM resampling synth, defined in ntom.c . */
 int synth_ntom_set_step(mpg123_handle *fr); /* prepare ntom decoding */
 unsigned long ntom_val(mpg123_handle *fr, off_t frame); /* compute ntom_val for frame offset */
@@ -229,17 +240,47 @@ off_t ntom_ins2outs(mpg123_handle *fr, off_t ins);
 off_t ntom_frameoff(mpg123_handle *fr, off_t soff);
 #endif
 
+#ifdef RESAMPLER
+/* The polyphase resampler, defined in resample.c . */
+int resample_setup(mpg123_handle *fr); /* prepare for frame_freq() to af.rate */
+void resample_free(mpg123_handle *fr);
+/* Decode the current frame via do_layer() and resample into the output buffer. */
+int resample_decode(mpg123_handle *fr);
+/* Frames to decode before the first wanted one, to fill the filter history. */
+long resample_preframes(mpg123_handle *fr);
+/* Like the ntom functions above, computed from the exact rate ratio. */
+off_t resample_frame_outsamples(mpg123_handle *fr);
+off_t resample_frmouts(mpg123_handle *fr, off_t frame);
+off_t resample_ins2outs(mpg123_handle *fr, off_t ins);
+off_t resample_frameoff(mpg123_handle *fr, off_t soff);
+float resample_dot_x86_64(const float *in, const float *coeff, size_t count);
+#endif
+
+/* Analysis decoding (analysis.c): Run the layer decoder on the current
+   frame, collecting its subband samples or layer III spectrum in fr->an
+   instead of synthesizing. */
+#define ANALYSIS_VALUES (2*1152)
+int analysis_decode(mpg123_handle *fr, int what);
+/* Append n values of one channel, called by the layer decoders. */
+void analysis_store(mpg123_handle *fr, real *in, int n, int channels);
+void analysis_free(mpg123_handle *fr);
+/* Loudness measurement for mpg123_scan(), frame by frame on the subbands. */
+struct loudness;
+struct loudness *loudness_new(void);
+void loudness_del(struct loudness *ld);
+int loudness_frame(struct loudness *ld, mpg123_handle *fr);
+void loudness_finish(struct loudness *ld, mpg123_handle *fr);
+
 /* Initialization of any static data that majy be needed at runtime.
    Make sure you call these once before it is too late. */
 #ifndef NO_LAYER3
 void init_layer3(void);
-real init_layer3_gainpow2(mpg123_handle *fr, int i);
-void init_layer3_stuff(mpg123_handle *fr, real (*gainpow2)(mpg123_handle *fr, int i));
+/* Point the handle to the shared tables for normal or MMX/SSE decoders. */
+void init_layer3_stuff(mpg123_handle *fr, int mmx);
 #endif
 #ifndef NO_LAYER12
 void  init_layer12(void);
-real* init_layer12_table(mpg123_handle *fr, real *table, int m);
-void  init_layer12_stuff(mpg123_handle *fr, real* (*init_table)(mpg123_handle *fr, real *table, int m));
+void  init_layer12_stuff(mpg123_handle *fr, int mmx);
 #endif
 
 void prepare_decode_tables(void);
@@ -253,12 +294,6 @@ void make_decode_tables(mpg123_handle *fr); /* For every volume change. */
 #ifdef OPT_MMXORSSE
 /* Special treatment for mmx-like decoders, these functions go into the slots below. */
 void make_decode_tables_mmx(mpg123_handle *fr);
-#ifndef NO_LAYER3
-real init_layer3_gainpow2_mmx(mpg123_handle *fr, int i);
-#endif
-#ifndef NO_LAYER12
-real* init_layer12_table_mmx(mpg123_handle *fr, real *table, int m);
-#endif
 #endif
 
 #ifndef NO_8BIT
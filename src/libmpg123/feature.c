@@ -107,6 +107,20 @@ int mpg123_feature(const enum mpg123_feature_set key)
 		return 0;
 #endif
 
+		case MPG123_FEATURE_COUNTERS:
+#ifdef DECODER_COUNTERS
+		return 1;
+#else
+		return 0;
+#endif
+
+		case MPG123_FEATURE_READAHEAD:
+#ifdef READ_AHEAD
+		return 1;
+#else
+		return 0;
+#endif
+
 		default: return 0;
 	}
 }
@@ -289,8 +289,11 @@ int frame_output_format(mpg123_handle *fr)
 	return -1;
 
 end: /* Here is the _good_ end. */
+	/* Planes only make a difference with more than one channel. */
+	nf.planar = (p->flags & MPG123_PLANAR && nf.channels > 1) ? 1 : 0;
 	/* we had a successful match, now see if there's a change */
-	if(nf.rate == fr->af.rate && nf.channels == fr->af.channels && nf.encoding == fr->af.encoding)
+	if(  nf.rate == fr->af.rate && nf.channels == fr->af.channels
+	  && nf.encoding == fr->af.encoding && nf.planar == fr->af.planar )
 	{
 		debug2("Old format with %i channels, and FORCE_MONO=%li", nf.channels, p->flags & MPG123_FORCE_MONO);
 		return 0; /* the same format as before */
@@ -301,6 +304,7 @@ end: /* Here is the _good_ end. */
 		fr->af.rate = nf.rate;
 		fr->af.channels = nf.channels;
 		fr->af.encoding = nf.encoding;
+		fr->af.planar = nf.planar;
 		/* Cache the size of one sample in bytes, for ease of use. */
 		fr->af.encsize = mpg123_encsize(fr->af.encoding);
 		if(fr->af.encsize < 1)
@@ -452,6 +456,7 @@ void invalidate_format(struct audioformat *af)
 	af->encoding = 0;
 	af->rate     = 0;
 	af->channels = 0;
+	af->planar   = 0;
 }
 
 /* Number of bytes the decoder produces. */
@@ -483,61 +488,58 @@ off_t outblock_bytes(mpg123_handle *fr, off_t s)
 	return s * encsize * fr->af.channels;
 }
 
+/* SSE2 comes with any x86-64 CPU, whatever the decoder. */
+#if defined(OPT_X86_64) || defined(OPT_AVX)
+#define CONV_X86_64
+#endif
+
+#define SIGN_FLIP 0x80000000UL
+
 #ifndef NO_32BIT
-/* Remove every fourth byte, facilitating conversion from 32 bit to 24 bit integers.
+/* Remove every fourth byte, facilitating conversion from 32 bit to 24 bit integers,
+   after XORing with flip to get unsigned output if desired. One pass.
    This has to be aware of endianness, of course. */
-static void chop_fourth_byte(struct outbuffer *buf)
+static void conv_s32_to_24(struct outbuffer *buf, uint32_t flip)
 {
+	size_t count = buf->fill/sizeof(int32_t);
+#ifdef CONV_X86_64
+	conv_s32_to_24_x86_64(buf->data, count, flip);
+#else
+	uint32_t *samples = (uint32_t*) buf->data;
 	unsigned char *wpos = buf->data;
-	unsigned char *rpos = buf->data;
-#ifdef WORDS_BIGENDIAN
-	while((size_t) (rpos - buf->data + 4) <= buf->fill)
+	size_t i;
+	/* Writing stays behind reading. */
+	for(i=0; i<count; ++i)
 	{
-		/* Really stupid: Copy, increment. Byte per byte. */
-		*wpos = *rpos;
-		wpos++; rpos++;
-		*wpos = *rpos;
-		wpos++; rpos++;
-		*wpos = *rpos;
-		wpos++; rpos++;
-		rpos++; /* Skip the lowest byte (last). */
-	}
+		uint32_t val = samples[i] ^ flip;
+#ifdef WORDS_BIGENDIAN
+		wpos[0] = (unsigned char)(val >> 24);
+		wpos[1] = (unsigned char)(val >> 16);
+		wpos[2] = (unsigned char)(val >> 8);
 #else
-	while((size_t) (rpos - buf->data + 4) <= buf->fill)
-	{
-		/* Really stupid: Copy, increment. Byte per byte. */
-		rpos++; /* Skip the lowest byte (first). */
-		*wpos = *rpos;
-		wpos++; rpos++;
-		*wpos = *rpos;
-		wpos++; rpos++;
-		*wpos = *rpos;
-		wpos++; rpos++;
+		wpos[0] = (unsigned char)(val >> 8);
+		wpos[1] = (unsigned char)(val >> 16);
+		wpos[2] = (unsigned char)(val >> 24);
+#endif
+		wpos += 3;
 	}
 #endif
-	buf->fill = wpos-buf->data;
+	buf->fill = count*3;
 }
 
+/* Flipping the sign bit is the same as adding 2^31 modulo 2^32. */
 static void conv_s32_to_u32(struct outbuffer *buf)
 {
-	size_t i;
-	int32_t  *ssamples = (int32_t*)  buf->data;
-	uint32_t *usamples = (uint32_t*) buf->data;
 	size_t count = buf->fill/sizeof(int32_t);
+#ifdef CONV_X86_64
+	conv_s32_to_u32_x86_64(buf->data, count);
+#else
+	size_t i;
+	uint32_t *samples = (uint32_t*) buf->data;
 
 	for(i=0; i<count; ++i)
-	{
-		/* Different strategy since we don't have a larger type at hand.
-			 Also watch out for silly +-1 fun because integer constants are signed in C90! */
-		if(ssamples[i] >= 0)
-		usamples[i] = (uint32_t)ssamples[i] + 2147483647+1;
-		/* The smallest value goes zero. */
-		else if(ssamples[i] == ((int32_t)-2147483647-1))
-		usamples[i] = 0;
-		/* Now -value is in the positive range of signed int ... so it's a possible value at all. */
-		else
-		usamples[i] = (uint32_t)2147483647+1 - (uint32_t)(-ssamples[i]);
-	}
+	samples[i] ^= SIGN_FLIP;
+#endif
 }
 
 #endif
@@ -554,28 +556,26 @@ static const char *bufsizeerr = "Fatal: Buffer too small for postprocessing!";
 static void conv_s16_to_u16(struct outbuffer *buf)
 {
 	size_t i;
-	int16_t  *ssamples = (int16_t*) buf->data;
-	uint16_t *usamples = (uint16_t*)buf->data;
+	uint16_t *samples = (uint16_t*)buf->data;
 	size_t count = buf->fill/sizeof(int16_t);
 
 	for(i=0; i<count; ++i)
-	{
-		long tmp = (long)ssamples[i]+32768;
-		usamples[i] = (uint16_t)tmp;
-	}
+	samples[i] ^= 0x8000;
 }
 
 #ifndef NO_REAL
 static void conv_s16_to_f32(struct outbuffer *buf)
 {
+	size_t count = buf->fill/sizeof(int16_t);
+#ifndef CONV_X86_64
 	ssize_t i;
 	int16_t *in = (int16_t*) buf->data;
 	float  *out = (float*)   buf->data;
-	size_t count = buf->fill/sizeof(int16_t);
 	/* Does that make any sense? In x86, there is an actual instruction to divide
 	   float by integer ... but then, if we have that FPU, we don't really need
 	   fixed point decoder hacks ...? */
 	float scale = 1./SHORT_SCALE;
+#endif
 
 	if(buf->size < count*sizeof(float))
 	{
@@ -583,21 +583,28 @@ static void conv_s16_to_f32(struct outbuffer *buf)
 		return;
 	}
 
+#ifdef CONV_X86_64
+	conv_s16_to_f32_x86_64(buf->data, count);
+#else
 	/* Work from the back since output is bigger. */
 	for(i=count-1; i>=0; --i)
 	out[i] = (float)in[i] * scale;
+#endif
 
 	buf->fill = count*sizeof(float);
 }
 #endif
 
 #ifndef NO_32BIT
-static void conv_s16_to_s32(struct outbuffer *buf)
+/* To signed 32 bit, or unsigned with flip == SIGN_FLIP. */
+static void conv_s16_to_s32(struct outbuffer *buf, uint32_t flip)
 {
-	ssize_t i;
-	int16_t  *in = (int16_t*) buf->data;
-	int32_t *out = (int32_t*) buf->data;
 	size_t count = buf->fill/sizeof(int16_t);
+#ifndef CONV_X86_64
+	ssize_t i;
+	int16_t  *in = (int16_t*)  buf->data;
+	uint32_t *out = (uint32_t*) buf->data;
+#endif
 
 	if(buf->size < count*sizeof(int32_t))
 	{
@@ -605,19 +612,104 @@ static void conv_s16_to_s32(struct outbuffer *buf)
 		return;
 	}
 
+#ifdef CONV_X86_64
+	conv_s16_to_s32_x86_64(buf->data, count, flip);
+#else
 	/* Work from the back since output is bigger. */
 	for(i=count-1; i>=0; --i)
 	{
-		out[i] = in[i];
 		/* Could just shift bytes, but would have to mess with sign bit. */
-		out[i] *= S32_RESCALE;
+		int32_t val = (int32_t)in[i] * S32_RESCALE;
+		out[i] = (uint32_t)val ^ flip;
 	}
+#endif
 
 	buf->fill = count*sizeof(int32_t);
 }
+
+/* Straight to 24 bit, the lowest byte being zero anyway. */
+static void conv_s16_to_24(struct outbuffer *buf, uint32_t flip)
+{
+	ssize_t i;
+	int16_t *in = (int16_t*) buf->data;
+	size_t count = buf->fill/sizeof(int16_t);
+
+	if(buf->size < count*3)
+	{
+		error1("%s", bufsizeerr);
+		return;
+	}
+
+	/* Work from the back since output is bigger. */
+	for(i=count-1; i>=0; --i)
+	{
+		int32_t val = (int32_t)in[i] * S32_RESCALE;
+		uint32_t uval = (uint32_t)val ^ flip;
+		unsigned char *wpos = buf->data + 3*i;
+#ifdef WORDS_BIGENDIAN
+		wpos[0] = (unsigned char)(uval >> 24);
+		wpos[1] = (unsigned char)(uval >> 16);
+		wpos[2] = 0;
+#else
+		wpos[0] = 0;
+		wpos[1] = (unsigned char)(uval >> 16);
+		wpos[2] = (unsigned char)(uval >> 24);
+#endif
+	}
+
+	buf->fill = count*3;
+}
 #endif
 #endif
 
+/* Take interleaved samples from the synth apart into the planes of the
+   output buffer, each one pl.plane bytes long. */
+void planar_store(mpg123_handle *fr, const unsigned char *in, size_t bytes)
+{
+	int channels = fr->af.channels;
+	size_t size  = fr->af.dec_encsize;
+	size_t count = bytes/(size*channels);
+	size_t pos   = fr->buffer.fill/channels;
+	size_t i;
+	int ch;
+
+	if(pos + count*size > fr->pl.plane)
+	{
+		if(NOQUIET) error("planar output does not fit, should not happen");
+		return;
+	}
+	for(ch=0; ch<channels; ++ch)
+	{
+		unsigned char *out = fr->buffer.data + ch*fr->pl.plane + pos;
+		switch(size)
+		{
+			case 1:
+				for(i=0; i<count; ++i)
+					out[i] = in[i*channels+ch];
+			break;
+			case 2:
+			{
+				int16_t *o = (int16_t*)out;
+				const int16_t *s = (const int16_t*)in + ch;
+				for(i=0; i<count; ++i)
+					o[i] = s[i*channels];
+			}
+			break;
+			case 4:
+			{
+				int32_t *o = (int32_t*)out;
+				const int32_t *s = (const int32_t*)in + ch;
+				for(i=0; i<count; ++i)
+					o[i] = s[i*channels];
+			}
+			break;
+			default:
+				for(i=0; i<count; ++i)
+					memcpy(out+i*size, in+(i*channels+ch)*size, size);
+		}
+	}
+	fr->buffer.fill += count*size*channels;
+}
 
 void postprocess_buffer(mpg123_handle *fr)
 {
@@ -625,7 +717,7 @@ void postprocess_buffer(mpg123_handle *fr)
 		This caters for the final output formats that are never produced by
 		decoder synth directly (wide unsigned and 24 bit formats) or that are
 		missing because of limited decoder precision (16 bit synth but 32 or
-		24 bit output).
+		24 bit output). Each case is a single pass over the buffer.
 	*/
 	switch(fr->af.dec_enc)
 	{
@@ -637,11 +729,10 @@ void postprocess_buffer(mpg123_handle *fr)
 			conv_s32_to_u32(&fr->buffer);
 		break;
 		case MPG123_ENC_UNSIGNED_24:
-			conv_s32_to_u32(&fr->buffer);
-			chop_fourth_byte(&fr->buffer);
+			conv_s32_to_24(&fr->buffer, SIGN_FLIP);
 		break;
 		case MPG123_ENC_SIGNED_24:
-			chop_fourth_byte(&fr->buffer);
+			conv_s32_to_24(&fr->buffer, 0);
 		break;
 		}
 	break;
@@ -660,24 +751,22 @@ void postprocess_buffer(mpg123_handle *fr)
 #endif
 #ifndef NO_32BIT
 		case MPG123_ENC_SIGNED_32:
-			conv_s16_to_s32(&fr->buffer);
+			conv_s16_to_s32(&fr->buffer, 0);
 		break;
 		case MPG123_ENC_UNSIGNED_32:
-			conv_s16_to_s32(&fr->buffer);
-			conv_s32_to_u32(&fr->buffer);
+			conv_s16_to_s32(&fr->buffer, SIGN_FLIP);
 		break;
 		case MPG123_ENC_UNSIGNED_24:
-			conv_s16_to_s32(&fr->buffer);
-			conv_s32_to_u32(&fr->buffer);
-			chop_fourth_byte(&fr->buffer);
+			conv_s16_to_24(&fr->buffer, SIGN_FLIP);
 		break;
 		case MPG123_ENC_SIGNED_24:
-			conv_s16_to_s32(&fr->buffer);
-			chop_fourth_byte(&fr->buffer);
+			conv_s16_to_24(&fr->buffer, 0);
 		break;
 #endif
 		}
 	break;
 #endif
 	}
+	if(fr->af.dec_enc != fr->af.encoding)
+		COUNTER_ADD(fr, copy_bytes, fr->buffer.fill);
 }
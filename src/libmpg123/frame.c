@@ -6,9 +6,17 @@
 	initially written by Thomas Orgis
 */
 
+/* Needed for clock_gettime() from time.h. */
+#define _POSIX_C_SOURCE 200112L
+
 #include "mpg123lib_intern.h"
 #include "getcpuflags.h"
 #include "debug.h"
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#elif defined(HAVE_SYS_TIME_H)
+#include <sys/time.h>
+#endif
 
 static void frame_fixed_reset(mpg123_handle *fr);
 
@@ -64,6 +72,9 @@ static void frame_default_pars(mpg123_pars *mp)
 	mp->feedpool = 5; 
 	mp->feedbuffer = 4096;
 #endif
+#ifdef READ_AHEAD
+	mp->readahead = 1024*1024;
+#endif
 }
 
 void frame_init(mpg123_handle *fr)
@@ -78,6 +89,10 @@ void frame_init_par(mpg123_handle *fr, mpg123_pars *mp)
 	fr->buffer.rdata = NULL;
 	fr->buffer.fill = 0;
 	fr->buffer.size = 0;
+	fr->slots = NULL;
+	fr->slotsizes = NULL;
+	fr->slotcount = 0;
+	fr->slotnext = 0;
 	fr->rawbuffs = NULL;
 	fr->rawbuffss = 0;
 	fr->rawdecwin = NULL;
@@ -98,6 +113,19 @@ void frame_init_par(mpg123_handle *fr, mpg123_pars *mp)
 	fr->ntom_val[1] = NTOM_MUL>>1;
 	fr->ntom_step = NTOM_MUL;
 #endif
+#ifdef RESAMPLER
+	fr->rs.in_rate = fr->rs.out_rate = 0;
+	fr->rs.n = fr->rs.m = 1;
+	fr->rs.taps = fr->rs.delay = 0;
+	fr->rs.coeffs = NULL;
+	fr->rs.in = NULL;
+	fr->rs.hist = NULL;
+	fr->rs.bytes = 0;
+	fr->rs.next = -1;
+#endif
+	fr->an.what = 0;
+	fr->an.data = NULL;
+	pcmcache_init(fr);
 	/* unnecessary: fr->buffer.size = fr->buffer.fill = 0; */
 	mpg123_reset_eq(fr);
 	init_icy(&fr->icy);
@@ -112,6 +140,13 @@ void frame_init_par(mpg123_handle *fr, mpg123_pars *mp)
 	fr->rdat.r_read_handle = NULL;
 	fr->rdat.r_lseek_handle = NULL;
 	fr->rdat.cleanup_handle = NULL;
+	fr->rdat.framebody = NULL;
+#ifdef READ_MMAP
+	fr->rdat.map = NULL;
+#endif
+#ifdef READ_AHEAD
+	fr->rdat.ahead = NULL;
+#endif
 	fr->wrapperdata = NULL;
 	fr->wrapperclean = NULL;
 	fr->decoder_change = 1;
@@ -132,6 +167,22 @@ void frame_init_par(mpg123_handle *fr, mpg123_pars *mp)
 	fi_init(&fr->index);
 	frame_index_setup(fr); /* Apply the size setting. */
 #endif
+#ifdef DECODER_COUNTERS
+	memset(&fr->counters, 0, sizeof(fr->counters));
+#endif
+}
+
+double counter_clock(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + 1e-9*now.tv_nsec;
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (double)now.tv_sec + 1e-6*now.tv_usec;
+#endif
 }
 
 #ifdef OPT_DITHER
@@ -229,6 +280,22 @@ int attribute_align_arg mpg123_replace_buffer(mpg123_handle *mh, unsigned char *
 	return MPG123_OK;
 }
 
+int attribute_align_arg mpg123_set_slots(mpg123_handle *mh, unsigned char **slots, size_t *sizes, size_t count)
+{
+	debug2("set %"SIZE_P" output slots at %p", (size_p)count, (void*)slots);
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	if(count > 0 && (slots == NULL || sizes == NULL))
+	{
+		mh->err = MPG123_BAD_BUFFER;
+		return MPG123_ERR;
+	}
+	mh->slots     = count > 0 ? slots : NULL;
+	mh->slotsizes = count > 0 ? sizes : NULL;
+	mh->slotcount = count;
+	mh->slotnext  = 0;
+	return MPG123_OK;
+}
+
 #ifdef FRAME_INDEX
 int frame_index_setup(mpg123_handle *fr)
 {
@@ -259,6 +326,23 @@ static void frame_decode_buffers_reset(mpg123_handle *fr)
 	memset(fr->rawbuffs, 0, fr->rawbuffss);
 }
 
+/* Size of the layer scratch block, including slack for 64 byte alignment. */
+static size_t layerscratch_size(void)
+{
+	size_t scratchsize = 0;
+#ifndef NO_LAYER1
+	scratchsize += sizeof(real) * 2 * SBLIMIT;
+#endif
+#ifndef NO_LAYER2
+	scratchsize += sizeof(real) * 2 * 4 * SBLIMIT;
+#endif
+#ifndef NO_LAYER3
+	scratchsize += sizeof(real) * 2 * SBLIMIT * SSLIMIT; /* hybrid_in */
+	scratchsize += sizeof(real) * 2 * SSLIMIT * SBLIMIT; /* hybrid_out */
+#endif
+	return scratchsize+63;
+}
+
 int frame_buffers(mpg123_handle *fr)
 {
 	int buffssize = 0;
@@ -385,23 +469,12 @@ int frame_buffers(mpg123_handle *fr)
 	if(fr->layerscratch == NULL)
 	{
 		/* Allocate specific layer1/2/3 buffers, so that we know they'll work for SSE. */
-		size_t scratchsize = 0;
 		real *scratcher;
-#ifndef NO_LAYER1
-		scratchsize += sizeof(real) * 2 * SBLIMIT;
-#endif
-#ifndef NO_LAYER2
-		scratchsize += sizeof(real) * 2 * 4 * SBLIMIT;
-#endif
-#ifndef NO_LAYER3
-		scratchsize += sizeof(real) * 2 * SBLIMIT * SSLIMIT; /* hybrid_in */
-		scratchsize += sizeof(real) * 2 * SSLIMIT * SBLIMIT; /* hybrid_out */
-#endif
 		/*
 			Now figure out correct alignment:
 			We need 16 byte minimum, smallest unit of the blocks is 2*SBLIMIT*sizeof(real), which is 64*4=256. Let's do 64bytes as heuristic for cache line (as proven useful in buffs above).
 		*/
-		fr->layerscratch = malloc(scratchsize+63);
+		fr->layerscratch = malloc(layerscratch_size());
 		if(fr->layerscratch == NULL) return -1;
 
 		/* Get aligned part of the memory, then divide it up. */
@@ -445,6 +518,9 @@ int frame_buffers_reset(mpg123_handle *fr)
 	memset(fr->ssave, 0, 34);
 	fr->hybrid_blc[0] = fr->hybrid_blc[1] = 0;
 	memset(fr->hybrid_block, 0, sizeof(real)*2*2*SBLIMIT*SSLIMIT);
+#ifdef RESAMPLER
+	fr->rs.next = -1; /* Forget the filter history, too. */
+#endif
 	return 0;
 }
 
@@ -530,9 +606,11 @@ static void frame_fixed_reset(mpg123_handle *fr)
 	fr->rva.gain[1] = 0;
 	fr->rva.peak[0] = 0;
 	fr->rva.peak[1] = 0;
+	fr->loud.valid = 0;
 	fr->fsizeold = 0;
 	fr->firstframe = 0;
 	fr->ignoreframe = fr->firstframe-fr->p.preframes;
+	fr->seek_frames = 0;
 	fr->header_change = 0;
 	fr->lastframe = -1;
 	fr->fresh = 1;
@@ -561,6 +639,37 @@ static void frame_fixed_reset(mpg123_handle *fr)
 	fr->freeformat_framesize = -1;
 }
 
+size_t frame_resident_bytes(mpg123_handle *fr)
+{
+	size_t bytes = sizeof(*fr);
+
+	bytes += fr->rawbuffss + fr->rawdecwins;
+	if(fr->layerscratch != NULL) bytes += layerscratch_size();
+	if(fr->buffer.rdata != NULL) bytes += fr->buffer.size+15;
+#ifndef NO_8BIT
+	if(fr->conv16to8_buf != NULL) bytes += 8192;
+#endif
+#ifdef OPT_DITHER
+	if(fr->dithernoise != NULL) bytes += sizeof(float)*DITHERSIZE;
+#endif
+#ifdef FRAME_INDEX
+	if(fr->index.data != NULL) bytes += fr->index.size*sizeof(off_t);
+#endif
+	if(fr->xing_toc != NULL) bytes += 100;
+#ifndef NO_FEEDER
+	bytes += bc_mem(&fr->rdat.buffer);
+#endif
+#ifdef RESAMPLER
+	bytes += fr->rs.bytes;
+#endif
+#ifdef READ_AHEAD
+	if(fr->rdat.ahead != NULL) bytes += ahead_mem(fr->rdat.ahead);
+#endif
+	if(fr->an.data != NULL) bytes += sizeof(float)*ANALYSIS_VALUES;
+	bytes += pcmcache_mem(fr);
+	return bytes;
+}
+
 static void frame_free_buffers(mpg123_handle *fr)
 {
 	if(fr->rawbuffs != NULL) free(fr->rawbuffs);
@@ -586,6 +695,10 @@ void frame_exit(mpg123_handle *fr)
 	fr->buffer.rdata = NULL;
 	frame_free_buffers(fr);
 	frame_free_toc(fr);
+#ifdef RESAMPLER
+	resample_free(fr);
+#endif
+	analysis_free(fr);
 #ifdef FRAME_INDEX
 	fi_exit(&fr->index);
 #endif
@@ -686,25 +799,20 @@ off_t frame_index_find(mpg123_handle *fr, off_t want_frame, off_t* get_frame)
 	/* Possibly use VBRI index, too? I'd need an example for this... */
 	if(fr->index.fill)
 	{
-		/* find in index */
-		size_t fi;
-		/* at index fi there is frame step*fi... */
-		fi = want_frame/fr->index.step;
-		if(fi >= fr->index.fill) /* If we are beyond the end of frame index...*/
+		/* Closest position from coarse index or recorded seek points. */
+		off_t ipos;
+		off_t iframe;
+		fi_find(&fr->index, want_frame, &iframe, &ipos);
+		/* When fuzzy seek is allowed, we have some limited tolerance for the frames we want to read rather then jump over. */
+		if(fr->p.flags & MPG123_FUZZY && want_frame - iframe > 10 && want_frame/fr->index.step >= (off_t)fr->index.fill)
 		{
-			/* When fuzzy seek is allowed, we have some limited tolerance for the frames we want to read rather then jump over. */
-			if(fr->p.flags & MPG123_FUZZY && want_frame - (fr->index.fill-1)*fr->index.step > 10)
-			{
-				gopos = frame_fuzzy_find(fr, want_frame, get_frame);
-				if(gopos > fr->audio_start) return gopos; /* Only in that case, we have a useful guess. */
-				/* Else... just continue, fuzzyness didn't help. */
-			}
-			/* Use the last available position, slowly advancing from that one. */
-			fi = fr->index.fill - 1;
+			gopos = frame_fuzzy_find(fr, want_frame, get_frame);
+			if(gopos > fr->audio_start) return gopos; /* Only in that case, we have a useful guess. */
+			/* Else... just continue, fuzzyness didn't help. */
 		}
 		/* We have index position, that yields frame and byte offsets. */
-		*get_frame = fi*fr->index.step;
-		gopos = fr->index.data[fi];
+		*get_frame = iframe;
+		gopos = ipos;
 		fr->state_flags |= FRAME_ACCURATE; /* When using the frame index, we are accurate. */
 	}
 	else
@@ -736,6 +844,9 @@ off_t frame_ins2outs(mpg123_handle *fr, off_t ins)
 		break;
 #		ifndef NO_NTOM
 		case 3: outs = ntom_ins2outs(fr, ins); break;
+#		endif
+#		ifdef RESAMPLER
+		case 4: outs = resample_ins2outs(fr, ins); break;
 #		endif
 		default: error1("Bad down_sample (%i) ... should not be possible!!", fr->down_sample);
 	}
@@ -756,6 +867,9 @@ off_t frame_outs(mpg123_handle *fr, off_t num)
 		break;
 #ifndef NO_NTOM
 		case 3: outs = ntom_frmouts(fr, num); break;
+#endif
+#ifdef RESAMPLER
+		case 4: outs = resample_frmouts(fr, num); break;
 #endif
 		default: error1("Bad down_sample (%i) ... should not be possible!!", fr->down_sample);
 	}
@@ -778,6 +892,9 @@ off_t frame_expect_outsamples(mpg123_handle *fr)
 		break;
 #ifndef NO_NTOM
 		case 3: outs = ntom_frame_outsamples(fr); break;
+#endif
+#ifdef RESAMPLER
+		case 4: outs = resample_frame_outsamples(fr); break;
 #endif
 		default: error1("Bad down_sample (%i) ... should not be possible!!", fr->down_sample);
 	}
@@ -798,6 +915,9 @@ off_t frame_offset(mpg123_handle *fr, off_t outs)
 		break;
 #ifndef NO_NTOM
 		case 3: num = ntom_frameoff(fr, outs); break;
+#endif
+#ifdef RESAMPLER
+		case 4: num = resample_frameoff(fr, outs); break;
 #endif
 		default: error("Bad down_sample ... should not be possible!!");
 	}
@@ -825,11 +945,17 @@ void frame_gapless_init(mpg123_handle *fr, off_t framecount, off_t bskip, off_t
 
 void frame_gapless_realinit(mpg123_handle *fr)
 {
-	fr->begin_os = frame_ins2outs(fr, fr->begin_s);
-	fr->end_os   = frame_ins2outs(fr, fr->end_s);
+	off_t delay = 0;
+#ifdef RESAMPLER
+	/* The resampler output lags behind by its filter delay. */
+	if(fr->down_sample == 4 && fr->end_s > 0) delay = fr->rs.delay;
+#endif
+	fr->begin_os = frame_ins2outs(fr, fr->begin_s+delay);
+	fr->end_os   = frame_ins2outs(fr, fr->end_s+delay);
 	if(fr->gapless_frames > 0)
 	fr->fullend_os = frame_ins2outs(fr, fr->gapless_frames*fr->spf);
 	else fr->fullend_os = 0;
+	if(delay && fr->end_os > fr->fullend_os) fr->end_os = fr->fullend_os;
 
 	debug4("frame_gapless_realinit: from %"OFF_P" to %"OFF_P" samples (%"OFF_P", %"OFF_P")", (off_p)fr->begin_os, (off_p)fr->end_os, (off_p)fr->fullend_os, (off_p)fr->gapless_frames);
 }
@@ -866,6 +992,11 @@ static off_t ignoreframe(mpg123_handle *fr)
 	if(fr->lay==3 && preshift < 1) preshift = 1;
 	/* Layer 1 & 2 reall do not need more than 2. */
 	if(fr->lay!=3 && preshift > 2) preshift = 2;
+#ifdef RESAMPLER
+	/* The resampler needs its filter history filled, too. */
+	if(fr->down_sample == 4 && preshift < resample_preframes(fr))
+	preshift = resample_preframes(fr);
+#endif
 
 	return fr->firstframe - preshift;
 }
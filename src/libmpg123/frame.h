@@ -20,6 +20,8 @@
 #include "index.h"
 #endif
 #include "synths.h"
+#include "pcmcache.h"
+#include "counters.h"
 
 #ifdef OPT_DITHER
 #include "dither.h"
@@ -53,6 +55,7 @@ struct audioformat
 	int dec_encsize; /* Size of one decoder sample. */
 	int channels;
 	long rate;
+	int planar; /* MPG123_PLANAR for more than one channel */
 };
 
 void invalidate_format(struct audioformat *af);
@@ -84,6 +87,9 @@ struct mpg123_pars_struct
 	long feedpool;
 	long feedbuffer;
 #endif
+#ifdef READ_AHEAD
+	long readahead; /* window size */
+#endif
 };
 
 enum frame_state_flags
@@ -133,21 +139,51 @@ struct mpg123_handle_struct
 	unsigned char *conv16to8_buf;
 	unsigned char *conv16to8;
 #endif
-	/* There's some possible memory saving for stuff that is not _really_ dynamic. */
+	/* Tables that are not _really_ dynamic, shared between handles, pointing to static storage. */
 
 	/* layer3 */
-	int longLimit[9][23];
-	int shortLimit[9][14];
-	real gainpow2[256+118+4]; /* not really dynamic, just different for mmx */
+	real *gainpow2; /* [256+118+4], just different for mmx */
 
 	/* layer2 */
-	real muls[27][64];	/* also used by layer 1 */
+	real (*muls)[64]; /* [27][64], also used by layer 1 */
 
 #ifndef NO_NTOM
 	/* decode_ntom */
 	unsigned long ntom_val[2];
 	unsigned long ntom_step;
 #endif
+#ifdef RESAMPLER
+	/* polyphase resampler, see resample.c */
+	struct
+	{
+		long in_rate;  /* rates the filter has been computed for */
+		long out_rate;
+		long n, m;     /* reduced ratio: n input samples for m output samples */
+		long taps;     /* filter length, multiple of 8 */
+		long delay;    /* filter latency in input samples, taps/2 */
+		long phases;   /* coefficient rows: m for exact phases, else interpolated */
+		int exact;
+		int format;    /* enum synth_format of the stored samples */
+		real *coeffs;  /* rows of taps coefficients */
+		real *in;      /* interleaved full rate synth output of one frame */
+		real *hist;    /* per channel: taps samples of history, then one frame */
+		size_t bytes;  /* memory allocated for the above */
+		off_t next;    /* frame expected next, continuing the history */
+		long pos;      /* input position of next output, relative to frame start */
+		long phase;    /* fractional part of that, in units of 1/m */
+	} rs;
+#endif
+	/* analysis decoding, see analysis.c */
+	struct
+	{
+		int what;      /* enum mpg123_analysis while analysing, 0 otherwise */
+		float *data;   /* one frame: blocks of channels*width values */
+		size_t fill;   /* values stored */
+		int width;     /* values per channel in a block */
+		int channels;
+		float scale;   /* undoing 16 bit scaling in MMX/SSE tables */
+		short longlines[4]; /* layer III spectrum: long block lines of each block */
+	} an;
 	/* special i486 fun */
 #ifdef OPT_I486
 	int *int_buffs[2][2];
@@ -179,6 +215,13 @@ struct mpg123_handle_struct
 	func_synth synth;
 	func_synth_stereo synth_stereo;
 	func_synth_mono synth_mono;
+	/* Planar output: the synths behind the ones that split into planes. */
+	struct
+	{
+		func_synth_stereo stereo;
+		func_synth_mono mono;
+		size_t plane; /* bytes of one channel in the current frame */
+	} pl;
 	/* Yes, this function is runtime-switched, too. */
 	void (*make_decode_tables)(mpg123_handle *fr); /* That is the volume control. */
 
@@ -239,6 +282,14 @@ struct mpg123_handle_struct
 		float gain[2];
 		float peak[2];
 	} rva;
+	/* Measured by mpg123_scan() with MPG123_SCAN_LOUDNESS. */
+	struct
+	{
+		int valid;
+		double integrated; /* LUFS */
+		double peak; /* linear */
+	} loud;
+	struct pcmcache_state pc;
 
 	/* input data */
 	off_t track_frames;
@@ -260,17 +311,26 @@ struct mpg123_handle_struct
 #ifdef FRAME_INDEX
 	struct frame_index index;
 #endif
+#ifdef DECODER_COUNTERS
+	struct decoder_counters counters; /* over the lifetime of the handle */
+#endif
 
 	/* output data */
 	struct outbuffer buffer;
 	struct audioformat af;
 	int own_buffer;
+	/* Caller-owned output slots for mpg123_decode_slot(). */
+	unsigned char **slots;
+	size_t *slotsizes;
+	size_t slotcount;
+	size_t slotnext;
 	size_t outblock; /* number of bytes that this frame produces (upper bound) */
 	int to_decode;   /* this frame holds data to be decoded */
 	int to_ignore;   /* the same, somehow */
 	off_t firstframe;  /* start decoding from here */
 	off_t lastframe;   /* last frame to decode (for gapless or num_frames limit) */
 	off_t ignoreframe; /* frames to decode but discard before firstframe */
+	off_t seek_frames; /* frames read forward from the index position in the last seek */
 #ifdef GAPLESS
 	off_t gapless_frames; /* frame count for the gapless part */
 	off_t firstoff; /* number of samples to ignore from firstframe */
@@ -346,6 +406,7 @@ int frame_buffers(mpg123_handle *fr); /* various decoder buffers, needed once */
 int frame_reset(mpg123_handle* fr);   /* reset for next track */
 int frame_buffers_reset(mpg123_handle *fr);
 void frame_exit(mpg123_handle *fr);   /* end, free all buffers */
+size_t frame_resident_bytes(mpg123_handle *fr); /* memory owned by this handle */
 
 /* Index functions... */
 /* Well... print it... */
@@ -55,6 +55,16 @@ static off_t sample_unadjust(mpg123_handle *mh, off_t x)
 	Take the buffer after a frame decode (strictly: it is the data from frame fr->num!) and cut samples out.
 	fr->buffer.fill may then be smaller than before...
 */
+/* Planar output: Keep keep bytes from skip on of each plane, packed together again. */
+static void planar_cut(mpg123_handle *fr, size_t skip, size_t keep)
+{
+	size_t plane = fr->buffer.fill/fr->af.channels;
+	int ch;
+	for(ch=0; ch<fr->af.channels; ++ch)
+		memmove(fr->buffer.p + ch*keep, fr->buffer.p + ch*plane + skip, keep);
+	fr->buffer.fill = keep*fr->af.channels;
+}
+
 static void frame_buffercheck(mpg123_handle *fr)
 {
 	/* When we have no accurate position, gapless code does not make sense. */
@@ -77,6 +87,9 @@ static void frame_buffercheck(mpg123_handle *fr)
 		off_t byteoff = (fr->num == fr->lastframe) ? samples_to_bytes(fr, fr->lastoff) : 0;
 		if((off_t)fr->buffer.fill > byteoff)
 		{
+			if(fr->af.planar)
+				planar_cut(fr, 0, (size_t)byteoff/fr->af.channels);
+			else
 			fr->buffer.fill = byteoff;
 		}
 		if(VERBOSE3) fprintf(stderr, "\nNote: Cut frame %"OFF_P" buffer on end of stream to %"OFF_P" samples, fill now %"SIZE_P" bytes.\n", (off_p)fr->num, (off_p)(fr->num == fr->lastframe ? fr->lastoff : 0), (size_p)fr->buffer.fill);
@@ -86,7 +99,12 @@ static void frame_buffercheck(mpg123_handle *fr)
 	if(fr->firstoff && fr->num == fr->firstframe)
 	{
 		off_t byteoff = samples_to_bytes(fr, fr->firstoff);
-		if((off_t)fr->buffer.fill > byteoff)
+		if((off_t)fr->buffer.fill > byteoff && fr->af.planar)
+		{
+			size_t skip = (size_t)byteoff/fr->af.channels;
+			planar_cut(fr, skip, fr->buffer.fill/fr->af.channels - skip);
+		}
+		else if((off_t)fr->buffer.fill > byteoff)
 		{
 			fr->buffer.fill -= byteoff;
 			/* buffer.p != buffer.data only for own buffer */
@@ -44,6 +44,8 @@ void fi_init(struct frame_index *fi)
 	fi->size = 0;
 	fi->grow_size = 0;
 	fi->next = fi_next(fi);
+	fi->pt_fill = 0;
+	fi->pt_clock = 0;
 }
 
 void fi_exit(struct frame_index *fi)
@@ -122,6 +124,7 @@ int fi_set(struct frame_index *fi, off_t *offsets, off_t step, size_t fill)
 		fi->fill = 0;
 	}
 	fi->next = fi_next(fi);
+	fi->pt_fill = 0;
 	debug3("set new index of fill %lu, size %lu at %p",
 	(unsigned long)fi->fill, (unsigned long)fi->size, (void*)fi->data);
 	return 0;
@@ -133,4 +136,81 @@ void fi_reset(struct frame_index *fi)
 	fi->fill = 0;
 	fi->step = 1;
 	fi->next = fi_next(fi);
+	fi->pt_fill = 0;
+}
+
+/* Index of the last seek point with frame <= want_frame, or -1. */
+static long fi_point_search(struct frame_index *fi, off_t want_frame)
+{
+	long lo = 0;
+	long hi = (long)fi->pt_fill - 1;
+	while(lo <= hi)
+	{
+		long mid = lo + (hi-lo)/2;
+		if(fi->pt_frame[mid] <= want_frame) lo = mid+1;
+		else hi = mid-1;
+	}
+	return hi;
+}
+
+void fi_point_add(struct frame_index *fi, off_t frame, off_t pos)
+{
+	long i = fi_point_search(fi, frame);
+	size_t c;
+
+	/* Coarse index has this one already. */
+	if(frame % fi->step == 0 && (size_t)(frame/fi->step) < fi->fill)
+	return;
+	if(i >= 0 && fi->pt_frame[i] == frame)
+	{
+		fi->pt_pos[i] = pos;
+		fi->pt_used[i] = ++fi->pt_clock;
+		return;
+	}
+	if(fi->pt_fill == FI_POINTS)
+	{ /* Drop the least recently used point. */
+		size_t old = 0;
+		for(c = 1; c < fi->pt_fill; ++c)
+		if(fi->pt_used[c] < fi->pt_used[old]) old = c;
+		for(c = old; c+1 < fi->pt_fill; ++c)
+		{
+			fi->pt_frame[c] = fi->pt_frame[c+1];
+			fi->pt_pos[c]   = fi->pt_pos[c+1];
+			fi->pt_used[c]  = fi->pt_used[c+1];
+		}
+		--fi->pt_fill;
+		if((long)old <= i) --i;
+	}
+	/* Insert after i. */
+	for(c = fi->pt_fill; (long)c > i+1; --c)
+	{
+		fi->pt_frame[c] = fi->pt_frame[c-1];
+		fi->pt_pos[c]   = fi->pt_pos[c-1];
+		fi->pt_used[c]  = fi->pt_used[c-1];
+	}
+	fi->pt_frame[i+1] = frame;
+	fi->pt_pos[i+1]   = pos;
+	fi->pt_used[i+1]  = ++fi->pt_clock;
+	++fi->pt_fill;
+	debug3("added seek point %li at %li (%lu points)", (long)frame, (long)pos, (unsigned long)fi->pt_fill);
+}
+
+int fi_find(struct frame_index *fi, off_t want_frame, off_t *frame, off_t *pos)
+{
+	size_t ci;
+	long pi;
+
+	if(!fi->fill) return -1;
+	ci = want_frame/fi->step;
+	if(ci >= fi->fill) ci = fi->fill - 1;
+	*frame = (off_t)ci*fi->step;
+	*pos   = fi->data[ci];
+	pi = fi_point_search(fi, want_frame);
+	if(pi >= 0 && fi->pt_frame[pi] > *frame)
+	{
+		*frame = fi->pt_frame[pi];
+		*pos   = fi->pt_pos[pi];
+		fi->pt_used[pi] = ++fi->pt_clock;
+	}
+	return 0;
 }
@@ -15,6 +15,12 @@
 	In this manner we maintain a good resolution with the given
 	maximum index size while covering the whole stream.
 
+	On top of that, a small table of exact seek points keeps the positions
+	of frames that seeks actually went to, sorted by frame number. A later
+	seek into the same region starts from the closest of those instead of
+	the possibly far away coarse entry. When that table is full, the entry
+	used least recently is replaced.
+
 	copyright 2007-8 by the mpg123 project - free software under the terms of the LGPL 2.1
 	see COPYING and AUTHORS files in distribution or http://mpg123.org
 	initially written by Thomas Orgis
@@ -23,6 +29,8 @@
 #include "config.h"
 #include "compat.h"
 
+#define FI_POINTS 64
+
 struct frame_index
 {
 	off_t *data; /* actual data, the frame positions */
@@ -31,6 +39,12 @@ struct frame_index
 	size_t size; /* total number of possible entries */
 	size_t fill; /* number of used entries */
 	size_t grow_size; /* if > 0: index allowed to grow on need with these steps, instead of lowering resolution */
+	/* Exact seek points, sorted by frame number. */
+	off_t pt_frame[FI_POINTS];
+	off_t pt_pos[FI_POINTS];
+	unsigned long pt_used[FI_POINTS]; /* pt_clock value of last use */
+	size_t pt_fill;
+	unsigned long pt_clock;
 };
 
 /* The condition for a framenum to be appended to the index. 
@@ -56,4 +70,12 @@ int fi_set(struct frame_index *fi, off_t *offsets, off_t step, size_t fill);
 /* Empty the index (setting fill=0 and step=1), but keep current size. */
 void fi_reset(struct frame_index *fi);
 
+/* Remember the exact position of a frame that a seek went to. */
+void fi_point_add(struct frame_index *fi, off_t frame, off_t pos);
+
+/* Find the closest known frame at or before want_frame, from the coarse
+   index or the seek points. Returns 0 and stores frame number and byte
+   position on success, -1 if the index is empty. */
+int fi_find(struct frame_index *fi, off_t want_frame, off_t *frame, off_t *pos);
+
 #endif
@@ -166,6 +166,7 @@ int do_layer1(mpg123_handle *fr)
 	if(stereo == 1 || single == SINGLE_MIX) /* I don't see mixing handled here */
 	single = SINGLE_LEFT;
 
+	COUNTER_START(fr);
 	if(I_step_one(balloc,scale_index,fr))
 	{
 		if(NOQUIET) error("Aborting layer I decoding after step one.\n");
@@ -175,11 +176,13 @@ int do_layer1(mpg123_handle *fr)
 	for(i=0;i<SCALE_BLOCK;i++)
 	{
 		I_step_two(fraction,balloc,scale_index,fr);
+		COUNTER_STAGE(fr, dequant_time);
 
 		if(single != SINGLE_STEREO)
 		clip += (fr->synth_mono)(fraction[single], fr);
 		else
 		clip += (fr->synth_stereo)(fraction[0], fraction[1], fr);
+		COUNTER_STAGE(fr, synth_time);
 	}
 
 	return clip;
@@ -36,6 +36,23 @@ static const double mulmul[27] =
 };
 #endif
 
+/*
+	The dequantization tables only depend on the decoder class and are shared
+	by all handles: variant 0 for the normal decoders, 1 and 2 for MMX/SSE ones
+	without and with downsampling.
+*/
+#ifdef OPT_MMXORSSE
+#define MULS_VARIANTS 3
+#else
+#define MULS_VARIANTS 1
+#endif
+static real muls_tabs[MULS_VARIANTS][27][64];
+
+static real* init_layer12_table(real *table, int m);
+#ifdef OPT_MMXORSSE
+static real* init_layer12_table_mmx(int down_sample, real *table, int m);
+#endif
+
 void init_layer12(void)
 {
 	const int base[3][9] =
@@ -62,20 +79,30 @@ void init_layer12(void)
 			*itable++ = base[i][j];
 		}
 	}
+
+	for(k=0;k<27;k++)
+	{
+		*init_layer12_table(muls_tabs[0][k], k) = 0.0;
+#ifdef OPT_MMXORSSE
+		*init_layer12_table_mmx(0, muls_tabs[1][k], k) = 0.0;
+		*init_layer12_table_mmx(1, muls_tabs[2][k], k) = 0.0;
+#endif
+	}
 }
 
-void init_layer12_stuff(mpg123_handle *fr, real* (*init_table)(mpg123_handle *fr, real *table, int m))
+void init_layer12_stuff(mpg123_handle *fr, int mmx)
 {
-	int k;
-	real *table;
-	for(k=0;k<27;k++)
+#ifdef OPT_MMXORSSE
+	if(mmx)
 	{
-		table = init_table(fr, fr->muls[k], k);
-		*table++ = 0.0;
+		fr->muls = muls_tabs[fr->p.down_sample ? 2 : 1];
+		return;
 	}
+#endif
+	fr->muls = muls_tabs[0];
 }
 
-real* init_layer12_table(mpg123_handle *fr, real *table, int m)
+static real* init_layer12_table(real *table, int m)
 {
 #if defined(REAL_IS_FIXED) && defined(PRECALC_TABLES)
 	int i;
@@ -91,10 +118,10 @@ real* init_layer12_table(mpg123_handle *fr, real *table, int m)
 }
 
 #ifdef OPT_MMXORSSE
-real* init_layer12_table_mmx(mpg123_handle *fr, real *table, int m)
+static real* init_layer12_table_mmx(int down_sample, real *table, int m)
 {
 	int i,j;
-	if(!fr->p.down_sample) 
+	if(!down_sample) 
 	{
 		for(j=3,i=0;i<63;i++,j--)
 			*table++ = DOUBLE_TO_REAL(16384 * mulmul[m] * pow(2.0,(double) j / 3.0));
@@ -351,11 +378,13 @@ int do_layer2(mpg123_handle *fr)
 	if(stereo == 1 || single == SINGLE_MIX) /* also, mix not really handled */
 	single = SINGLE_LEFT;
 
+	COUNTER_START(fr);
 	II_step_one(bit_alloc, scale, fr);
 
 	for(i=0;i<SCALE_BLOCK;i++)
 	{
 		II_step_two(bit_alloc,fraction,scale,fr,i>>2);
+		COUNTER_STAGE(fr, dequant_time);
 		for(j=0;j<3;j++) 
 		{
 			if(single != SINGLE_STEREO)
@@ -363,6 +392,7 @@ int do_layer2(mpg123_handle *fr)
 			else
 			clip += (fr->synth_stereo)(fraction[0][j], fraction[1][j], fr);
 		}
+		COUNTER_STAGE(fr, synth_time);
 	}
 
 	return clip;
@@ -18,6 +18,8 @@
 #ifdef USE_NEW_HUFFTABLE
 #include "newhuffman.h"
 #else
+/* The lookup tables are derived from the radix-4 ones. */
+#undef USE_HUFFMAN_LOOKUP
 #include "huffman.h"
 #endif
 #include "getbits.h"
@@ -51,6 +53,21 @@ static real pow1_1[2][16],pow2_1[2][16],pow1_2[2][16],pow2_2[2][16];
 #endif
 #endif
 
+#ifdef USE_HUFFMAN_LOOKUP
+/*
+	Multi-bit lookup on top of the radix-4 tables: One primary lookup on the
+	next 8 bits either gives the final value (same format as the radix-4
+	leaves, with the code length of up to 8 bits in the upper byte) or the
+	negated offset of the radix-4 subtable to continue with after 8 bits.
+	The count1 codes are at most 6 bits long and fully covered by one lookup,
+	entries are (length<<4)|quad.
+*/
+#define HUFF_PRIMARY_BITS 8
+static short huff_pool[16][1<<HUFF_PRIMARY_BITS];
+static const short *huff_primary[32];
+static unsigned char huffc_lookup[2][64];
+#endif
+
 /* Decoder state data, living on the stack of do_layer3. */
 
 struct gr_info_s
@@ -159,17 +176,32 @@ static int *mapend[9][3];
 static unsigned int n_slen2[512]; /* MPEG 2.0 slen for 'normal' mode */
 static unsigned int i_slen2[256]; /* MPEG 2.0 slen for intensity stereo */
 
+/*
+	Tables that only depend on the decoder class, shared by all handles.
+	Variant 0 is for the normal decoders, 1 and 2 for MMX/SSE ones without and
+	with downsampling. The band limits are stored for the full subband range
+	and clipped to the downsampling limit on use.
+*/
+#ifdef OPT_MMXORSSE
+#define GAINPOW2_VARIANTS 3
+#else
+#define GAINPOW2_VARIANTS 1
+#endif
+static real gainpow2_tabs[GAINPOW2_VARIANTS][256+118+4];
+static int longLimit[9][23];
+static int shortLimit[9][14];
+
 /* Some helpers used in init_layer3 */
 
 #ifdef OPT_MMXORSSE
-real init_layer3_gainpow2_mmx(mpg123_handle *fr, int i)
+static real init_layer3_gainpow2_mmx(int down_sample, int i)
 {
-	if(!fr->p.down_sample) return DOUBLE_TO_REAL(16384.0 * pow((double)2.0,-0.25 * (double) (i+210) ));
+	if(!down_sample) return DOUBLE_TO_REAL(16384.0 * pow((double)2.0,-0.25 * (double) (i+210) ));
 	else return DOUBLE_TO_REAL(pow((double)2.0,-0.25 * (double) (i+210)));
 }
 #endif
 
-real init_layer3_gainpow2(mpg123_handle *fr, int i)
+static real init_layer3_gainpow2(int i)
 {
 #if defined(REAL_IS_FIXED) && defined(PRECALC_TABLES)
 	return gainpow2[i+256];
@@ -180,6 +212,62 @@ real init_layer3_gainpow2(mpg123_handle *fr, int i)
 
 
 /* init tables for layer-3 ... specific with the downsampling... */
+#ifdef USE_HUFFMAN_LOOKUP
+static void init_huffman_lookup(void)
+{
+	int i,j,p;
+	int pools = 0;
+
+	for(i=0;i<32;i++)
+	{
+		const short *table = ht[i].table;
+		short *prim;
+		/* Tables with linbits variants share the code tree. */
+		for(j=0;j<i;j++)
+		if(ht[j].table == table)
+		{
+			huff_primary[i] = huff_primary[j];
+			break;
+		}
+		if(j < i) continue;
+
+		prim = huff_pool[pools++];
+		for(p=0;p<(1<<HUFF_PRIMARY_BITS);p++)
+		{
+			const short *val = table;
+			short y = 0;
+			int step;
+			for(step=0;step<HUFF_PRIMARY_BITS/4;step++)
+			{
+				y = val[(p>>(HUFF_PRIMARY_BITS-4-4*step)) & 0xf];
+				if(y >= 0) break;
+				val -= y;
+			}
+			if(y >= 0)
+				prim[p] = (short)(((4*step + (y>>8))<<8) | (y & 0xff));
+			else
+				prim[p] = (short)-(val-table);
+		}
+		huff_primary[i] = prim;
+	}
+
+	for(i=0;i<2;i++)
+	for(p=0;p<64;p++)
+	{
+		const short *val = htc[i].table;
+		short a;
+		int len = 0;
+		while((a=*val++)<0)
+		{
+			if((p>>(5-len)) & 1) val -= a;
+
+			len++;
+		}
+		huffc_lookup[i][p] = (unsigned char)((len<<4) | a);
+	}
+}
+#endif
+
 void init_layer3(void)
 {
 	int i,j,k,l;
@@ -327,6 +415,25 @@ void init_layer3(void)
 		}
 		mapend[j][2] = mp;
 	}
+	for(i=-256;i<118+4;i++)
+	{
+		gainpow2_tabs[0][i+256] = init_layer3_gainpow2(i);
+#ifdef OPT_MMXORSSE
+		gainpow2_tabs[1][i+256] = init_layer3_gainpow2_mmx(0, i);
+		gainpow2_tabs[2][i+256] = init_layer3_gainpow2_mmx(1, i);
+#endif
+	}
+
+	for(j=0;j<9;j++)
+	{
+		for(i=0;i<23;i++)
+		longLimit[j][i] = (bandInfo[j].longIdx[i] - 1 + 8) / 18 + 1;
+		for(i=0;i<14;i++)
+		shortLimit[j][i] = (bandInfo[j].shortIdx[i] - 1) / 18 + 1;
+	}
+#ifdef USE_HUFFMAN_LOOKUP
+	init_huffman_lookup();
+#endif
 
 	/* Now for some serious loopings! */
 	for(i=0;i<5;i++)
@@ -368,27 +475,16 @@ void init_layer3(void)
 }
 
 
-void init_layer3_stuff(mpg123_handle *fr, real (*gainpow2)(mpg123_handle *fr, int i))
+void init_layer3_stuff(mpg123_handle *fr, int mmx)
 {
-	int i,j;
-
-	for(i=-256;i<118+4;i++)	fr->gainpow2[i+256] = gainpow2(fr,i);
-
-	for(j=0;j<9;j++)
+#ifdef OPT_MMXORSSE
+	if(mmx)
 	{
-		for(i=0;i<23;i++)
-		{
-			fr->longLimit[j][i] = (bandInfo[j].longIdx[i] - 1 + 8) / 18 + 1;
-			if(fr->longLimit[j][i] > (fr->down_sample_sblimit) )
-			fr->longLimit[j][i] = fr->down_sample_sblimit;
-		}
-		for(i=0;i<14;i++)
-		{
-			fr->shortLimit[j][i] = (bandInfo[j].shortIdx[i] - 1) / 18 + 1;
-			if(fr->shortLimit[j][i] > (fr->down_sample_sblimit) )
-			fr->shortLimit[j][i] = fr->down_sample_sblimit;
-		}
+		fr->gainpow2 = gainpow2_tabs[fr->p.down_sample ? 2 : 1];
+		return;
 	}
+#endif
+	fr->gainpow2 = gainpow2_tabs[0];
 }
 
 /*
@@ -779,6 +875,9 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 		{
 			int lp = l[i];
 			const struct newhuff *h = ht+gr_info->table_select[i];
+#ifdef USE_HUFFMAN_LOOKUP
+			const short *prim = huff_primary[gr_info->table_select[i]];
+#endif
 			for(;lp;lp--,mc--)
 			{
 				register long x,y;
@@ -808,7 +907,24 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 				{
 					const short *val = h->table;
 					REFRESH_MASK;
-#ifdef USE_NEW_HUFFTABLE
+#ifdef USE_HUFFMAN_LOOKUP
+					if((y=prim[(unsigned long)mask>>BITSHIFT])<0)
+					{
+						val -= y;
+						num -= HUFF_PRIMARY_BITS;
+						mask <<= HUFF_PRIMARY_BITS;
+						while((y=val[(unsigned long)mask>>(BITSHIFT+4)])<0)
+						{
+							val -= y;
+							num -= 4;
+							mask <<= 4;
+						}
+					}
+					num -= (y >> 8);
+					mask <<= (y >> 8);
+					x = (y >> 4) & 0xf;
+					y &= 0xf;
+#elif defined(USE_NEW_HUFFTABLE)
 					while((y=val[(unsigned long)mask>>(BITSHIFT+4)])<0)
 					{
 						val -= y;
@@ -884,8 +1000,10 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 
 		for(;l3 && (part2remain+num > 0);l3--)
 		{
+#ifndef USE_HUFFMAN_LOOKUP
 			const struct newhuff* h;
 			const short* val;
+#endif
 			register short a;
 			/*
 				This is only a humble hack to prevent a special segfault.
@@ -903,10 +1021,15 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 				if(NOQUIET) error2("attempted xrpnt overflow (%p !< %p)", (void*) xrpnt, (void*) &xr[SBLIMIT][0]);
 				return 2;
 			}
+			REFRESH_MASK;
+#ifdef USE_HUFFMAN_LOOKUP
+			a = huffc_lookup[gr_info->count1table_select][(unsigned long)mask>>(BITSHIFT+2)];
+			num -= a>>4;
+			mask <<= a>>4;
+			a &= 0xf;
+#else
 			h = htc+gr_info->count1table_select;
 			val = h->table;
-
-			REFRESH_MASK;
 			while((a=*val++)<0)
 			{
 				if(mask < 0) val -= a;
@@ -914,6 +1037,7 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 				num--;
 				mask <<= 1;
 			}
+#endif
 			if(part2remain+num <= 0)
 			{
 				num -= part2remain+num;
@@ -996,7 +1120,9 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 		{
 			int rmax = max[0] > max[1] ? max[0] : max[1];
 			rmax = (rmax > max[2] ? rmax : max[2]) + 1;
-			gr_info->maxb = rmax ? fr->shortLimit[sfreq][rmax] : fr->longLimit[sfreq][max[3]+1];
+			gr_info->maxb = rmax ? shortLimit[sfreq][rmax] : longLimit[sfreq][max[3]+1];
+			if(gr_info->maxb > (unsigned int)fr->down_sample_sblimit)
+			gr_info->maxb = fr->down_sample_sblimit;
 		}
 
 	}
@@ -1015,6 +1141,9 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 		{
 			int lp = l[i];
 			const struct newhuff *h = ht+gr_info->table_select[i];
+#ifdef USE_HUFFMAN_LOOKUP
+			const short *prim = huff_primary[gr_info->table_select[i]];
+#endif
 
 			for(;lp;lp--,mc--)
 			{
@@ -1038,7 +1167,24 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 				{
 					const short *val = h->table;
 					REFRESH_MASK;
-#ifdef USE_NEW_HUFFTABLE
+#ifdef USE_HUFFMAN_LOOKUP
+					if((y=prim[(unsigned long)mask>>BITSHIFT])<0)
+					{
+						val -= y;
+						num -= HUFF_PRIMARY_BITS;
+						mask <<= HUFF_PRIMARY_BITS;
+						while((y=val[(unsigned long)mask>>(BITSHIFT+4)])<0)
+						{
+							val -= y;
+							num -= 4;
+							mask <<= 4;
+						}
+					}
+					num -= (y >> 8);
+					mask <<= (y >> 8);
+					x = (y >> 4) & 0xf;
+					y &= 0xf;
+#elif defined(USE_NEW_HUFFTABLE)
 					while((y=val[(unsigned long)mask>>(BITSHIFT+4)])<0)
 					{
 						val -= y;
@@ -1113,11 +1259,19 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 		/* short (count1table) values */
 		for(;l3 && (part2remain+num > 0);l3--)
 		{
+#ifndef USE_HUFFMAN_LOOKUP
 			const struct newhuff *h = htc+gr_info->count1table_select;
 			const short *val = h->table;
+#endif
 			register short a;
 
 			REFRESH_MASK;
+#ifdef USE_HUFFMAN_LOOKUP
+			a = huffc_lookup[gr_info->count1table_select][(unsigned long)mask>>(BITSHIFT+2)];
+			num -= a>>4;
+			mask <<= a>>4;
+			a &= 0xf;
+#else
 			while((a=*val++)<0)
 			{
 				if (mask < 0) val -= a;
@@ -1125,6 +1279,7 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 				num--;
 				mask <<= 1;
 			}
+#endif
 			if(part2remain+num <= 0)
 			{
 				num -= part2remain+num;
@@ -1170,7 +1325,9 @@ static int III_dequantize_sample(mpg123_handle *fr, real xr[SBLIMIT][SSLIMIT],in
 		}
 
 		gr_info->maxbandl = max+1;
-		gr_info->maxb = fr->longLimit[sfreq][gr_info->maxbandl];
+		gr_info->maxb = longLimit[sfreq][gr_info->maxbandl];
+		if(gr_info->maxb > (unsigned int)fr->down_sample_sblimit)
+		gr_info->maxb = fr->down_sample_sblimit;
 	}
 
 	part2remain += num;
@@ -1723,7 +1880,13 @@ void dct36(real *inbuf,real *o1,real *o2,real *wintab,real *tsbuf)
 }
 
 
-/* new DCT12 */
+/*
+	new DCT12
+	There is no SIMD version of this one, unlike dct36. It only runs for short blocks, a small share of granules,
+	and each call is three 6-point transforms reading every third value
+	and overlap-adding into a stride of SBLIMIT: Packed ops would spend
+	more on shuffling than they save.
+*/
 static void dct12(real *in,real *rawout1,real *rawout2,register real *wi,register real *ts)
 {
 #define DCT12_PART1 \
@@ -1965,6 +2128,7 @@ int do_layer3(mpg123_handle *fr)
 		/*  hybridOut[2][SSLIMIT][SBLIMIT] */
 		real (*hybridOut)[SSLIMIT][SBLIMIT] = fr->layer3.hybrid_out;
 
+		COUNTER_START(fr);
 		{
 			struct gr_info_s *gr_info = &(sideinfo.ch[0].gr[gr]);
 			long part2bits;
@@ -2041,15 +2205,31 @@ int do_layer3(mpg123_handle *fr)
 			}
 		}
 
+		COUNTER_STAGE(fr, dequant_time);
+		if(fr->an.what == MPG123_ANALYSIS_SPECTRUM)
+		{
+			/* Hand over the spectrum, nothing more to do for this granule. */
+			for(ch=0;ch<stereo1;ch++)
+			{
+				struct gr_info_s *gr_info = &(sideinfo.ch[ch].gr[gr]);
+				/* Short blocks start after the first two subbands if mixed. */
+				fr->an.longlines[fr->an.fill/(SBLIMIT*SSLIMIT)] = gr_info->block_type != 2
+				?	SBLIMIT*SSLIMIT
+				:	(gr_info->mixed_block_flag ? 2*SSLIMIT : 0);
+				analysis_store(fr, hybridIn[ch][0], SBLIMIT*SSLIMIT, stereo1);
+			}
+			continue;
+		}
 		for(ch=0;ch<stereo1;ch++)
 		{
 			struct gr_info_s *gr_info = &(sideinfo.ch[ch].gr[gr]);
 			III_antialias(hybridIn[ch],gr_info);
 			III_hybrid(hybridIn[ch], hybridOut[ch], ch,gr_info, fr);
 		}
+		COUNTER_STAGE(fr, hybrid_time);
 
 #ifdef OPT_I486
-		if(single != SINGLE_STEREO || fr->af.encoding != MPG123_ENC_SIGNED_16 || fr->down_sample != 0)
+		if(single != SINGLE_STEREO || fr->af.encoding != MPG123_ENC_SIGNED_16 || fr->down_sample != 0 || fr->an.what || fr->af.planar)
 		{
 #endif
 		for(ss=0;ss<SSLIMIT;ss++)
@@ -2079,6 +2259,7 @@ int do_layer3(mpg123_handle *fr)
 			}
 		}
 #endif
+		COUNTER_STAGE(fr, synth_time);
 	}
   
 	return clip;
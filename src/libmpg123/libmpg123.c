@@ -11,6 +11,7 @@
 #include "debug.h"
 
 #include "gapless.h"
+#include <sys/stat.h>
 /* Want accurate rounding function regardless of decoder setup. */
 #define FORCE_ACCURATE
 #include "sample.h"
@@ -251,6 +252,14 @@ int attribute_align_arg mpg123_par(mpg123_pars *mp, enum mpg123_parms key, long
 			else ret = MPG123_BAD_VALUE;
 #else
 			ret = MPG123_MISSING_FEATURE;
+#endif
+		break;
+		case MPG123_READAHEAD_WINDOW:
+#ifdef READ_AHEAD
+			if(val > 0) mp->readahead = val;
+			else ret = MPG123_BAD_VALUE;
+#else
+			ret = MPG123_MISSING_FEATURE;
 #endif
 		break;
 		default:
@@ -340,6 +349,13 @@ int attribute_align_arg mpg123_getpar(mpg123_pars *mp, enum mpg123_parms key, lo
 			*val = mp->feedbuffer;
 #else
 			ret = MPG123_MISSING_FEATURE;
+#endif
+		break;
+		case MPG123_READAHEAD_WINDOW:
+#ifdef READ_AHEAD
+			*val = mp->readahead;
+#else
+			ret = MPG123_MISSING_FEATURE;
 #endif
 		break;
 		default:
@@ -384,6 +400,130 @@ int attribute_align_arg mpg123_getstate(mpg123_handle *mh, enum mpg123_state key
 			theval = mh->state_flags & FRAME_FRESH_DECODER;
 			mh->state_flags &= ~FRAME_FRESH_DECODER;
 		break;
+		case MPG123_SEEK_FRAMES:
+			theval = (long)mh->seek_frames;
+			thefval = (double)mh->seek_frames;
+			if((off_t)theval != mh->seek_frames)
+			{
+				mh->err = MPG123_INT_OVERFLOW;
+				ret = MPG123_ERR;
+			}
+		break;
+		case MPG123_RESIDENT_BYTES:
+		{
+			size_t sval = frame_resident_bytes(mh);
+			theval = (long)sval;
+			thefval = (double)sval;
+			if((size_t)theval != sval)
+			{
+				mh->err = MPG123_INT_OVERFLOW;
+				ret = MPG123_ERR;
+			}
+		}
+		break;
+#ifdef DECODER_COUNTERS
+		case MPG123_FRAMES_PARSED:
+		case MPG123_RESYNC_BYTES:
+		case MPG123_COPY_BYTES:
+		{
+			off_t count = key == MPG123_FRAMES_PARSED
+			?	mh->counters.frames
+			:	( key == MPG123_RESYNC_BYTES
+				?	mh->counters.resync_bytes
+				:	mh->counters.copy_bytes );
+			theval = (long)count;
+			thefval = (double)count;
+			if((off_t)theval != count)
+			{
+				mh->err = MPG123_INT_OVERFLOW;
+				ret = MPG123_ERR;
+			}
+		}
+		break;
+		case MPG123_PARSE_TIME:
+			thefval = mh->counters.parse_time;
+			theval = (long)(1e6*thefval);
+		break;
+		case MPG123_DEQUANT_TIME:
+			thefval = mh->counters.dequant_time;
+			theval = (long)(1e6*thefval);
+		break;
+		case MPG123_HYBRID_TIME:
+			thefval = mh->counters.hybrid_time;
+			theval = (long)(1e6*thefval);
+		break;
+		case MPG123_SYNTH_TIME:
+			thefval = mh->counters.synth_time;
+			theval = (long)(1e6*thefval);
+		break;
+		case MPG123_DECODER_REINITS:
+			theval = mh->counters.reinits;
+			thefval = (double)theval;
+		break;
+#else
+		case MPG123_FRAMES_PARSED:
+		case MPG123_RESYNC_BYTES:
+		case MPG123_COPY_BYTES:
+		case MPG123_PARSE_TIME:
+		case MPG123_DEQUANT_TIME:
+		case MPG123_HYBRID_TIME:
+		case MPG123_SYNTH_TIME:
+		case MPG123_DECODER_REINITS:
+			mh->err = MPG123_MISSING_FEATURE;
+			ret = MPG123_ERR;
+		break;
+#endif
+		case MPG123_READAHEAD_FILL:
+		case MPG123_READAHEAD_STALLS:
+#ifdef READ_AHEAD
+			if(mh->rdat.ahead != NULL)
+			{
+				if(key == MPG123_READAHEAD_FILL)
+				{
+					size_t sval = ahead_fill(mh->rdat.ahead);
+					theval = (long)sval;
+					thefval = (double)sval;
+					if((size_t)theval != sval)
+					{
+						mh->err = MPG123_INT_OVERFLOW;
+						ret = MPG123_ERR;
+					}
+				}
+				else
+				{
+					theval = ahead_stalls(mh->rdat.ahead);
+					thefval = (double)theval;
+				}
+			}
+#else
+			mh->err = MPG123_MISSING_FEATURE;
+			ret = MPG123_ERR;
+#endif
+		break;
+		case MPG123_LOUDNESS:
+		case MPG123_SUBBAND_PEAK:
+			if(mh->loud.valid)
+			{
+				thefval = key == MPG123_LOUDNESS
+				?	mh->loud.integrated
+				:	( mh->loud.peak > 0. ? 20.*log10(mh->loud.peak) : -HUGE_VAL );
+				theval = thefval > -HUGE_VAL ? (long)(100.*thefval) : LONG_MIN;
+			}
+			else
+			{
+				mh->err = MPG123_BAD_VALUE;
+				ret = MPG123_ERR;
+			}
+		break;
+		case MPG123_CACHED_FRAMES:
+			theval = (long)mh->pc.hits;
+			thefval = (double)mh->pc.hits;
+			if((off_t)theval != mh->pc.hits)
+			{
+				mh->err = MPG123_INT_OVERFLOW;
+				ret = MPG123_ERR;
+			}
+		break;
 		default:
 			mh->err = MPG123_BAD_KEY;
 			ret = MPG123_ERR;
@@ -528,7 +668,11 @@ int decode_update(mpg123_handle *mh)
 	if(mh->af.rate == native_rate) mh->down_sample = 0;
 	else if(mh->af.rate == native_rate>>1) mh->down_sample = 1;
 	else if(mh->af.rate == native_rate>>2) mh->down_sample = 2;
+#ifdef RESAMPLER
+	else mh->down_sample = 4; /* flexible rate, polyphase filter */
+#else
 	else mh->down_sample = 3; /* flexible (fixed) rate */
+#endif
 	switch(mh->down_sample)
 	{
 		case 0:
@@ -554,6 +698,19 @@ int decode_update(mpg123_handle *mh)
 			                 )/NTOM_MUL ));
 		}
 		break;
+#endif
+#ifdef RESAMPLER
+		case 4:
+		{
+			if(resample_setup(mh) != 0) return -1;
+			/* Subbands entirely above the new Nyquist frequency are not needed,
+			   only keep the neighbour of the one containing it. */
+			mh->down_sample_sblimit = (SBLIMIT*mh->af.rate + frame_freq(mh)-1)
+			                        / frame_freq(mh) + 1;
+			if(mh->down_sample_sblimit > SBLIMIT) mh->down_sample_sblimit = SBLIMIT;
+			mh->outblock = outblock_bytes(mh, resample_ins2outs(mh, mh->spf)+1);
+		}
+		break;
 #endif
 	}
 
@@ -569,6 +726,7 @@ int decode_update(mpg123_handle *mh)
 	if(frame_outbuffer(mh) != MPG123_OK) return -1;
 
 	do_rva(mh);
+	COUNTER_ADD(mh, reinits, 1);
 	debug3("done updating decoder structure with native rate %li and af.rate %li and down_sample %i", frame_freq(mh), mh->af.rate, mh->down_sample);
 
 	return 0;
@@ -587,6 +745,19 @@ size_t attribute_align_arg mpg123_outblock(mpg123_handle *mh)
 	else return mpg123_safe_buffer();
 }
 
+/* Run the layer decoder on the current frame, through the resampler if that is active. */
+static int decode_layer(mpg123_handle *fr)
+{
+	/* Each channel gets its share of the buffer for the frame. */
+	if(fr->af.planar)
+		fr->pl.plane = decoder_synth_bytes(fr, frame_expect_outsamples(fr))
+		/	fr->af.channels;
+#ifdef RESAMPLER
+	if(fr->down_sample == 4) return resample_decode(fr);
+#endif
+	return (fr->do_layer)(fr);
+}
+
 /* Read in the next frame we actually want for decoding.
    This includes skipping/ignoring frames, in additon to skipping junk in the parser. */
 static int get_next_frame(mpg123_handle *mh)
@@ -612,7 +783,9 @@ static int get_next_frame(mpg123_handle *mh)
 		{
 			debug1("ignoring frame %li", (long)mh->num);
 			/* Decoder structure must be current! decode_update has been called before... */
-			(mh->do_layer)(mh); mh->buffer.fill = 0;
+			if(pcmcache_frame(mh)) frame_skip(mh);
+			else decode_layer(mh);
+			mh->buffer.fill = 0;
 #ifndef NO_NTOM
 			/* The ignored decoding may have failed. Make sure ntom stays consistent. */
 			if(mh->down_sample == 3) ntom_set_ntom(mh, mh->num+1);
@@ -622,7 +795,9 @@ static int get_next_frame(mpg123_handle *mh)
 		/* Read new frame data; possibly breaking out here for MPG123_NEED_MORE. */
 		debug("read frame");
 		mh->to_decode = FALSE;
+		COUNTER_START(mh);
 		b = read_frame(mh); /* That sets to_decode only if a full frame was read. */
+		COUNTER_STAGE(mh, parse_time);
 		debug4("read of frame %li returned %i (to_decode=%i) at sample %li", (long)mh->num, b, mh->to_decode, (long)mpg123_tell(mh));
 		if(b == MPG123_NEED_MORE) return MPG123_NEED_MORE; /* need another call with data */
 		else if(b <= 0)
@@ -632,6 +807,7 @@ static int get_next_frame(mpg123_handle *mh)
 			{ /* We simply reached the end. */
 				mh->track_frames = mh->num + 1;
 				debug("What about updating/checking gapless sample count here?");
+				pcmcache_done(mh);
 				return MPG123_DONE;
 			}
 			else return MPG123_ERR; /* Some real error. */
@@ -706,8 +882,16 @@ static int zero_byte(mpg123_handle *fr)
 */
 static void decode_the_frame(mpg123_handle *fr)
 {
-	size_t needed_bytes = decoder_synth_bytes(fr, frame_expect_outsamples(fr));
-	fr->clip += (fr->do_layer)(fr);
+	size_t needed_bytes;
+	/* That output is there already, without the gapless cutting. */
+	if(pcmcache_frame(fr))
+	{
+		frame_skip(fr);
+		pcmcache_fetch(fr);
+		return;
+	}
+	needed_bytes = decoder_synth_bytes(fr, frame_expect_outsamples(fr));
+	fr->clip += decode_layer(fr);
 	/*fprintf(stderr, "frame %"OFF_P": got %"SIZE_P" / %"SIZE_P"\n", fr->num,(size_p)fr->buffer.fill, (size_p)needed_bytes);*/
 	/* There could be less data than promised.
 	   Also, then debugging, we look out for coding errors that could result in _more_ data than expected. */
@@ -726,6 +910,15 @@ static void decode_the_frame(mpg123_handle *fr)
 				but we have funny 8bit formats that have a different opinion on zero...
 				Unsigned 16 or 32 bit formats are handled later.
 			*/
+			if(fr->af.planar)
+			{
+				int ch;
+				size_t have = fr->buffer.fill/fr->af.channels;
+				for(ch=0; ch<fr->af.channels; ++ch)
+					memset( fr->buffer.data + ch*fr->pl.plane + have, zero_byte(fr)
+					,	fr->pl.plane - have );
+			}
+			else
 			memset( fr->buffer.data + fr->buffer.fill, zero_byte(fr), needed_bytes - fr->buffer.fill );
 
 			fr->buffer.fill = needed_bytes;
@@ -743,6 +936,7 @@ static void decode_the_frame(mpg123_handle *fr)
 	}
 #endif
 	postprocess_buffer(fr);
+	pcmcache_store(fr);
 }
 
 /*
@@ -779,6 +973,32 @@ int attribute_align_arg mpg123_framebyframe_decode(mpg123_handle *mh, off_t *num
 	return MPG123_OK;
 }
 
+int attribute_align_arg mpg123_framebyframe_analyze( mpg123_handle *mh
+,	enum mpg123_analysis domain, const float **data, size_t *count
+,	int *width, int *channels )
+{
+	if(data == NULL || count == NULL) return MPG123_ERR_NULL;
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	if(domain != MPG123_ANALYSIS_SUBBANDS && domain != MPG123_ANALYSIS_SPECTRUM)
+	{
+		mh->err = MPG123_BAD_VALUE;
+		return MPG123_ERR;
+	}
+
+	*count = 0;
+	mh->buffer.fill = 0;
+	if(!mh->to_decode) return MPG123_OK;
+
+	debug("analysing");
+	if(analysis_decode(mh, domain) != 0) return MPG123_ERR;
+	mh->to_decode = mh->to_ignore = FALSE;
+	*data = mh->an.data;
+	*count = mh->an.fill;
+	if(width != NULL) *width = mh->an.width;
+	if(channels != NULL) *channels = mh->an.channels;
+	return MPG123_OK;
+}
+
 /*
 	Find, read and parse the next mp3 frame while skipping junk and parsing id3 tags, lame headers, etc.
 	Prepares everything for decoding using mpg123_framebyframe_decode.
@@ -865,11 +1085,262 @@ int attribute_align_arg mpg123_decode_frame(mpg123_handle *mh, off_t *num, unsig
 	}
 }
 
+struct mpg123_batch_struct
+{
+	size_t count;
+	mpg123_handle **mh;
+	size_t *order; /* decoding order, grouped, kept from round to round */
+	long frames;   /* since the last mpg123_batch_stats() */
+	double seconds;
+};
+
+mpg123_batch attribute_align_arg *mpg123_new_batch(mpg123_handle **mh, size_t count, int *error)
+{
+	mpg123_batch *batch;
+	size_t i;
+
+	if(mh == NULL)
+	{
+		if(error != NULL) *error = MPG123_ERR_NULL;
+		return NULL;
+	}
+	for(i=0; i<count; ++i) if(mh[i] == NULL)
+	{
+		if(error != NULL) *error = MPG123_BAD_HANDLE;
+		return NULL;
+	}
+	batch = malloc(sizeof(*batch));
+	if(batch != NULL)
+	{
+		batch->mh = malloc(count ? count*sizeof(*batch->mh) : 1);
+		batch->order = malloc(count ? count*sizeof(*batch->order) : 1);
+	}
+	if(batch == NULL || batch->mh == NULL || batch->order == NULL)
+	{
+		if(batch != NULL)
+		{
+			if(batch->mh != NULL) free(batch->mh);
+			if(batch->order != NULL) free(batch->order);
+			free(batch);
+		}
+		if(error != NULL) *error = MPG123_OUT_OF_MEM;
+		return NULL;
+	}
+	batch->count = count;
+	for(i=0; i<count; ++i)
+	{
+		batch->mh[i] = mh[i];
+		batch->order[i] = i;
+	}
+	batch->frames = 0;
+	batch->seconds = 0.;
+	if(error != NULL) *error = MPG123_OK;
+	return batch;
+}
+
+void attribute_align_arg mpg123_delete_batch(mpg123_batch *batch)
+{
+	if(batch == NULL) return;
+	free(batch->order);
+	free(batch->mh);
+	free(batch);
+}
+
+/* Handles with the same layer, decoder and synth share code and tables. */
+static int batch_before(mpg123_handle *a, mpg123_handle *b)
+{
+	if(a->lay != b->lay) return a->lay < b->lay;
+	if(a->cpu_opts.type != b->cpu_opts.type) return a->cpu_opts.type < b->cpu_opts.type;
+	if(a->down_sample != b->down_sample) return a->down_sample < b->down_sample;
+	return a->af.encoding < b->af.encoding;
+}
+
+/* Insertion sort, stable and linear for the order of the last round. */
+static void batch_group(mpg123_batch *batch)
+{
+	size_t i, j;
+	for(i=1; i<batch->count; ++i)
+	{
+		size_t cur = batch->order[i];
+		for(j=i; j>0 && batch_before(batch->mh[cur], batch->mh[batch->order[j-1]]); --j)
+			batch->order[j] = batch->order[j-1];
+		batch->order[j] = cur;
+	}
+}
+
+/*
+	One round of lock-step decoding: mpg123_decode_frame() taken apart.
+	First, every handle reads its next frame (including frames to skip or
+	ignore), then the ones that have a frame decode it, in groups.
+*/
+int attribute_align_arg mpg123_decode_batch(mpg123_batch *batch, int *status, unsigned char **audio, size_t *bytes)
+{
+	double start;
+	size_t i;
+	int got = 0;
+
+	if(batch == NULL || status == NULL || audio == NULL || bytes == NULL)
+		return MPG123_ERR_NULL;
+	start = counter_clock();
+	for(i=0; i<batch->count; ++i)
+	{
+		mpg123_handle *mh = batch->mh[i];
+		audio[i] = NULL;
+		bytes[i] = 0;
+		status[i] = MPG123_OK;
+		if(mh->buffer.size < mh->outblock)
+		{
+			status[i] = MPG123_NO_SPACE;
+			continue;
+		}
+		mh->buffer.fill = 0;
+		if(!mh->to_decode)
+		{
+			int b = get_next_frame(mh);
+			if(b < 0) status[i] = b;
+		}
+	}
+	batch_group(batch);
+	for(i=0; i<batch->count; ++i)
+	{
+		size_t n = batch->order[i];
+		mpg123_handle *mh = batch->mh[n];
+		if(status[n] != MPG123_OK || !mh->to_decode)
+			continue;
+		if(mh->new_format)
+		{
+			debug("notifiying new format");
+			mh->new_format = 0;
+			status[n] = MPG123_NEW_FORMAT;
+			continue;
+		}
+		decode_the_frame(mh);
+		mh->to_decode = mh->to_ignore = FALSE;
+		mh->buffer.p = mh->buffer.data;
+		FRAME_BUFFERCHECK(mh);
+		audio[n] = mh->buffer.p;
+		bytes[n] = mh->buffer.fill;
+		++got;
+	}
+	batch->frames += got;
+	batch->seconds += counter_clock() - start;
+	return got;
+}
+
+int attribute_align_arg mpg123_batch_stats(mpg123_batch *batch, long *frames, double *seconds, double *fps)
+{
+	if(batch == NULL) return MPG123_ERR_NULL;
+	if(frames != NULL) *frames = batch->frames;
+	if(seconds != NULL) *seconds = batch->seconds;
+	if(fps != NULL) *fps = batch->seconds > 0. ? batch->frames/batch->seconds : 0.;
+	batch->frames = 0;
+	batch->seconds = 0.;
+	return MPG123_OK;
+}
+
+/*
+	Like mpg123_decode_frame(), but the synth writes straight into the next caller-provided slot.
+	The internal buffer is swapped out for the duration of the decode and treated as foreign
+	memory, so gapless cutting moves the data to the slot start instead of shifting buffer.p.
+	The slot cursor only advances when audio got stored.
+	MPG123_NO_SPACE   -- the next slot is smaller than mpg123_outblock()
+*/
+int attribute_align_arg mpg123_decode_slot(mpg123_handle *mh, size_t *slot, size_t *bytes)
+{
+	if(bytes != NULL) *bytes = 0;
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	if(mh->slotcount == 0)
+	{
+		mh->err = MPG123_BAD_BUFFER;
+		return MPG123_ERR;
+	}
+	mh->buffer.fill = 0;
+	while(TRUE)
+	{
+		if(mh->to_decode)
+		{
+			struct outbuffer own = mh->buffer;
+			int own_buffer = mh->own_buffer;
+			size_t i = mh->slotnext;
+			if(mh->new_format)
+			{
+				debug("notifiying new format");
+				mh->new_format = 0;
+				return MPG123_NEW_FORMAT;
+			}
+			if(mh->slotsizes[i] < mh->outblock) return MPG123_NO_SPACE;
+
+			mh->buffer.data = mh->buffer.p = mh->slots[i];
+			mh->buffer.size = mh->slotsizes[i];
+			mh->buffer.fill = 0;
+			mh->own_buffer  = FALSE;
+			debug1("decoding into slot %"SIZE_P, (size_p)i);
+			decode_the_frame(mh);
+			mh->to_decode = mh->to_ignore = FALSE;
+			FRAME_BUFFERCHECK(mh);
+			if(slot != NULL) *slot = i;
+			if(bytes != NULL) *bytes = mh->buffer.fill;
+			if(mh->buffer.fill) mh->slotnext = (i+1) % mh->slotcount;
+
+			mh->buffer = own;
+			mh->buffer.fill = 0;
+			mh->own_buffer = own_buffer;
+			return MPG123_OK;
+		}
+		else
+		{
+			int b = get_next_frame(mh);
+			if(b < 0) return b;
+			debug1("got next frame, %i", mh->to_decode);
+		}
+	}
+}
+
 int attribute_align_arg mpg123_read(mpg123_handle *mh, unsigned char *out, size_t size, size_t *done)
 {
 	return mpg123_decode(mh, NULL, 0, out, size, done);
 }
 
+int attribute_align_arg mpg123_feed_ref( mpg123_handle *mh
+,	const unsigned char *in, size_t size
+,	void (*release)(void *handle), void *handle )
+{
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+#ifndef NO_FEEDER
+	if(release == NULL)
+	{
+		mh->err = MPG123_NULL_POINTER;
+		return MPG123_ERR;
+	}
+	if(size > 0)
+	{
+		if(in == NULL)
+		{
+			mh->err = MPG123_NULL_BUFFER;
+			return MPG123_ERR;
+		}
+		if(size > LONG_MAX)
+		{
+			mh->err = MPG123_BAD_VALUE;
+			return MPG123_ERR;
+		}
+		if(feed_more_ref(mh, in, (long)size, release, handle) != 0)
+		{
+			mh->err = MPG123_OUT_OF_MEM;
+			return MPG123_ERR;
+		}
+		/* See mpg123_feed(). */
+		if(mh->err == MPG123_ERR_READER) mh->err = MPG123_OK;
+	}
+	else release(handle);
+
+	return MPG123_OK;
+#else
+	mh->err = MPG123_MISSING_FEATURE;
+	return MPG123_ERR;
+#endif
+}
+
 int attribute_align_arg mpg123_feed(mpg123_handle *mh, const unsigned char *in, size_t size)
 {
 	if(mh == NULL) return MPG123_BAD_HANDLE;
@@ -944,6 +1415,13 @@ int attribute_align_arg mpg123_decode(mpg123_handle *mh, const unsigned char *in
 				ret = MPG123_NEW_FORMAT;
 				goto decodeend;
 			}
+			/* Planes of one frame cannot be handed out in pieces. */
+			if(mh->af.planar)
+			{
+				mh->err = MPG123_BAD_OUTFORMAT;
+				ret = MPG123_ERR;
+				goto decodeend;
+			}
 			if(mh->buffer.size - mh->buffer.fill < mh->outblock)
 			{
 				ret = MPG123_NO_SPACE;
@@ -1132,6 +1610,7 @@ static int do_the_seek(mpg123_handle *mh)
 	int b;
 	off_t fnum = SEEKFRAME(mh);
 	mh->buffer.fill = 0;
+	mh->seek_frames = 0;
 
 	/* If we are inside the ignoreframe - firstframe window, we may get away without actual seeking. */
 	if(mh->num < mh->firstframe)
@@ -1151,6 +1630,7 @@ static int do_the_seek(mpg123_handle *mh)
 
 	/* OK, real seeking follows... clear buffers and go for it. */
 	frame_buffers_reset(mh);
+	pcmcache_seek(mh);
 #ifndef NO_NTOM
 	if(mh->down_sample == 3)
 	{
@@ -1261,6 +1741,7 @@ off_t attribute_align_arg mpg123_feedseek(mpg123_handle *mh, off_t sampleoff, in
 	frame_set_seek(mh, SAMPLE_UNADJUST(mh,pos));
 	pos = SEEKFRAME(mh);
 	mh->buffer.fill = 0;
+	mh->seek_frames = 0;
 
 	/* Shortcuts without modifying input stream. */
 	*input_offset = mh->rdat.buffer.fileoff + mh->rdat.buffer.size;
@@ -1269,6 +1750,7 @@ off_t attribute_align_arg mpg123_feedseek(mpg123_handle *mh, off_t sampleoff, in
 	if(mh->num == pos-1) goto feedseekend;
 	/* Whole way. */
 	*input_offset = feed_set_pos(mh, frame_index_find(mh, SEEKFRAME(mh), &pos));
+	mh->seek_frames = SEEKFRAME(mh) - pos;
 	mh->num = pos-1; /* The next read frame will have num = pos. */
 	if(*input_offset < 0) return MPG123_ERR;
 
@@ -1383,6 +1865,8 @@ int attribute_align_arg mpg123_scan(mpg123_handle *mh)
 	off_t oldpos;
 	off_t track_frames = 0;
 	off_t track_samples = 0;
+	struct loudness *ld = NULL;
+	int ret = MPG123_OK;
 
 	if(mh == NULL) return MPG123_BAD_HANDLE;
 	if(!(mh->rdat.flags & READER_SEEKABLE)){ mh->err = MPG123_NO_SEEK; return MPG123_ERR; }
@@ -1403,20 +1887,51 @@ int attribute_align_arg mpg123_scan(mpg123_handle *mh)
 	track_samples = mh->spf; /* Internal samples. */
 	debug("TODO: We should disable gapless code when encountering inconsistent mh->spf!");
 	debug("      ... at least unset MPG123_ACCURATE.");
+	if(mh->p.flags & MPG123_SCAN_LOUDNESS)
+	{
+		ld = loudness_new();
+		if(ld == NULL || loudness_frame(ld, mh) != 0)
+		{
+			mh->err = MPG123_OUT_OF_MEM;
+			ret = MPG123_ERR;
+		}
+	}
 	/* Do not increment mh->track_frames in the loop as tha would confuse Frankenstein detection. */
-	while(read_frame(mh) == 1)
+	while(ret == MPG123_OK && read_frame(mh) == 1)
 	{
 		++track_frames;
 		track_samples += mh->spf;
+		if(ld != NULL && loudness_frame(ld, mh) != 0)
+		{
+			mh->err = MPG123_OUT_OF_MEM;
+			ret = MPG123_ERR;
+		}
+	}
+	if(ret == MPG123_OK)
+	{
+		mh->track_frames = track_frames;
+		mh->track_samples = track_samples;
+	}
+	if(mh->p.flags & MPG123_SCAN_LOUDNESS)
+	{
+		if(ret == MPG123_OK)
+		{
+			loudness_finish(ld, mh);
+			do_rva(mh);
+		}
+		loudness_del(ld);
+		/* Layer III decoding starts over with the seek. */
+		mh->hybrid_blc[0] = mh->hybrid_blc[1] = 0;
+		memset(mh->hybrid_block, 0, sizeof(mh->hybrid_block));
 	}
-	mh->track_frames = track_frames;
-	mh->track_samples = track_samples;
 	debug2("Scanning yielded %"OFF_P" track samples, %"OFF_P" frames.", (off_p)mh->track_samples, (off_p)mh->track_frames);
 #ifdef GAPLESS
 	/* Also, think about usefulness of that extra value track_samples ... it could be used for consistency checking. */
-	if(mh->p.flags & MPG123_GAPLESS) frame_gapless_update(mh, mh->track_samples);
+	if(ret == MPG123_OK && mh->p.flags & MPG123_GAPLESS) frame_gapless_update(mh, mh->track_samples);
 #endif
-	return mpg123_seek(mh, oldpos, SEEK_SET) >= 0 ? MPG123_OK : MPG123_ERR;
+	/* Back to where we were, also after failure. */
+	if(mpg123_seek(mh, oldpos, SEEK_SET) < 0) ret = MPG123_ERR;
+	return ret;
 }
 
 int attribute_align_arg mpg123_meta_check(mpg123_handle *mh)
@@ -1593,10 +2108,265 @@ int attribute_align_arg mpg123_set_index(mpg123_handle *mh, off_t *offsets, off_
 #endif
 }
 
+/*
+	Index file layout, all integers little endian:
+	8 bytes magic, 4 bytes version, INDEXFILE_FIELDS fields of 8 bytes
+	(see below), fill index entries of 8 bytes, CRC-32 of all that (4 bytes).
+*/
+#define INDEXFILE_MAGIC   "mpg123ix"
+#define INDEXFILE_VERSION 1
+enum indexfile_field
+{
+	ixf_filelen = 0, ixf_mtime, ixf_audio_start, ixf_firsthead
+,	ixf_track_frames, ixf_track_samples
+,	ixf_gapless_frames, ixf_begin_s, ixf_end_s
+,	ixf_step, ixf_fill, INDEXFILE_FIELDS
+};
+#define INDEXFILE_HEAD (8+4+8*INDEXFILE_FIELDS)
+
+static unsigned long indexfile_crc(const unsigned char *buf, size_t len)
+{
+	unsigned long crc = 0xffffffffUL;
+	size_t i;
+	int k;
+	for(i=0; i<len; ++i)
+	{
+		crc ^= buf[i];
+		for(k=0; k<8; ++k)
+		crc = (crc >> 1) ^ (0xedb88320UL & (0UL - (crc & 1)));
+	}
+	return ~crc & 0xffffffffUL;
+}
+
+static void indexfile_put(unsigned char *buf, off_t val)
+{
+	int i;
+	for(i=0; i<8; ++i)
+	{
+		buf[i] = (unsigned char)(val & 0xff);
+		val >>= 8;
+	}
+}
+
+static void indexfile_put32(unsigned char *buf, unsigned long val)
+{
+	int i;
+	for(i=0; i<4; ++i)
+	buf[i] = (unsigned char)((val >> (8*i)) & 0xff);
+}
+
+static unsigned long indexfile_get32(const unsigned char *buf)
+{
+	return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8)
+	|	((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+/* Returns -1 if the value does not fit into a non-negative off_t. */
+static off_t indexfile_get(const unsigned char *buf)
+{
+	off_t val = 0;
+	int i;
+	for(i=7; i>=0; --i)
+	{
+		if(val >> (8*sizeof(off_t)-9)) return -1;
+		val = (val << 8) | buf[i];
+	}
+	return val;
+}
+
+/* Modification time of the file behind the reader, 0 if unknown. */
+static off_t stream_mtime(mpg123_handle *mh)
+{
+	struct stat st;
+	if(  (mh->rdat.flags & READER_HANDLEIO) || mh->rdat.filept < 0
+	  || fstat(mh->rdat.filept, &st) != 0 || st.st_mtime < 0 )
+	return 0;
+	return (off_t)st.st_mtime;
+}
+
+int attribute_align_arg mpg123_index_save(mpg123_handle *mh, const char *path)
+{
+#ifdef FRAME_INDEX
+	off_t field[INDEXFILE_FIELDS];
+	unsigned char *buf;
+	size_t bufsize, i;
+	FILE *out;
+	int ret = MPG123_OK;
+
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	if(path == NULL)
+	{
+		mh->err = MPG123_NULL_POINTER;
+		return MPG123_ERR;
+	}
+	/* Exact sample count and full index need a scan. */
+	if(mh->track_samples < 0 && mpg123_scan(mh) != MPG123_OK)
+	return MPG123_ERR;
+	if(mh->rdat.filelen <= 0 || mh->track_samples < 0 || mh->index.fill < 1)
+	{
+		mh->err = MPG123_INDEX_FAIL;
+		return MPG123_ERR;
+	}
+	field[ixf_filelen]        = mh->rdat.filelen;
+	field[ixf_mtime]          = stream_mtime(mh);
+	field[ixf_audio_start]    = mh->audio_start;
+	field[ixf_firsthead]      = (off_t)mh->firsthead;
+	field[ixf_track_frames]   = mh->track_frames;
+	field[ixf_track_samples]  = mh->track_samples;
+#ifdef GAPLESS
+	field[ixf_gapless_frames] = mh->gapless_frames > 0 ? mh->gapless_frames : 0;
+	field[ixf_begin_s]        = mh->begin_s;
+	field[ixf_end_s]          = mh->end_s;
+#else
+	field[ixf_gapless_frames] = field[ixf_begin_s] = field[ixf_end_s] = 0;
+#endif
+	field[ixf_step]           = mh->index.step;
+	field[ixf_fill]           = (off_t)mh->index.fill;
+
+	bufsize = INDEXFILE_HEAD + 8*mh->index.fill + 4;
+	if((buf = malloc(bufsize)) == NULL)
+	{
+		mh->err = MPG123_OUT_OF_MEM;
+		return MPG123_ERR;
+	}
+	memcpy(buf, INDEXFILE_MAGIC, 8);
+	indexfile_put32(buf+8, INDEXFILE_VERSION);
+	for(i=0; i<INDEXFILE_FIELDS; ++i)
+	indexfile_put(buf+12+8*i, field[i]);
+	for(i=0; i<mh->index.fill; ++i)
+	indexfile_put(buf+INDEXFILE_HEAD+8*i, mh->index.data[i]);
+	indexfile_put32(buf+bufsize-4, indexfile_crc(buf, bufsize-4));
+
+	out = compat_fopen(path, "wb");
+	if(out != NULL)
+	{
+		if(fwrite(buf, 1, bufsize, out) != bufsize) ret = MPG123_ERR;
+		if(compat_fclose(out) != 0) ret = MPG123_ERR;
+	}
+	else ret = MPG123_ERR;
+	if(ret != MPG123_OK)
+	{
+		if(!(mh->p.flags & MPG123_QUIET)) error1("cannot write index file %s", path);
+		mh->err = MPG123_BAD_FILE;
+	}
+	free(buf);
+	return ret;
+#else
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	mh->err = MPG123_MISSING_FEATURE;
+	return MPG123_ERR;
+#endif
+}
+
+int attribute_align_arg mpg123_index_load(mpg123_handle *mh, const char *path)
+{
+#ifdef FRAME_INDEX
+	off_t field[INDEXFILE_FIELDS];
+	unsigned char head[INDEXFILE_HEAD];
+	unsigned char *buf = NULL;
+	off_t *offsets = NULL;
+	size_t bufsize = 0, fill, i;
+	off_t mtime;
+	FILE *in;
+	int b;
+	int ret = MPG123_ERR;
+
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	if(path == NULL)
+	{
+		mh->err = MPG123_NULL_POINTER;
+		return MPG123_ERR;
+	}
+	if((in = compat_fopen(path, "rb")) == NULL)
+	{
+		mh->err = MPG123_BAD_FILE;
+		return MPG123_ERR;
+	}
+	if(fread(head, 1, INDEXFILE_HEAD, in) != INDEXFILE_HEAD)
+	goto bad_file;
+	for(i=0; i<INDEXFILE_FIELDS; ++i)
+	field[i] = indexfile_get(head+12+8*i);
+	fill = (size_t)field[ixf_fill];
+	if(  memcmp(head, INDEXFILE_MAGIC, 8)
+	  || indexfile_get32(head+8) != INDEXFILE_VERSION
+	  || field[ixf_fill] < 1 || (off_t)fill != field[ixf_fill]
+	  || fill > ((size_t)-1 - INDEXFILE_HEAD - 4)/8 )
+	goto bad_file;
+	bufsize = INDEXFILE_HEAD + 8*fill + 4;
+	if(  (buf = malloc(bufsize)) == NULL
+	  || (offsets = malloc(fill*sizeof(off_t))) == NULL )
+	{
+		mh->err = MPG123_OUT_OF_MEM;
+		goto fail;
+	}
+	memcpy(buf, head, INDEXFILE_HEAD);
+	if(  fread(buf+INDEXFILE_HEAD, 1, bufsize-INDEXFILE_HEAD, in) != bufsize-INDEXFILE_HEAD
+	  || indexfile_get32(buf+bufsize-4) != indexfile_crc(buf, bufsize-4) )
+	goto bad_file;
+	for(i=0; i<INDEXFILE_FIELDS; ++i)
+	if(field[i] < 0) goto bad_file;
+	for(i=0; i<fill; ++i)
+	if((offsets[i] = indexfile_get(buf+INDEXFILE_HEAD+8*i)) < 0)
+	goto bad_file;
+	/* The file is sound, now it needs the first header for comparison. */
+	b = init_track(mh);
+	if(b < 0)
+	{
+		ret = b == MPG123_DONE ? MPG123_ERR : b;
+		goto fail;
+	}
+	/* Does it describe the stream at hand? */
+	mtime = stream_mtime(mh);
+	if(  field[ixf_filelen] != mh->rdat.filelen
+	  || (mtime && field[ixf_mtime] && field[ixf_mtime] != mtime)
+	  || field[ixf_audio_start] != mh->audio_start
+	  || (unsigned long)field[ixf_firsthead] != mh->firsthead
+	  || field[ixf_step] < 1 )
+	{
+		debug("index file does not match the stream");
+		goto bad_file;
+	}
+	if(fi_set(&mh->index, offsets, field[ixf_step], fill) == -1)
+	{
+		mh->err = MPG123_OUT_OF_MEM;
+		goto fail;
+	}
+	mh->track_frames  = field[ixf_track_frames];
+	mh->track_samples = field[ixf_track_samples];
+#ifdef GAPLESS
+	if(field[ixf_gapless_frames] > 0)
+	{
+		mh->gapless_frames = field[ixf_gapless_frames];
+		mh->begin_s = field[ixf_begin_s];
+		mh->end_s   = field[ixf_end_s];
+		frame_gapless_realinit(mh);
+	}
+	if(mh->p.flags & MPG123_GAPLESS) frame_gapless_update(mh, mh->track_samples);
+#endif
+	free(offsets);
+	free(buf);
+	compat_fclose(in);
+	return MPG123_OK;
+
+bad_file:
+	mh->err = MPG123_BAD_INDEX_FILE;
+fail:
+	free(offsets);
+	free(buf);
+	compat_fclose(in);
+	return ret;
+#else
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	mh->err = MPG123_MISSING_FEATURE;
+	return MPG123_ERR;
+#endif
+}
+
 int attribute_align_arg mpg123_close(mpg123_handle *mh)
 {
 	if(mh == NULL) return MPG123_BAD_HANDLE;
 
+	pcmcache_close(mh);
 	/* mh->rd is never NULL! */
 	if(mh->rd->close != NULL) mh->rd->close(mh);
 
@@ -1667,6 +2437,7 @@ static const char *mpg123_error[] =
 	,"Custom I/O obviously not prepared."
 	,"Overflow in LFS (large file support) conversion."
 	,"Overflow in integer conversion."
+	,"Index file is damaged or does not match the stream."
 };
 
 const char* attribute_align_arg mpg123_plain_strerror(int errcode)
@@ -302,6 +302,8 @@ off_t bytes_to_samples(mpg123_handle *fr , off_t b);
 off_t outblock_bytes(mpg123_handle *fr, off_t s);
 /* Postprocessing format conversion of freshly decoded buffer. */
 void postprocess_buffer(mpg123_handle *fr);
+/* Planar output: Append interleaved synth samples to the planes. */
+void planar_store(mpg123_handle *fr, const unsigned char *in, size_t bytes);
 
 /* If networking is enabled and we really mean internal networking, the timeout_read function is available. */
 #if defined (NETWORK) && !defined (WANT_WIN32_SOCKETS)
@@ -359,11 +359,57 @@ static int find_dectype(mpg123_handle *fr)
 	}
 }
 
+/*
+	Planar output: The synths (including all the assembly ones) write
+	interleaved samples. They get a small scratch buffer for that instead of
+	the output, which is split into the planes right away, still in cache.
+	Room for the most samples of one call, upsampling included, of the
+	biggest decoder sample format.
+*/
+#define PLANAR_SCRATCH (2*(NTOM_MAX+1)*SBLIMIT)
+
+static int synth_planar_stereo(real *bandPtr_l, real *bandPtr_r, mpg123_handle *fr)
+{
+	double scratch[PLANAR_SCRATCH];
+	unsigned char *data = fr->buffer.data;
+	size_t fill = fr->buffer.fill;
+	size_t bytes;
+	int clip;
+
+	fr->buffer.data = (unsigned char*)scratch;
+	fr->buffer.fill = 0;
+	clip = (fr->pl.stereo)(bandPtr_l, bandPtr_r, fr);
+	bytes = fr->buffer.fill;
+	fr->buffer.data = data;
+	fr->buffer.fill = fill;
+	planar_store(fr, (unsigned char*)scratch, bytes);
+	return clip;
+}
+
+static int synth_planar_mono(real *bandPtr, mpg123_handle *fr)
+{
+	double scratch[PLANAR_SCRATCH];
+	unsigned char *data = fr->buffer.data;
+	size_t fill = fr->buffer.fill;
+	size_t bytes;
+	int clip;
+
+	fr->buffer.data = (unsigned char*)scratch;
+	fr->buffer.fill = 0;
+	clip = (fr->pl.mono)(bandPtr, fr);
+	bytes = fr->buffer.fill;
+	fr->buffer.data = data;
+	fr->buffer.fill = fill;
+	planar_store(fr, (unsigned char*)scratch, bytes);
+	return clip;
+}
+
 /* set synth functions for current frame, optimizations handled by opt_* macros */
 int set_synth_functions(mpg123_handle *fr)
 {
 	enum synth_resample resample = r_none;
 	enum synth_format basic_format = f_none; /* Default is always 16bit, or whatever. */
+	enum synth_format synth_format;
 
 	/* Select the basic output format, different from 16bit: 8bit, real. */
 	if(FALSE){}
@@ -403,6 +449,9 @@ int set_synth_functions(mpg123_handle *fr)
 #endif
 #ifndef NO_NTOM
 		case 3: resample = r_ntom; break;
+#endif
+#ifdef RESAMPLER
+		case 4: resample = r_1to1; break;
 #endif
 	}
 
@@ -413,13 +462,27 @@ int set_synth_functions(mpg123_handle *fr)
 		return -1;
 	}
 
-	debug2("selecting synth: resample=%i format=%i", resample, basic_format);
+	/* The resampler takes real samples at the native rate. */
+	synth_format = basic_format;
+#ifdef RESAMPLER
+	if(fr->down_sample == 4) synth_format = f_real;
+#endif
+
+	debug2("selecting synth: resample=%i format=%i", resample, synth_format);
 	/* Finally selecting the synth functions for stereo / mono. */
-	fr->synth = fr->synths.plain[resample][basic_format];
-	fr->synth_stereo = fr->synths.stereo[resample][basic_format];
+	fr->synth = fr->synths.plain[resample][synth_format];
+	fr->synth_stereo = fr->synths.stereo[resample][synth_format];
 	fr->synth_mono = fr->af.channels==2
-		? fr->synths.mono2stereo[resample][basic_format] /* Mono MPEG file decoded to stereo. */
-		: fr->synths.mono[resample][basic_format];       /* Mono MPEG file decoded to mono. */
+		? fr->synths.mono2stereo[resample][synth_format] /* Mono MPEG file decoded to stereo. */
+		: fr->synths.mono[resample][synth_format];       /* Mono MPEG file decoded to mono. */
+	/* The resampler has its own input buffer, it handles planes on output. */
+	if(fr->af.planar && fr->down_sample != 4)
+	{
+		fr->pl.stereo = fr->synth_stereo;
+		fr->pl.mono   = fr->synth_mono;
+		fr->synth_stereo = synth_planar_stereo;
+		fr->synth_mono   = synth_planar_mono;
+	}
 
 	if(find_dectype(fr) != MPG123_OK) /* Actually determine the currently active decoder breed. */
 	{
@@ -452,10 +515,10 @@ int set_synth_functions(mpg123_handle *fr)
 	   The real-decoding SSE for x86-64 uses normal tables! */
 	if(fr->cpu_opts.class == mmxsse
 #	ifndef NO_REAL
-	   && basic_format != f_real
+	   && synth_format != f_real
 #	endif
 #	ifndef NO_32BIT
-	   && basic_format != f_32
+	   && synth_format != f_32
 #	endif
 #	ifdef ACCURATE_ROUNDING
 	   && fr->cpu_opts.type != sse
@@ -468,10 +531,10 @@ int set_synth_functions(mpg123_handle *fr)
 	  )
 	{
 #ifndef NO_LAYER3
-		init_layer3_stuff(fr, init_layer3_gainpow2_mmx);
+		init_layer3_stuff(fr, 1);
 #endif
 #ifndef NO_LAYER12
-		init_layer12_stuff(fr, init_layer12_table_mmx);
+		init_layer12_stuff(fr, 1);
 #endif
 		fr->make_decode_tables = make_decode_tables_mmx;
 	}
@@ -479,10 +542,10 @@ int set_synth_functions(mpg123_handle *fr)
 #endif
 	{
 #ifndef NO_LAYER3
-		init_layer3_stuff(fr, init_layer3_gainpow2);
+		init_layer3_stuff(fr, 0);
 #endif
 #ifndef NO_LAYER12
-		init_layer12_stuff(fr, init_layer12_table);
+		init_layer12_stuff(fr, 0);
 #endif
 		fr->make_decode_tables = make_decode_tables;
 	}
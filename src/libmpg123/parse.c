@@ -555,12 +555,15 @@ init_resync:
 	{
 		unsigned char *newbuf = fr->bsspace[fr->bsnum]+512;
 		/* read main data into memory */
+		fr->rdat.framebody = NULL;
 		if((ret=fr->rd->read_frame_body(fr,newbuf,fr->framesize))<0)
 		{
 			/* if failed: flip back */
 			debug("need more?");
 			goto read_frame_bad;
 		}
+		/* Maybe the reader had it in memory already. */
+		if(fr->rdat.framebody != NULL) newbuf = fr->rdat.framebody;
 		fr->bsbufold = fr->bsbuf;
 		fr->bsbuf = newbuf;
 	}
@@ -600,6 +603,7 @@ init_resync:
 		fr->mean_framesize = ((fr->mean_frames-1)*fr->mean_framesize+compute_bpf(fr)) / fr->mean_frames ;
 	}
 	++fr->num; /* 0 for first frame! */
+	COUNTER_ADD(fr, frames, 1);
 	debug4("Frame %"OFF_P" %08lx %i, next filepos=%"OFF_P, 
 	(off_p)fr->num, newhead, fr->framesize, (off_p)fr->rd->tell(fr));
 	if(!(fr->state_flags & FRAME_FRANKENSTEIN) && (
@@ -1115,17 +1119,12 @@ apetag_bad:
 	return PARSE_AGAIN; /* Give the resync code a chance to fix things */
 }
 
-/* Advance a byte in stream to get next possible header and forget 
-   buffered data if possible (for feed reader). */
-#define FORGET_INTERVAL 1024 /* Used by callers to set forget flag each <n> bytes. */
-static int forget_head_shift(mpg123_handle *fr, unsigned long *newheadp, int forget)
+/* Try to forget buffered data as early as possible to speed up parsing where
+   new data needs to be added for resync (and things would be re-parsed again
+   and again because of the start from beginning after hitting end). */
+static void head_forget(mpg123_handle *fr)
 {
-	int ret;
-	if((ret=fr->rd->head_shift(fr,newheadp))<=0) return ret;
-	/* Try to forget buffered data as early as possible to speed up parsing where
-	   new data needs to be added for resync (and things would be re-parsed again
-	   and again because of the start from beginning after hitting end). */
-	if(forget && fr->rd->forget != NULL)
+	if(fr->rd->forget != NULL)
 	{
 		/* Ensure that the last 4 bytes stay in buffers for reading the header
 		   anew. */
@@ -1135,9 +1134,33 @@ static int forget_head_shift(mpg123_handle *fr, unsigned long *newheadp, int for
 			fr->rd->back_bytes(fr, -4);
 		}
 	}
+}
+
+/* Advance a byte in stream to get next possible header and forget 
+   buffered data if possible (for feed reader). */
+#define FORGET_INTERVAL 1024 /* Used by callers to set forget flag each <n> bytes. */
+static int forget_head_shift(mpg123_handle *fr, unsigned long *newheadp, int forget)
+{
+	int ret;
+	if((ret=fr->rd->head_shift(fr,newheadp))<=0) return ret;
+	COUNTER_ADD(fr, resync_bytes, 1);
+	if(forget) head_forget(fr);
 	return ret; /* No surprise here, error already triggered early return. */
 }
 
+/* Advance up to limit bytes (any number if < 0) in the stream, stopping at the
+   first header with sync bits, which still needs head_check(). The reader
+   scans blocks of data at once where it can. Returns the count of bytes
+   advanced, or <= 0 like head_shift(). */
+static long forget_head_sync(mpg123_handle *fr, unsigned long *newheadp, long limit)
+{
+	long ret;
+	if((ret=fr->rd->head_sync(fr,newheadp,limit))<=0) return ret;
+	COUNTER_ADD(fr, resync_bytes, ret);
+	head_forget(fr);
+	return ret;
+}
+
 /* watch out for junk/tags on beginning of stream by invalid header */
 static int skip_junk(mpg123_handle *fr, unsigned long *newheadp, long *headcount)
 {
@@ -1189,11 +1212,16 @@ static int skip_junk(mpg123_handle *fr, unsigned long *newheadp, long *headcount
 
 	do
 	{
-		++(*headcount);
-		if(limit >= 0 && *headcount >= limit) break;				
+		long got;
+		if(limit >= 0 && *headcount+1 >= limit)
+		{
+			++(*headcount);
+			break;
+		}
 
-		if(++forgetcount > FORGET_INTERVAL) forgetcount = 0;
-		if((ret=forget_head_shift(fr, &newhead, !forgetcount))<=0) return ret;
+		got = forget_head_sync(fr, &newhead, limit >= 0 ? limit-1-*headcount : -1);
+		if(got <= 0) return (int)got;
+		*headcount += got;
 
 		if(head_check(newhead) && (ret=decode_header(fr, newhead, &freeformat_count))) break;
 	} while(1);
@@ -1259,26 +1287,29 @@ static int wetwork(mpg123_handle *fr, unsigned long *newheadp)
 	{
 		long try = 0;
 		long limit = fr->p.resync_limit;
-		unsigned int forgetcount = 0;
 
 		/* If a resync is needed the bitreservoir of previous frames is no longer valid */
 		fr->bitreservoir = 0;
 
 		if(NOQUIET && fr->silent_resync == 0) fprintf(stderr, "Note: Trying to resync...\n");
 
-		do /* ... shift the header with additional single bytes until be found something that could be a header. */
+		do /* ... shift the header along until we found something that could be a header. */
 		{
-			++try;
-			if(limit >= 0 && try >= limit) break;				
+			long got;
+			if(limit >= 0 && try+1 >= limit)
+			{
+				++try;
+				break;
+			}
 
-			if(++forgetcount > FORGET_INTERVAL) forgetcount = 0;
-			if((ret=forget_head_shift(fr,&newhead,!forgetcount)) <= 0)
+			if((got=forget_head_sync(fr, &newhead, limit >= 0 ? limit-1-try : -1)) <= 0)
 			{
 				*newheadp = newhead;
 				if(NOQUIET) fprintf (stderr, "Note: Hit end of (available) data during resync.\n");
 
-				return ret ? ret : PARSE_END;
+				return got ? (int)got : PARSE_END;
 			}
+			try += got;
 			if(VERBOSE3) debug3("resync try %li at %"OFF_P", got newhead 0x%08lx", try, (off_p)fr->rd->tell(fr),  newhead);
 		} while(!head_check(newhead));
 
@@ -0,0 +1,434 @@
+/*
+	pcmcache: decoded audio of whole tracks, shared among handles
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	Entries do not change once they are in the cache and are only freed
+	when no handle references them, so copying audio out needs no lock.
+	The lock functions of the application guard the list and the counts.
+	A new entry evicts the least recently used ones not in use to stay
+	within the budget, or is dropped if that is not possible. There is only
+	one entry per key; a second complete decode is dropped, too.
+
+	Only regular files are known by their identity. For the decoder state
+	to be the one of a plain sequential decode, the frames of a new entry
+	have to be stored in order from the first one, without seeks or frames
+	from the cache in between. When decoding has to take over after frames
+	from the cache, it starts over as after a seek.
+*/
+
+#include "mpg123lib_intern.h"
+#include <sys/stat.h>
+#include "debug.h"
+
+struct pcmcache_entry
+{
+	struct pcmcache_entry *prev; /* used more recently */
+	struct pcmcache_entry *next;
+	struct pcmcache_key key;
+	off_t frames;
+	unsigned char *data;
+	size_t *offsets; /* frames+1 of them, into data */
+	size_t bytes;    /* counted against the budget */
+	int users;
+};
+
+struct mpg123_cache_struct
+{
+	size_t limit;
+	size_t used;
+	struct pcmcache_entry *first; /* most recently used */
+	struct pcmcache_entry *last;
+	void (*lock)(void *);
+	void (*unlock)(void *);
+	void *lockdata;
+};
+
+static void cache_lock(mpg123_cache *cache)
+{
+	if(cache->lock != NULL) cache->lock(cache->lockdata);
+}
+
+static void cache_unlock(mpg123_cache *cache)
+{
+	if(cache->unlock != NULL) cache->unlock(cache->lockdata);
+}
+
+static void entry_free(struct pcmcache_entry *e)
+{
+	if(e->data != NULL) free(e->data);
+	if(e->offsets != NULL) free(e->offsets);
+	free(e);
+}
+
+static void entry_unlink(mpg123_cache *cache, struct pcmcache_entry *e)
+{
+	if(e->prev != NULL) e->prev->next = e->next;
+	else cache->first = e->next;
+	if(e->next != NULL) e->next->prev = e->prev;
+	else cache->last = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void entry_push(mpg123_cache *cache, struct pcmcache_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache->first;
+	if(cache->first != NULL) cache->first->prev = e;
+	else cache->last = e;
+	cache->first = e;
+}
+
+/* Parsing the Info frame as audio or not skipping junk gives other frames. */
+#define PCMCACHE_FLAGS (MPG123_IGNORE_INFOFRAME|MPG123_NO_RESYNC)
+
+static int key_equal(const struct pcmcache_key *a, const struct pcmcache_key *b)
+{
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size
+	&&	a->mtime == b->mtime && a->flags == b->flags
+	&&	a->rate == b->rate && a->channels == b->channels
+	&&	a->encoding == b->encoding && a->planar == b->planar
+	&&	a->decoder == b->decoder
+	&&	a->down_sample == b->down_sample && a->single == b->single
+	&&	a->scale == b->scale;
+}
+
+mpg123_cache attribute_align_arg *mpg123_new_cache( size_t bytes
+,	void (*lock)(void *), void (*unlock)(void *), void *lockdata, int *error )
+{
+	mpg123_cache *cache;
+	if((lock == NULL) != (unlock == NULL))
+	{
+		if(error != NULL) *error = MPG123_BAD_VALUE;
+		return NULL;
+	}
+	cache = malloc(sizeof(*cache));
+	if(cache == NULL)
+	{
+		if(error != NULL) *error = MPG123_OUT_OF_MEM;
+		return NULL;
+	}
+	cache->limit = bytes;
+	cache->used = 0;
+	cache->first = cache->last = NULL;
+	cache->lock = lock;
+	cache->unlock = unlock;
+	cache->lockdata = lockdata;
+	if(error != NULL) *error = MPG123_OK;
+	return cache;
+}
+
+void attribute_align_arg mpg123_delete_cache(mpg123_cache *cache)
+{
+	if(cache == NULL) return;
+	while(cache->first != NULL)
+	{
+		struct pcmcache_entry *e = cache->first;
+		entry_unlink(cache, e);
+		entry_free(e);
+	}
+	free(cache);
+}
+
+void pcmcache_init(mpg123_handle *fr)
+{
+	fr->pc.cache = NULL;
+	fr->pc.known = 0;
+	fr->pc.looked = 0;
+	fr->pc.stale = 0;
+	fr->pc.entry = NULL;
+	fr->pc.hits = 0;
+	fr->pc.frames = 0;
+	fr->pc.data = NULL;
+	fr->pc.fill = 0;
+	fr->pc.size = 0;
+	fr->pc.offsets = NULL;
+	fr->pc.slots = 0;
+}
+
+static void build_free(struct pcmcache_state *pc)
+{
+	if(pc->data != NULL) free(pc->data);
+	if(pc->offsets != NULL) free(pc->offsets);
+	pc->data = NULL;
+	pc->offsets = NULL;
+	pc->fill = pc->size = pc->slots = 0;
+	pc->frames = 0;
+}
+
+/* Let go of the entry and the frames stored for a new one. */
+static void release(mpg123_handle *fr)
+{
+	struct pcmcache_entry *e = fr->pc.entry;
+	if(e != NULL)
+	{
+		cache_lock(fr->pc.cache);
+		--e->users;
+		cache_unlock(fr->pc.cache);
+		fr->pc.entry = NULL;
+	}
+	build_free(&fr->pc);
+	fr->pc.looked = 0;
+}
+
+int attribute_align_arg mpg123_set_cache(mpg123_handle *mh, mpg123_cache *cache)
+{
+	if(mh == NULL) return MPG123_BAD_HANDLE;
+	release(mh);
+	mh->pc.cache = cache;
+	return MPG123_OK;
+}
+
+void pcmcache_identify(mpg123_handle *fr)
+{
+	struct stat st;
+	fr->pc.known = 0;
+	/* Only files we read ourselves, not anything behind replaced I/O.
+	   Without inode numbers, files on a device are not told apart. */
+	if(  (fr->rdat.flags & READER_HANDLEIO)
+	  || fr->rdat.r_read != NULL || fr->rdat.r_lseek != NULL
+	  || fstat(fr->rdat.filept, &st) != 0 || !S_ISREG(st.st_mode)
+	  || st.st_ino == 0 )
+	return;
+	fr->pc.key.dev = st.st_dev;
+	fr->pc.key.ino = st.st_ino;
+	fr->pc.key.size = st.st_size;
+	fr->pc.key.mtime = st.st_mtime;
+	fr->pc.known = 1;
+}
+
+static void lookup(mpg123_handle *fr)
+{
+	mpg123_cache *cache = fr->pc.cache;
+	struct pcmcache_entry *e;
+	cache_lock(cache);
+	for(e = cache->first; e != NULL; e = e->next)
+	if(key_equal(&e->key, &fr->pc.key))
+	{
+		entry_unlink(cache, e);
+		entry_push(cache, e);
+		++e->users;
+		break;
+	}
+	cache_unlock(cache);
+	fr->pc.entry = e;
+	fr->pc.looked = 1;
+	debug1("pcmcache: %s", e != NULL ? "hit" : "miss");
+}
+
+/* The decoder did not see the frames from the cache, start over as after a seek. */
+static void decoder_refresh(mpg123_handle *fr)
+{
+	if(fr->rawbuffs != NULL) memset(fr->rawbuffs, 0, fr->rawbuffss);
+	fr->hybrid_blc[0] = fr->hybrid_blc[1] = 0;
+	memset(fr->hybrid_block, 0, sizeof(fr->hybrid_block));
+#ifdef RESAMPLER
+	fr->rs.next = -1;
+#endif
+#ifndef NO_NTOM
+	if(fr->down_sample == 3) ntom_set_ntom(fr, fr->num);
+#endif
+}
+
+int pcmcache_frame(mpg123_handle *fr)
+{
+	struct pcmcache_state *pc = &fr->pc;
+	/* The equalizer can change at any time, no caching with it. */
+	if(pc->cache != NULL && pc->known && !fr->have_eq_settings)
+	{
+		struct pcmcache_key key = pc->key;
+		key.flags = fr->p.flags & PCMCACHE_FLAGS;
+		key.rate = fr->af.rate;
+		key.channels = fr->af.channels;
+		key.encoding = fr->af.encoding;
+		key.planar = fr->af.planar;
+		key.decoder = fr->cpu_opts.type;
+		key.down_sample = fr->down_sample;
+		key.single = fr->single;
+		key.scale = fr->lastscale;
+		if(!pc->looked || !key_equal(&key, &pc->key))
+		{
+			release(fr);
+			pc->key = key;
+			lookup(fr);
+		}
+		if(pc->entry != NULL && fr->num >= 0 && fr->num < pc->entry->frames)
+		{
+			pc->stale = 1;
+			++pc->hits;
+			return 1;
+		}
+	}
+	if(pc->stale)
+	{
+		decoder_refresh(fr);
+		pc->stale = 0;
+	}
+	return 0;
+}
+
+void pcmcache_fetch(mpg123_handle *fr)
+{
+	struct pcmcache_entry *e = fr->pc.entry;
+	size_t i = (size_t)fr->num;
+	size_t bytes = e->offsets[i+1] - e->offsets[i];
+	/* Same key, same size. Just making sure. */
+	if(bytes > fr->buffer.size) bytes = fr->buffer.size;
+	memcpy(fr->buffer.data, e->data + e->offsets[i], bytes);
+	fr->buffer.fill = bytes;
+}
+
+void pcmcache_store(mpg123_handle *fr)
+{
+	struct pcmcache_state *pc = &fr->pc;
+	size_t bytes = fr->buffer.fill;
+	/* Only with a key from pcmcache_frame() and no entry for it. */
+	if( pc->cache == NULL || !pc->known || !pc->looked
+	 || fr->have_eq_settings || pc->entry != NULL )
+	return;
+	if(fr->num == 0)
+	{
+		/* Do not start on a track that will not fit, as far as one can tell. */
+		double frames = fr->track_frames > 0
+		?	(double)fr->track_frames
+		:	( fr->rdat.filelen > 0 ? (double)fr->rdat.filelen/compute_bpf(fr) : 0. );
+		pc->frames = 0;
+		pc->fill = 0;
+		if(frames*bytes > (double)pc->cache->limit)
+		{
+			build_free(pc);
+			return;
+		}
+	}
+	else if(fr->num != pc->frames || pc->frames == 0)
+	{
+		if(pc->frames) debug1("pcmcache: frame %"OFF_P" out of order", (off_p)fr->num);
+		build_free(pc);
+		return;
+	}
+	/* Not even the decode up to here fits into the cache. */
+	if(pc->fill + bytes + sizeof(size_t)*(pc->frames+2) > pc->cache->limit)
+	{
+		build_free(pc);
+		return;
+	}
+	if(pc->fill + bytes > pc->size)
+	{
+		size_t size = pc->size ? pc->size : 16*bytes+1;
+		unsigned char *data;
+		while(size < pc->fill + bytes) size *= 2;
+		data = safe_realloc(pc->data, size);
+		if(data == NULL)
+		{
+			build_free(pc);
+			return;
+		}
+		pc->data = data;
+		pc->size = size;
+	}
+	if((size_t)pc->frames+2 > pc->slots)
+	{
+		size_t slots = pc->slots ? 2*pc->slots : 64;
+		size_t *offsets = safe_realloc(pc->offsets, sizeof(size_t)*slots);
+		if(offsets == NULL)
+		{
+			build_free(pc);
+			return;
+		}
+		pc->offsets = offsets;
+		pc->slots = slots;
+	}
+	memcpy(pc->data + pc->fill, fr->buffer.data, bytes);
+	pc->offsets[0] = 0;
+	pc->fill += bytes;
+	pc->offsets[++pc->frames] = pc->fill;
+}
+
+void pcmcache_seek(mpg123_handle *fr)
+{
+	build_free(&fr->pc);
+	/* The seek resets the decoder anyway. */
+	fr->pc.stale = 0;
+}
+
+void pcmcache_done(mpg123_handle *fr)
+{
+	struct pcmcache_state *pc = &fr->pc;
+	mpg123_cache *cache = pc->cache;
+	struct pcmcache_entry *e, *old;
+	size_t avail;
+
+	if(pc->frames == 0) return;
+	if(cache == NULL || pc->frames != fr->num+1)
+	{
+		build_free(pc);
+		return;
+	}
+	e = malloc(sizeof(*e));
+	if(e == NULL)
+	{
+		build_free(pc);
+		return;
+	}
+	/* Give back what growing in steps left over. */
+	e->data = pc->fill ? safe_realloc(pc->data, pc->fill) : NULL;
+	if(e->data == NULL) e->data = pc->data;
+	else pc->size = pc->fill;
+	e->offsets = safe_realloc(pc->offsets, sizeof(size_t)*(pc->frames+1));
+	if(e->offsets == NULL) e->offsets = pc->offsets;
+	else pc->slots = pc->frames+1;
+	e->key = pc->key;
+	e->frames = pc->frames;
+	e->bytes = sizeof(*e) + pc->size + sizeof(size_t)*pc->slots;
+	e->users = 0;
+	e->prev = e->next = NULL;
+	pc->data = NULL;
+	pc->offsets = NULL;
+	build_free(pc);
+	/* Next time, this handle can use the new entry, too. */
+	pc->looked = 0;
+
+	cache_lock(cache);
+	avail = cache->limit - cache->used;
+	for(old = cache->first; old != NULL; old = old->next)
+	{
+		if(key_equal(&old->key, &e->key)) break;
+		if(!old->users) avail += old->bytes;
+	}
+	if(old == NULL && e->bytes <= avail)
+	{
+		old = cache->last;
+		while(cache->used + e->bytes > cache->limit)
+		{
+			struct pcmcache_entry *prev = old->prev;
+			if(!old->users)
+			{
+				debug1("pcmcache: evicting %"SIZE_P" bytes", (size_p)old->bytes);
+				entry_unlink(cache, old);
+				cache->used -= old->bytes;
+				entry_free(old);
+			}
+			old = prev;
+		}
+		entry_push(cache, e);
+		cache->used += e->bytes;
+		debug2("pcmcache: new entry of %"OFF_P" frames, %"SIZE_P" bytes", (off_p)e->frames, (size_p)e->bytes);
+		e = NULL;
+	}
+	cache_unlock(cache);
+	if(e != NULL) entry_free(e);
+}
+
+void pcmcache_close(mpg123_handle *fr)
+{
+	release(fr);
+	fr->pc.known = 0;
+	fr->pc.stale = 0;
+	fr->pc.hits = 0;
+}
+
+size_t pcmcache_mem(mpg123_handle *fr)
+{
+	return fr->pc.size + sizeof(size_t)*fr->pc.slots;
+}
@@ -0,0 +1,82 @@
+#ifndef MPG123_H_PCMCACHE
+#define MPG123_H_PCMCACHE
+
+/*
+	pcmcache: decoded audio of whole tracks, shared among handles
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	A handle with a cache attached (mpg123_set_cache()) looks up the file
+	it is decoding together with the output setup. On a hit, frames are
+	copied from the cache instead of being decoded, before the gapless
+	cutting, so that and seeking work as usual. On a miss, the handle keeps
+	the output of a sequential decode from the first frame on and hands it
+	to the cache when it reaches the end of the track.
+*/
+
+#include "config.h"
+#include "compat.h"
+#include <time.h>
+
+/* What makes decoded frames the same. */
+struct pcmcache_key
+{
+	/* The file: device, inode, size and modification time. */
+	dev_t  dev;
+	ino_t  ino;
+	off_t  size;
+	time_t mtime;
+	/* The parsing: flags that change which frames there are (PCMCACHE_FLAGS). */
+	long   flags;
+	/* The output: format, layout, decoder, rate reduction, channel mode, volume. */
+	long   rate;
+	int    channels;
+	int    encoding;
+	int    planar;
+	int    decoder;
+	int    down_sample;
+	int    single;
+	double scale;
+};
+
+struct pcmcache_entry;
+
+/* The part living in the handle. */
+struct pcmcache_state
+{
+	mpg123_cache *cache;
+	struct pcmcache_key key;
+	int known;    /* the file part of key is valid */
+	int looked;   /* lookup done for the current key */
+	int stale;    /* decoder state is from before frames taken from the cache */
+	struct pcmcache_entry *entry; /* referenced while in use */
+	off_t hits;   /* frames not decoded thanks to the cache */
+	/* Output of frames [0, frames) for a new entry. */
+	off_t frames;
+	unsigned char *data;
+	size_t fill;
+	size_t size;
+	size_t *offsets; /* frames+1 of them */
+	size_t slots;
+};
+
+void pcmcache_init(mpg123_handle *fr);
+/* Remember the identity of a freshly opened file. */
+void pcmcache_identify(mpg123_handle *fr);
+/* Before decoding the current frame: Returns 1 if the cache has it, the
+   decoder can skip the frame then. Otherwise, it is decoded as usual. */
+int pcmcache_frame(mpg123_handle *fr);
+/* Put the cached output of the current frame into the buffer. */
+void pcmcache_fetch(mpg123_handle *fr);
+/* Keep the output of the current frame that got decoded. */
+void pcmcache_store(mpg123_handle *fr);
+/* Decoding does not continue from the last stored frame. */
+void pcmcache_seek(mpg123_handle *fr);
+/* End of track: Hand a complete decode to the cache. */
+void pcmcache_done(mpg123_handle *fr);
+/* Drop everything of the current track, also when detaching the cache. */
+void pcmcache_close(mpg123_handle *fr);
+size_t pcmcache_mem(mpg123_handle *fr);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+	readahead.c: input read-ahead thread
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	With input on a network file system, each read() of the decoding thread
+	may block for a while and make the audio drop out. Here, a thread reads
+	ahead into a ring buffer, which the reader (fdread) takes the bytes from.
+
+	Positions are plain stream offsets. The ring holds [start, end), the
+	thread appends at end, the reader consumes at pos and moves start up
+	behind it, leaving some history for small seeks back. The reader only
+	takes the lock when it runs out of bytes it knows about, when it frees a
+	good piece of the window, or on seeks. A seek outside the window is a
+	request for the thread, which drops whatever read was in flight.
+*/
+
+/* Needed for pthread_sigmask() from signal.h. */
+#define _POSIX_C_SOURCE 200112L
+
+#include "mpg123lib_intern.h"
+#include <pthread.h>
+#include <signal.h>
+#include "debug.h"
+
+/* Largest single read() of the thread. */
+#define AHEAD_CHUNK (64*1024)
+/* Smallest window that makes sense with that. */
+#define AHEAD_MIN (16*1024)
+
+struct readahead
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* for the thread: space or a request */
+	pthread_cond_t data; /* for the reader: bytes, end or a finished seek */
+	struct reader_data *rdat;
+	ssize_t (*read)(struct reader_data *, void *, size_t);
+	off_t   (*seek)(struct reader_data *, off_t, int);
+	unsigned char *buf;
+	size_t size;
+	size_t history; /* consumed bytes kept for seeking back */
+	/* Only the reader touches these. */
+	off_t pos;   /* next byte to hand out */
+	off_t ready; /* the last end the reader has seen */
+	/* The rest is protected by the lock. */
+	off_t start;
+	off_t end;
+	off_t seekto;  /* pending seek request, -1 if none */
+	unsigned long seeks; /* counts requests, to spot stale reads */
+	long stalls;
+	int eof;
+	int err;
+	int quit;
+	int thread_waiting;
+	int reader_waiting;
+};
+
+static void *ahead_loop(void *arg)
+{
+	struct readahead *ra = arg;
+	pthread_mutex_lock(&ra->lock);
+	while(!ra->quit)
+	{
+		unsigned long seeks = ra->seeks;
+		if(ra->seekto >= 0)
+		{
+			off_t to = ra->seekto;
+			off_t ret;
+			pthread_mutex_unlock(&ra->lock);
+			ret = ra->seek(ra->rdat, to, SEEK_SET);
+			pthread_mutex_lock(&ra->lock);
+			if(seeks != ra->seeks)
+				continue; /* Another one came in meanwhile. */
+			debug2("read-ahead seek to %"OFF_P": %"OFF_P, (off_p)to, (off_p)ret);
+			ra->seekto = -1;
+			ra->start = ra->end = to;
+			ra->eof = 0;
+			ra->err = ret != to;
+		}
+		else if(ra->eof || ra->err || ra->end - ra->start >= (off_t)ra->size)
+		{
+			ra->thread_waiting = 1;
+			pthread_cond_wait(&ra->wake, &ra->lock);
+			ra->thread_waiting = 0;
+			continue;
+		}
+		else
+		{
+			size_t ringpos = (size_t)(ra->end % (off_t)ra->size);
+			size_t count = ra->size - (size_t)(ra->end - ra->start);
+			ssize_t got;
+			if(count > ra->size - ringpos)
+				count = ra->size - ringpos;
+			if(count > AHEAD_CHUNK)
+				count = AHEAD_CHUNK;
+			/* The reader does not look beyond end, this part is ours. */
+			pthread_mutex_unlock(&ra->lock);
+			got = ra->read(ra->rdat, ra->buf+ringpos, count);
+			pthread_mutex_lock(&ra->lock);
+			if(seeks != ra->seeks)
+				continue; /* Stale data from before a seek, forget it. */
+			if(got > 0)
+				ra->end += got;
+			else if(got == 0)
+				ra->eof = 1;
+			else
+				ra->err = 1;
+		}
+		if(ra->reader_waiting)
+			pthread_cond_signal(&ra->data);
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return NULL;
+}
+
+struct readahead *ahead_new( struct reader_data *rdat, size_t window, off_t pos
+,	ssize_t (*read)(struct reader_data *, void *, size_t)
+,	off_t (*seek)(struct reader_data *, off_t, int) )
+{
+	struct readahead *ra;
+	sigset_t all, old;
+	int err;
+
+	if(window < AHEAD_MIN)
+		window = AHEAD_MIN;
+	ra = malloc(sizeof(*ra));
+	if(ra == NULL)
+		return NULL;
+	ra->buf = malloc(window);
+	if(ra->buf == NULL)
+	{
+		free(ra);
+		return NULL;
+	}
+	ra->rdat = rdat;
+	ra->read = read;
+	ra->seek = seek;
+	ra->size = window;
+	ra->history = window/4;
+	ra->pos = ra->ready = ra->start = ra->end = pos;
+	ra->seekto = -1;
+	ra->seeks = 0;
+	ra->stalls = 0;
+	ra->eof = ra->err = ra->quit = 0;
+	ra->thread_waiting = ra->reader_waiting = 0;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->wake, NULL);
+	pthread_cond_init(&ra->data, NULL);
+	/* Signals are for the application's threads, not for this one. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&ra->thread, NULL, ahead_loop, ra);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err)
+	{
+		pthread_cond_destroy(&ra->data);
+		pthread_cond_destroy(&ra->wake);
+		pthread_mutex_destroy(&ra->lock);
+		free(ra->buf);
+		free(ra);
+		return NULL;
+	}
+	return ra;
+}
+
+/* This waits for a read in progress, there is no portable way to cut it short. */
+void ahead_del(struct readahead *ra)
+{
+	if(ra == NULL)
+		return;
+	pthread_mutex_lock(&ra->lock);
+	ra->quit = 1;
+	pthread_cond_signal(&ra->wake);
+	pthread_mutex_unlock(&ra->lock);
+	pthread_join(ra->thread, NULL);
+	pthread_cond_destroy(&ra->data);
+	pthread_cond_destroy(&ra->wake);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra->buf);
+	free(ra);
+}
+
+/* With the lock held: Give the window behind the history back to the thread. */
+static void ahead_release(struct readahead *ra)
+{
+	off_t keep = ra->pos - (off_t)ra->history;
+	if(ra->seekto < 0 && keep > ra->start)
+	{
+		ra->start = keep;
+		if(ra->thread_waiting)
+			pthread_cond_signal(&ra->wake);
+	}
+	ra->ready = ra->end;
+}
+
+/* Get to know about more bytes, waiting if there are none yet.
+   Returns the count after pos, 0 on end, -1 on error. */
+static ssize_t ahead_wait(struct readahead *ra)
+{
+	ssize_t ret;
+	pthread_mutex_lock(&ra->lock);
+	while(ra->seekto >= 0)
+	{
+		ra->reader_waiting = 1;
+		pthread_cond_wait(&ra->data, &ra->lock);
+		ra->reader_waiting = 0;
+	}
+	ahead_release(ra);
+	if(ra->end <= ra->pos && !ra->err)
+	{
+		if(ra->eof)
+		{
+			/* Look again, the file might have grown. */
+			ra->eof = 0;
+			if(ra->thread_waiting)
+				pthread_cond_signal(&ra->wake);
+		}
+		/* Having read everything there was, not waiting for a fresh start. */
+		else if(ra->end > ra->start)
+			++ra->stalls;
+		while(ra->end <= ra->pos && !ra->eof && !ra->err)
+		{
+			ra->reader_waiting = 1;
+			pthread_cond_wait(&ra->data, &ra->lock);
+			ra->reader_waiting = 0;
+		}
+		ra->ready = ra->end;
+	}
+	if(ra->end > ra->pos)
+		ret = (ssize_t)(ra->end - ra->pos);
+	else
+		ret = ra->err ? -1 : 0;
+	pthread_mutex_unlock(&ra->lock);
+	return ret;
+}
+
+ssize_t ahead_read(struct readahead *ra, void *buf, size_t count)
+{
+	size_t got = 0;
+	if(ra->ready <= ra->pos)
+	{
+		ssize_t ret = ahead_wait(ra);
+		if(ret <= 0)
+			return ret;
+	}
+	/* Up to two pieces, around the end of the ring. */
+	while(got < count && ra->pos < ra->ready)
+	{
+		size_t ringpos = (size_t)(ra->pos % (off_t)ra->size);
+		size_t piece = count - got;
+		if(piece > (size_t)(ra->ready - ra->pos))
+			piece = (size_t)(ra->ready - ra->pos);
+		if(piece > ra->size - ringpos)
+			piece = ra->size - ringpos;
+		memcpy((unsigned char*)buf+got, ra->buf+ringpos, piece);
+		got += piece;
+		ra->pos += piece;
+	}
+	/* Start is only changed by this side outside of seeks, no lock for looking. */
+	if(ra->pos - (off_t)ra->history - ra->start >= (off_t)(ra->size/4))
+	{
+		pthread_mutex_lock(&ra->lock);
+		ahead_release(ra);
+		pthread_mutex_unlock(&ra->lock);
+	}
+	return (ssize_t)got;
+}
+
+off_t ahead_seek(struct readahead *ra, off_t pos)
+{
+	pthread_mutex_lock(&ra->lock);
+	if(ra->seekto < 0 && pos >= ra->start && pos <= ra->end)
+	{
+		debug1("read-ahead seek to %"OFF_P" inside window", (off_p)pos);
+		ra->ready = ra->end;
+	}
+	else
+	{
+		ra->seekto = pos;
+		++ra->seeks;
+		ra->ready = pos;
+		if(ra->thread_waiting)
+			pthread_cond_signal(&ra->wake);
+	}
+	ra->pos = pos;
+	pthread_mutex_unlock(&ra->lock);
+	return pos;
+}
+
+size_t ahead_fill(struct readahead *ra)
+{
+	size_t fill = 0;
+	pthread_mutex_lock(&ra->lock);
+	if(ra->seekto < 0 && ra->end > ra->pos)
+		fill = (size_t)(ra->end - ra->pos);
+	pthread_mutex_unlock(&ra->lock);
+	return fill;
+}
+
+long ahead_stalls(struct readahead *ra)
+{
+	long stalls;
+	pthread_mutex_lock(&ra->lock);
+	stalls = ra->stalls;
+	pthread_mutex_unlock(&ra->lock);
+	return stalls;
+}
+
+size_t ahead_mem(struct readahead *ra)
+{
+	return sizeof(*ra) + ra->size;
+}
@@ -12,6 +12,11 @@
 #include "config.h"
 #include "mpg123.h"
 
+/* Plain files can be mapped into memory (MPG123_MMAP). */
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define READ_MMAP
+#endif
+
 #ifndef NO_FEEDER
 struct buffy
 {
@@ -19,6 +24,9 @@ struct buffy
 	ssize_t size;
 	ssize_t realsize;
 	struct buffy *next;
+	/* For caller-owned data (mpg123_feed_ref()), called instead of free(). */
+	void (*release)(void *handle);
+	void *handle;
 };
 
 
@@ -47,6 +55,8 @@ void bc_cleanup(struct bufferchain *);
 void bc_poolsize(struct bufferchain *, size_t pool_size, size_t bufblock);
 /* Return available byte count in the buffer. */
 size_t bc_fill(struct bufferchain *bc);
+/* Return the memory held by the chain and its pool, in bytes. */
+size_t bc_mem(struct bufferchain *bc);
 
 #endif
 
@@ -74,9 +84,20 @@ struct reader_data
 	off_t   (*lseek)(int fd, off_t offset, int whence);
 	/* Buffered readers want that abstracted, set internally. */
 	ssize_t (*fullread)(mpg123_handle *, unsigned char *, ssize_t);
+	/* A reader can hand out the frame body in place instead of copying it
+	   to the buffer given to read_frame_body(). NULL otherwise. */
+	unsigned char *framebody;
+#ifdef READ_MMAP
+	unsigned char *map; /* The whole file, filepos is the offset in it. */
+	off_t maplen;       /* Full mapping size (filelen excludes ID3v1). */
+	off_t mapahead;     /* Read-ahead was requested up to here. */
+#endif
 #ifndef NO_FEEDER
 	struct bufferchain buffer; /* Not dynamically allocated, these few struct bytes aren't worth the trouble. */
 #endif
+#ifdef READ_AHEAD
+	struct readahead *ahead; /* Prefetch thread behind fdread, or NULL. */
+#endif
 };
 
 /* start to use off_t to properly do LFS in future ... used to be long */
@@ -87,6 +108,7 @@ struct reader
 	ssize_t (*fullread)       (mpg123_handle *, unsigned char *, ssize_t);
 	int     (*head_read)      (mpg123_handle *, unsigned long *newhead);    /* succ: TRUE, else <= 0 (FALSE or READER_MORE) */
 	int     (*head_shift)     (mpg123_handle *, unsigned long *head);       /* succ: TRUE, else <= 0 (FALSE or READER_MORE) */
+	long    (*head_sync)      (mpg123_handle *, unsigned long *head, long max); /* succ: bytes shifted, else <= 0 as head_shift */
 	off_t   (*skip_bytes)     (mpg123_handle *, off_t len);                 /* succ: >=0, else error or READER_MORE         */
 	int     (*read_frame_body)(mpg123_handle *, unsigned char *, int size);
 	int     (*back_bytes)     (mpg123_handle *, off_t bytes);
@@ -105,11 +127,34 @@ int open_stream_handle(mpg123_handle *, void *iohandle);
 int open_feed(mpg123_handle *);
 /* externally called function, returns 0 on success, -1 on error */
 int  feed_more(mpg123_handle *fr, const unsigned char *in, long count);
+int  feed_more_ref( mpg123_handle *fr, const unsigned char *in, long count
+                   , void (*release)(void *handle), void *handle );
 void feed_forget(mpg123_handle *fr);  /* forget the data that has been read (free some buffers) */
 off_t feed_set_pos(mpg123_handle *fr, off_t pos); /* Set position (inside available data if possible), return wanted byte offset of next feed. */
 
 void open_bad(mpg123_handle *);
 
+#ifdef READ_AHEAD
+/*
+	Read-ahead (readahead.c): A thread keeps a window of upcoming stream
+	bytes ready, using the given functions on the reader data. The reader
+	side takes the bytes with ahead_read() and moves with ahead_seek(),
+	within the window (including some already consumed history) or by
+	telling the thread to seek, which discards a read still in flight.
+*/
+struct readahead *ahead_new( struct reader_data *rdat, size_t window, off_t pos
+                           , ssize_t (*read)(struct reader_data *, void *, size_t)
+                           , off_t (*seek)(struct reader_data *, off_t, int) );
+void ahead_del(struct readahead *ra);
+/* Like read(): Returns what is there, waits only if nothing is, 0 on end. */
+ssize_t ahead_read(struct readahead *ra, void *buf, size_t count);
+/* Always succeeds, a failing seek shows up as error on the next read. */
+off_t ahead_seek(struct readahead *ra, off_t pos);
+size_t ahead_fill(struct readahead *ra);   /* bytes ready after the position */
+long   ahead_stalls(struct readahead *ra); /* times the reader had to wait */
+size_t ahead_mem(struct readahead *ra);
+#endif
+
 #define READER_FD_OPENED 0x1
 #define READER_ID3TAG    0x2
 #define READER_SEEKABLE  0x4
@@ -124,11 +169,14 @@ void open_bad(mpg123_handle *);
 #define READER_BUF_STREAM 3
 #define READER_BUF_ICY_STREAM 4
 
+#define READER_MMAP 5
+#define READER_AHEAD 6
+
 #ifdef READ_SYSTEM
-#define READER_SYSTEM 5
-#define READERS 6
+#define READER_SYSTEM 7
+#define READERS 8
 #else
-#define READERS 5
+#define READERS 7
 #endif
 
 #define READER_ERROR MPG123_ERR
@@ -22,8 +22,12 @@
 #ifdef _MSC_VER
 #include <io.h>
 #endif
+#ifdef READ_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "compat.h"
+#include "mpeghead.h"
 #include "debug.h"
 
 static int default_init(mpg123_handle *fr);
@@ -238,6 +242,11 @@ static off_t stream_lseek(mpg123_handle *fr, off_t pos, int whence)
 
 static void stream_close(mpg123_handle *fr)
 {
+#ifdef READ_AHEAD
+	/* The thread has to let go of the descriptor first. */
+	ahead_del(fr->rdat.ahead);
+	fr->rdat.ahead = NULL;
+#endif
 	if(fr->rdat.flags & READER_FD_OPENED) compat_close(fr->rdat.filept);
 
 	fr->rdat.filept = 0;
@@ -281,13 +290,20 @@ static int stream_seek_frame(mpg123_handle *fr, off_t newframe)
 			debug2("going to %lu; just got %lu", (long unsigned)newframe, (long unsigned)preframe);
 			fr->num = preframe-1; /* Watch out! I am going to read preframe... fr->num should indicate the frame before! */
 		}
+		fr->seek_frames = 0;
 		while(fr->num < newframe)
 		{
 			/* try to be non-fatal now... frameNum only gets advanced on success anyway */
 			if(!read_frame(fr)) break;
+			++fr->seek_frames;
 		}
 		/* Now the wanted frame should be ready for decoding. */
 		debug1("arrived at %lu", (long unsigned)fr->num);
+#ifdef FRAME_INDEX
+		/* Remember where we went, so that the next seek around here is short. */
+		if(fr->num == newframe && fr->seek_frames > 1 && (fr->state_flags & FRAME_ACCURATE))
+		fi_point_add(&fr->index, fr->num, fr->input_offset);
+#endif
 
 		return MPG123_OK;
 	}
@@ -328,6 +344,70 @@ static int generic_head_shift(mpg123_handle *fr,unsigned long *head)
 	return TRUE;
 }
 
+/*
+	Resync help: Instead of shifting single bytes into the header until it
+	could be a valid one, look for the sync bits in a block of data. The
+	bytes before 0xff followed by 0xe0 and up cannot start a header, so
+	memchr() (vectorized in any decent C library) does the bulk of the work.
+	The result is the count of bytes to shift so that the header starts with
+	the sync, or all of them if there is none.
+*/
+static size_t sync_search(unsigned long head, const unsigned char *buf, size_t count)
+{
+	const unsigned char *ff;
+	size_t i;
+	/* The first shifts still leave bytes of the old header at the top. */
+	for(i=0; i<3 && i<count; ++i)
+	{
+		head = ((head<<8) | buf[i]) & 0xffffffff;
+		if((head & HDR_SYNC) == HDR_SYNC)
+		return i+1;
+	}
+	/* Now a header starting at buf[i] needs four bytes of the block. */
+	for(i=0; count >= 4 && i <= count-4; ++i)
+	{
+		ff = memchr(buf+i, 0xff, count-3-i);
+		if(ff == NULL)
+		break;
+		i = ff-buf;
+		if((ff[1] & 0xe0) == 0xe0)
+		return i+4;
+	}
+	return count;
+}
+
+/* The header after shifting in count bytes of buf. */
+static unsigned long sync_head(unsigned long head, const unsigned char *buf, size_t count)
+{
+	size_t i = count > 4 ? count-4 : 0;
+	for(; i<count; ++i)
+	head = ((head<<8) | buf[i]) & 0xffffffff;
+
+	return head;
+}
+
+/* Seekable streams read a block and go back behind the candidate.
+   Others can only take single bytes. */
+static long stream_head_sync(mpg123_handle *fr, unsigned long *head, long max)
+{
+	unsigned char buf[4096];
+	ssize_t got;
+	size_t shift;
+	if(!(fr->rdat.flags & READER_SEEKABLE))
+	return fr->rd->head_shift(fr, head);
+
+	got = fr->rd->fullread(fr, buf, max >= 0 && max < (long)sizeof(buf) ? (ssize_t)max : (ssize_t)sizeof(buf));
+	if(got <= 0)
+	return got == READER_MORE ? READER_MORE : FALSE;
+
+	shift = sync_search(*head, buf, got);
+	if(shift < (size_t)got && fr->rd->back_bytes(fr, got-shift) != 0)
+	return READER_ERROR;
+
+	*head = sync_head(*head, buf, shift);
+	return (long)shift;
+}
+
 /* returns reached position... negative ones are bad... */
 static off_t stream_skip_bytes(mpg123_handle *fr,off_t len)
 {
@@ -470,6 +550,8 @@ static struct buffy* buffy_new(size_t size, size_t minsize)
 	}
 	newbuf->size = 0;
 	newbuf->next = NULL;
+	newbuf->release = NULL;
+	newbuf->handle = NULL;
 	return newbuf;
 }
 
@@ -477,7 +559,8 @@ static void buffy_del(struct buffy* buf)
 {
 	if(buf)
 	{
-		free(buf->data);
+		if(buf->release != NULL) buf->release(buf->handle);
+		else free(buf->data);
 		free(buf);
 	}
 }
@@ -506,6 +589,17 @@ size_t bc_fill(struct bufferchain *bc)
 	return (size_t)(bc->size - bc->pos);
 }
 
+size_t bc_mem(struct bufferchain *bc)
+{
+	size_t mem = 0;
+	struct buffy *b;
+	for(b = bc->first; b != NULL; b = b->next)
+	mem += sizeof(struct buffy) + (b->release != NULL ? 0 : (size_t)b->realsize);
+	for(b = bc->pool; b != NULL; b = b->next)
+	mem += sizeof(struct buffy) + (size_t)b->realsize;
+	return mem;
+}
+
 void bc_poolsize(struct bufferchain *bc, size_t pool_size, size_t bufblock)
 {
 	bc->pool_size = pool_size;
@@ -542,7 +636,8 @@ static void bc_free(struct bufferchain *bc, struct buffy* buf)
 {
 	if(!buf) return;
 
-	if(bc->pool_fill < bc->pool_size)
+	/* Borrowed memory goes back to its owner, never into the pool. */
+	if(buf->release == NULL && bc->pool_fill < bc->pool_size)
 	{
 		buf->next = bc->pool;
 		bc->pool = buf;
@@ -653,6 +748,33 @@ static int bc_add(struct bufferchain *bc, const unsigned char *data, ssize_t siz
 	return ret;
 }
 
+/* Append the caller's memory itself as a new buffy, to be released when
+   forgotten. Nothing is added to it later on, since size == realsize. */
+static int bc_add_ref( struct bufferchain *bc, const unsigned char *data, ssize_t size
+,	void (*release)(void *handle), void *handle )
+{
+	struct buffy *newbuf;
+	debug2("bc_add_ref: referencing %"SSIZE_P" bytes at %"OFF_P, (ssize_p)size, (off_p)(bc->fileoff+bc->size));
+	if(size < 1) return -1;
+
+	newbuf = malloc(sizeof(struct buffy));
+	if(newbuf == NULL) return -2;
+
+	newbuf->data = (unsigned char*)data;
+	newbuf->size = size;
+	newbuf->realsize = size;
+	newbuf->next = NULL;
+	newbuf->release = release;
+	newbuf->handle = handle;
+
+	if(bc->last != NULL) bc->last->next = newbuf;
+	else if(bc->first == NULL) bc->first = newbuf;
+
+	bc->last  = newbuf;
+	bc->size += size;
+	return 0;
+}
+
 /* Common handler for "You want more than I can give." situation. */
 static ssize_t bc_need_more(struct bufferchain *bc)
 {
@@ -773,13 +895,57 @@ int feed_more(mpg123_handle *fr, const unsigned char *in, long count)
 	return ret;
 }
 
+/* Same as feed_more(), but using the caller's memory until release(). */
+int feed_more_ref( mpg123_handle *fr, const unsigned char *in, long count
+,	void (*release)(void *handle), void *handle )
+{
+	int ret = 0;
+	if(VERBOSE3) debug("feed_more_ref");
+	if((ret = bc_add_ref(&fr->rdat.buffer, in, count, release, handle)) != 0)
+	{
+		ret = READER_ERROR;
+		if(NOQUIET) error1("Failed to add buffer, return: %i", ret);
+	}
+	return ret;
+}
+
 static ssize_t feed_read(mpg123_handle *fr, unsigned char *out, ssize_t count)
 {
 	ssize_t gotcount = bc_give(&fr->rdat.buffer, out, count);
+	if(gotcount > 0) COUNTER_ADD(fr, copy_bytes, gotcount);
 	if(gotcount >= 0 && gotcount != count) return READER_ERROR;
 	else return gotcount;
 }
 
+/* Search the buffer the current position is in, without copying.
+   When all is used up, shifting a byte has the reader get more. */
+static long buffered_head_sync(mpg123_handle *fr, unsigned long *head, long max)
+{
+	struct bufferchain *bc = &fr->rdat.buffer;
+	struct buffy *b = bc->first;
+	ssize_t offset = 0;
+	size_t count, shift;
+	const unsigned char *data;
+
+	while(b != NULL && (offset + b->size) <= bc->pos)
+	{
+		offset += b->size;
+		b = b->next;
+	}
+	if(b == NULL)
+	return fr->rd->head_shift(fr, head);
+
+	data  = b->data + (bc->pos - offset);
+	count = (size_t)(offset + b->size - bc->pos);
+	if(max >= 0 && count > (size_t)max)
+	count = (size_t)max;
+
+	shift = sync_search(*head, data, count);
+	*head = sync_head(*head, data, shift);
+	bc->pos += shift;
+	return (long)shift;
+}
+
 /* returns reached position... negative ones are bad... */
 static off_t feed_skip_bytes(mpg123_handle *fr,off_t len)
 {
@@ -863,6 +1029,7 @@ static ssize_t buffered_fullread(mpg123_handle *fr, unsigned char *out, ssize_t
 		count = bc->size - bc->pos; /* We want only what we got. */
 	}
 	gotcount = bc_give(bc, out, count);
+	if(gotcount > 0) COUNTER_ADD(fr, copy_bytes, gotcount);
 
 	if(VERBOSE3) debug2("wanted %li, got %li", (long)count, (long)gotcount);
 
@@ -875,6 +1042,12 @@ int feed_more(mpg123_handle *fr, const unsigned char *in, long count)
 	fr->err = MPG123_MISSING_FEATURE;
 	return -1;
 }
+int feed_more_ref( mpg123_handle *fr, const unsigned char *in, long count
+,	void (*release)(void *handle), void *handle )
+{
+	fr->err = MPG123_MISSING_FEATURE;
+	return -1;
+}
 off_t feed_set_pos(mpg123_handle *fr, off_t pos)
 {
 	fr->err = MPG123_MISSING_FEATURE;
@@ -882,6 +1055,248 @@ off_t feed_set_pos(mpg123_handle *fr, off_t pos)
 }
 #endif /* NO_FEEDER */
 
+#ifdef READ_MMAP
+/*
+	Plain files mapped into memory: No read() per header or frame body and
+	layer I/II frame bodies are decoded in place. The kernel is told to read
+	ahead sequentially during playback and to stop that while seeking.
+*/
+
+/* Stretch of the file to announce ahead of the current position. */
+#define MMAP_AHEAD (256*1024)
+
+/* Strict C modes may hide it in the headers, then there is no advice. */
+#if defined(HAVE_POSIX_MADVISE) && defined(POSIX_MADV_SEQUENTIAL)
+static void mmap_advise(struct reader_data *rdat, off_t start, off_t len, int advice)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t end = start+len;
+	if(page < 1) page = 4096;
+	if(end > rdat->maplen) end = rdat->maplen;
+	start -= start % page; /* The address has to be page-aligned. */
+	if(end > start)
+	posix_madvise(rdat->map+start, (size_t)(end-start), advice);
+}
+#else
+#define mmap_advise(rdat, start, len, advice)
+#define POSIX_MADV_SEQUENTIAL 0
+#define POSIX_MADV_RANDOM 0
+#define POSIX_MADV_WILLNEED 0
+#endif
+
+/* Returns -1 if the stream cannot be mapped, without any harm done. */
+static int mmap_init(mpg123_handle *fr)
+{
+	struct stat st;
+	void *map;
+	/* Only real files behind our own descriptor, anything else stays with
+	   the stream reader. That includes pipes and replaced I/O functions. */
+	if(  (fr->rdat.flags & READER_HANDLEIO) || (fr->p.flags & MPG123_NO_PEEK_END)
+	  || fr->rdat.r_read != NULL || fr->rdat.r_lseek != NULL
+#ifdef TIMEOUT_READ
+	  || fr->p.timeout > 0
+#endif
+	  || fstat(fr->rdat.filept, &st) != 0 || !S_ISREG(st.st_mode)
+	  || st.st_size < 1 || (off_t)(size_t)st.st_size != st.st_size )
+	return -1;
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fr->rdat.filept, 0);
+	if(map == MAP_FAILED)
+	{
+		if(VERBOSE2) fprintf(stderr, "Note: Cannot map file: %s\n", strerror(errno));
+		return -1;
+	}
+	debug1("mapped %"OFF_P" bytes", (off_p)st.st_size);
+	fr->rdat.map = map;
+	fr->rdat.maplen = st.st_size;
+	fr->rdat.filelen = st.st_size;
+	fr->rdat.filepos = 0;
+	fr->rdat.fdread = plain_read;
+	fr->rdat.flags |= READER_SEEKABLE;
+	if(  fr->rdat.maplen >= 128
+	  && !strncmp((char*)fr->rdat.map+fr->rdat.maplen-128, "TAG", 3) )
+	{
+		memcpy(fr->id3buf, fr->rdat.map+fr->rdat.maplen-128, 128);
+		fr->rdat.filelen -= 128;
+		fr->rdat.flags |= READER_ID3TAG;
+		fr->metaflags  |= MPG123_NEW_ID3;
+	}
+	mmap_advise(&fr->rdat, 0, fr->rdat.maplen, POSIX_MADV_SEQUENTIAL);
+	fr->rdat.mapahead = 0;
+	return 0;
+}
+
+static void mmap_close(mpg123_handle *fr)
+{
+	if(fr->rdat.map != NULL)
+	{
+		munmap((void*)fr->rdat.map, (size_t)fr->rdat.maplen);
+		fr->rdat.map = NULL;
+	}
+	stream_close(fr);
+}
+
+static ssize_t mmap_fullread(mpg123_handle *fr, unsigned char *buf, ssize_t count)
+{
+	off_t left = fr->rdat.maplen - fr->rdat.filepos;
+	if(left < count) count = left > 0 ? (ssize_t)left : 0;
+	if(count > 0)
+	{
+		memcpy(buf, fr->rdat.map+fr->rdat.filepos, count);
+		fr->rdat.filepos += count;
+	}
+	return count;
+}
+
+static int mmap_head_read(mpg123_handle *fr, unsigned long *newhead)
+{
+	const unsigned char *hbuf = fr->rdat.map+fr->rdat.filepos;
+	if(fr->rdat.filepos < 0 || fr->rdat.maplen - fr->rdat.filepos < 4)
+	return FALSE;
+
+	*newhead = ((unsigned long) hbuf[0] << 24) |
+	           ((unsigned long) hbuf[1] << 16) |
+	           ((unsigned long) hbuf[2] << 8)  |
+	            (unsigned long) hbuf[3];
+	fr->rdat.filepos += 4;
+	return TRUE;
+}
+
+static int mmap_head_shift(mpg123_handle *fr, unsigned long *head)
+{
+	if(fr->rdat.filepos < 0 || fr->rdat.filepos >= fr->rdat.maplen)
+	return FALSE;
+
+	*head <<= 8;
+	*head |= fr->rdat.map[fr->rdat.filepos++];
+	*head &= 0xffffffff;
+	return TRUE;
+}
+
+static long mmap_head_sync(mpg123_handle *fr, unsigned long *head, long max)
+{
+	off_t left = fr->rdat.maplen - fr->rdat.filepos;
+	size_t shift;
+	if(fr->rdat.filepos < 0 || left <= 0)
+	return FALSE;
+
+	if(max >= 0 && left > max)
+	left = max;
+	shift = sync_search(*head, fr->rdat.map+fr->rdat.filepos, (size_t)left);
+	*head = sync_head(*head, fr->rdat.map+fr->rdat.filepos, shift);
+	fr->rdat.filepos += shift;
+	return (long)shift;
+}
+
+/* Like lseek(), going beyond the end is fine, before the start is not. */
+static off_t mmap_skip_bytes(mpg123_handle *fr, off_t len)
+{
+	if(fr->rdat.filepos + len < 0)
+	{
+		fr->err = MPG123_LSEEK_FAILED;
+		return READER_ERROR;
+	}
+	fr->rdat.filepos += len;
+	return fr->rdat.filepos;
+}
+
+static int mmap_back_bytes(mpg123_handle *fr, off_t bytes)
+{
+	return mmap_skip_bytes(fr, -bytes) < 0 ? READER_ERROR : 0;
+}
+
+static int mmap_read_frame_body(mpg123_handle *fr, unsigned char *buf, int size)
+{
+	off_t pos = fr->rdat.filepos;
+	if(pos + MMAP_AHEAD/2 > fr->rdat.mapahead)
+	{
+		off_t from = pos > fr->rdat.mapahead ? pos : fr->rdat.mapahead;
+		mmap_advise(&fr->rdat, from, MMAP_AHEAD, POSIX_MADV_WILLNEED);
+		fr->rdat.mapahead = from + MMAP_AHEAD;
+	}
+	/* Layer III needs the bit reservoir in front of the body, so that one
+	   is copied. Layers I and II only read forward from the start, with
+	   the same slack behind as in bsspace (and in front, for set_pointer()
+	   on a layer change). */
+	if(  fr->lay != 3 && size <= MAXFRAMESIZE
+	  && pos >= 512 && fr->rdat.maplen - pos >= MAXFRAMESIZE )
+	{
+		fr->rdat.framebody = fr->rdat.map+pos;
+		fr->rdat.filepos += size;
+		return size;
+	}
+	return mmap_fullread(fr, buf, size) == size ? size : READER_MORE;
+}
+
+/* Seeks hop around via the frame index, no point in reading ahead there. */
+static int mmap_seek_frame(mpg123_handle *fr, off_t newframe)
+{
+	int ret;
+	mmap_advise(&fr->rdat, 0, fr->rdat.maplen, POSIX_MADV_RANDOM);
+	ret = stream_seek_frame(fr, newframe);
+	mmap_advise(&fr->rdat, 0, fr->rdat.maplen, POSIX_MADV_SEQUENTIAL);
+	fr->rdat.mapahead = fr->rdat.filepos;
+	return ret;
+}
+
+static void mmap_rewind(mpg123_handle *fr)
+{
+	fr->rdat.filepos  = 0;
+	fr->rdat.mapahead = 0;
+}
+#else
+#define mmap_init default_init
+#define mmap_close stream_close
+#define mmap_fullread plain_fullread
+#define mmap_head_read generic_head_read
+#define mmap_head_shift generic_head_shift
+#define mmap_head_sync stream_head_sync
+#define mmap_skip_bytes stream_skip_bytes
+#define mmap_read_frame_body generic_read_frame_body
+#define mmap_back_bytes stream_back_bytes
+#define mmap_seek_frame stream_seek_frame
+#define mmap_rewind stream_rewind
+#endif /* READ_MMAP */
+
+#ifdef READ_AHEAD
+/*
+	A thread reads ahead of the stream position (MPG123_READAHEAD). It sits
+	behind fdread, so it also works under the buffered and ICY readers of
+	non-seekable streams. Seekable streams get READER_AHEAD, which moves
+	within the window where possible and hands other seeks to the thread.
+*/
+
+static ssize_t ahead_fdread(mpg123_handle *fr, void *buf, size_t count)
+{
+	return ahead_read(fr->rdat.ahead, buf, count);
+}
+
+static off_t ahead_skip_bytes(mpg123_handle *fr, off_t len)
+{
+	if(fr->rdat.filepos + len < 0)
+	{
+		fr->err = MPG123_LSEEK_FAILED;
+		return READER_ERROR;
+	}
+	fr->rdat.filepos = ahead_seek(fr->rdat.ahead, fr->rdat.filepos + len);
+	return fr->rdat.filepos;
+}
+
+static int ahead_back_bytes(mpg123_handle *fr, off_t bytes)
+{
+	return ahead_skip_bytes(fr, -bytes) < 0 ? READER_ERROR : 0;
+}
+
+static void ahead_rewind(mpg123_handle *fr)
+{
+	fr->rdat.filepos = ahead_seek(fr->rdat.ahead, 0);
+}
+#else
+#define ahead_skip_bytes stream_skip_bytes
+#define ahead_back_bytes stream_back_bytes
+#define ahead_rewind stream_rewind
+#endif /* READ_AHEAD */
+
 /*****************************************************************
  * read frame helper
  */
@@ -892,6 +1307,7 @@ static void bad_close(mpg123_handle *mh){}
 static ssize_t bad_fullread(mpg123_handle *mh, unsigned char *data, ssize_t count) bugger_off
 static int bad_head_read(mpg123_handle *mh, unsigned long *newhead) bugger_off
 static int bad_head_shift(mpg123_handle *mh, unsigned long *head) bugger_off
+static long bad_head_sync(mpg123_handle *mh, unsigned long *head, long max) bugger_off
 static off_t bad_skip_bytes(mpg123_handle *mh, off_t len) bugger_off
 static int bad_read_frame_body(mpg123_handle *mh, unsigned char *data, int size) bugger_off
 static int bad_back_bytes(mpg123_handle *mh, off_t bytes) bugger_off
@@ -905,6 +1321,8 @@ static void bad_rewind(mpg123_handle *mh){}
 #define READER_FEED       2
 #define READER_BUF_STREAM 3
 #define READER_BUF_ICY_STREAM 4
+#define READER_MMAP 5
+#define READER_AHEAD 6
 static struct reader readers[] =
 {
 	{ /* READER_STREAM */
@@ -913,6 +1331,7 @@ static struct reader readers[] =
 		plain_fullread,
 		generic_head_read,
 		generic_head_shift,
+		stream_head_sync,
 		stream_skip_bytes,
 		generic_read_frame_body,
 		stream_back_bytes,
@@ -927,6 +1346,7 @@ static struct reader readers[] =
 		icy_fullread,
 		generic_head_read,
 		generic_head_shift,
+		stream_head_sync,
 		stream_skip_bytes,
 		generic_read_frame_body,
 		stream_back_bytes,
@@ -943,6 +1363,7 @@ static struct reader readers[] =
 #define feed_back_bytes NULL
 #define feed_skip_bytes NULL
 #define buffered_forget NULL
+#define buffered_head_sync NULL
 #endif
 	{ /* READER_FEED */
 		feed_init,
@@ -950,6 +1371,7 @@ static struct reader readers[] =
 		feed_read,
 		generic_head_read,
 		generic_head_shift,
+		buffered_head_sync,
 		feed_skip_bytes,
 		generic_read_frame_body,
 		feed_back_bytes,
@@ -964,6 +1386,7 @@ static struct reader readers[] =
 		buffered_fullread,
 		generic_head_read,
 		generic_head_shift,
+		buffered_head_sync,
 		stream_skip_bytes,
 		generic_read_frame_body,
 		stream_back_bytes,
@@ -978,6 +1401,7 @@ static struct reader readers[] =
 		buffered_fullread,
 		generic_head_read,
 		generic_head_shift,
+		buffered_head_sync,
 		stream_skip_bytes,
 		generic_read_frame_body,
 		stream_back_bytes,
@@ -986,6 +1410,36 @@ static struct reader readers[] =
 		stream_rewind,
 		buffered_forget
 	},
+	{ /* READER_MMAP */
+		mmap_init,
+		mmap_close,
+		mmap_fullread,
+		mmap_head_read,
+		mmap_head_shift,
+		mmap_head_sync,
+		mmap_skip_bytes,
+		mmap_read_frame_body,
+		mmap_back_bytes,
+		mmap_seek_frame,
+		generic_tell,
+		mmap_rewind,
+		NULL
+	},
+	{ /* READER_AHEAD */
+		default_init,
+		stream_close,
+		plain_fullread,
+		generic_head_read,
+		generic_head_shift,
+		stream_head_sync,
+		ahead_skip_bytes,
+		generic_read_frame_body,
+		ahead_back_bytes,
+		stream_seek_frame,
+		generic_tell,
+		ahead_rewind,
+		NULL
+	}
 #ifdef READ_SYSTEM
 	,{
 		system_init,
@@ -1000,6 +1454,7 @@ static struct reader readers[] =
 		NULL,
 		NULL,
 		NULL,
+		NULL,
 	}
 #endif
 };
@@ -1011,6 +1466,7 @@ static struct reader bad_reader =
 	bad_fullread,
 	bad_head_read,
 	bad_head_shift,
+	bad_head_sync,
 	bad_skip_bytes,
 	bad_read_frame_body,
 	bad_back_bytes,
@@ -1155,12 +1611,41 @@ static int open_finish(mpg123_handle *fr)
 	else
 #endif
 	{
+#ifdef READ_MMAP
+		/* Falls back to the stream reader for pipes and such. */
+		if((fr->p.flags & MPG123_MMAP) && mmap_init(fr) == 0)
+		{
+			fr->rd = &readers[READER_MMAP];
+			debug("mmap reader");
+			return MPG123_OK;
+		}
+#endif
 		fr->rd = &readers[READER_STREAM];
 		debug("stream reader");
 	}
 
 	if(fr->rd->init(fr) < 0) return -1;
 
+#ifdef READ_AHEAD
+	/* Timeout reading wants to select() on the descriptor itself. */
+	if((fr->p.flags & MPG123_READAHEAD) && !(fr->rdat.flags & READER_NONBLOCK))
+	{
+		fr->rdat.ahead = ahead_new( &fr->rdat, (size_t)fr->p.readahead
+		,	fr->rdat.filepos, io_read, io_seek );
+		if(fr->rdat.ahead == NULL)
+		{
+			if(NOQUIET) error("Cannot start read-ahead, reading directly.");
+		}
+		else
+		{
+			fr->rdat.fdread = ahead_fdread;
+			if(fr->rd == &readers[READER_STREAM] && (fr->rdat.flags & READER_SEEKABLE))
+				fr->rd = &readers[READER_AHEAD];
+			debug("read-ahead");
+		}
+	}
+#endif
+
 	return MPG123_OK;
 }
 
@@ -1191,6 +1676,7 @@ int open_stream(mpg123_handle *fr, const char *bs_filenam, int fd)
 	fr->rdat.filept  = filept;
 	fr->rdat.flags = 0;
 	if(filept_opened)	fr->rdat.flags |= READER_FD_OPENED;
+	pcmcache_identify(fr);
 
 	return open_finish(fr);
 }
@@ -0,0 +1,463 @@
+/*
+	resample.c: polyphase windowed-sinc resampling, taking over from NtoM
+
+	copyright 1995-2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	The synth produces real samples at the native rate into a private buffer,
+	which then are filtered to the output rate and stored in the decoder
+	format. Rates are reduced to n input samples for m output samples. Output
+	sample k is taken at input time k*n/m - delay, which makes the sample count
+	of the output from i input samples simply ceil(i*m/n). That keeps the
+	position math exact and independent of the decoding history: Each frame
+	yields the same output, whether decoded after a seek or in one go.
+
+	The filter is a Kaiser-windowed sinc with taps/2 zero crossings on each
+	side (widened for downsampling). When m is small enough, there is one row of
+	coefficients for each of the m phases (that covers 44100 to 48000 with its
+	160 phases); otherwise, RS_PHASES rows are interpolated.
+*/
+
+#include "mpg123lib_intern.h"
+#include "sample.h"
+#include "debug.h"
+
+#ifndef RESAMPLER
+#error "Do not build this file without floating point decoding and NtoM enabled!"
+#endif
+
+#if (defined OPT_X86_64 || defined OPT_AVX) && defined REAL_IS_FLOAT
+#define RS_DOT(in, coeff, count) resample_dot_x86_64(in, coeff, count)
+#else
+#define RS_DOT(in, coeff, count) rs_dot(in, coeff, count)
+#endif
+
+#define RS_HALF   48      /* zero crossings on each side, when upsampling */
+#define RS_CUTOFF 0.47    /* fraction of the lower sampling rate */
+#define RS_BETA   8.96    /* Kaiser window shape for about 90 dB stopband */
+#define RS_EXACT  65536   /* largest table with exact phases, in coefficients */
+#define RS_PHASES 256     /* interpolated phases otherwise */
+#define RS_MAXSPF 1152
+#define RS_BLOCK  256     /* output samples of all channels computed at once */
+
+static long gcd(long a, long b)
+{
+	while(b)
+	{
+		long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+	Exact a*b = quot*c + rem for non-negative arguments not exceeding the
+	rates. The product fits into a double mantissa, not necessarily a long.
+*/
+static void muldiv(long a, long b, long c, long *quot, long *rem)
+{
+	double prod = (double)a*b;
+	long q = (long)(prod/c);
+	double r = prod - (double)q*c;
+
+	while(r < 0)  { --q; r += c; }
+	while(r >= c) { ++q; r -= c; }
+	*quot = q;
+	*rem  = (long)r;
+}
+
+/* Zeroth order modified Bessel function of the first kind, for the window. */
+static double bessel_i0(double x)
+{
+	double sum  = 1.;
+	double term = 1.;
+	double q = x*x/4.;
+	int k;
+
+	for(k=1; k<100 && term > 1e-12*sum; ++k)
+	{
+		term *= q/((double)k*k);
+		sum  += term;
+	}
+	return sum;
+}
+
+/* The windowed sinc for cutoff fc (cycles per input sample) at distance x. */
+static double kernel(double x, double fc, double half, double i0beta)
+{
+	double r = x/half;
+	double w;
+
+	if(r <= -1. || r >= 1.) return 0.;
+	w = bessel_i0(RS_BETA*sqrt(1.-r*r))/i0beta;
+	return w * (x == 0. ? 2.*fc : sin(2.*M_PI*fc*x)/(M_PI*x));
+}
+
+#if !((defined OPT_X86_64 || defined OPT_AVX) && defined REAL_IS_FLOAT)
+/* Four separate sums for the compiler to vectorize. */
+static real rs_dot(const real *in, const real *coeff, size_t count)
+{
+	real s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i;
+
+	for(i=0; i<count; i+=4)
+	{
+		s0 += in[i]   * coeff[i];
+		s1 += in[i+1] * coeff[i+1];
+		s2 += in[i+2] * coeff[i+2];
+		s3 += in[i+3] * coeff[i+3];
+	}
+	return (s0+s1)+(s2+s3);
+}
+#endif
+
+/*
+	Compute the coefficient rows for the reduced ratio n:m. Row r is for
+	output at fractional input position phi = r/phases, tap j for the input
+	sample at distance delay-1-j+phi. Each row is normalized to unity gain,
+	scaled to the short range that the WRITE_*_SAMPLE macros expect.
+*/
+static int make_table(mpg123_handle *fr)
+{
+	double scale = fr->rs.m < fr->rs.n ? (double)fr->rs.m/fr->rs.n : 1.;
+	double fc = RS_CUTOFF*scale;
+	double i0beta = bessel_i0(RS_BETA);
+	long half = (long)ceil(RS_HALF/scale);
+	long rows, r, j;
+
+	half = (half+3) & ~3L;
+	fr->rs.taps  = 2*half;
+	fr->rs.delay = half;
+	fr->rs.exact = fr->rs.m*fr->rs.taps <= RS_EXACT;
+	fr->rs.phases = fr->rs.exact ? fr->rs.m : RS_PHASES;
+	rows = fr->rs.phases + (fr->rs.exact ? 0 : 1);
+
+	if(fr->rs.coeffs != NULL) free(fr->rs.coeffs);
+	fr->rs.coeffs = malloc(sizeof(real)*rows*fr->rs.taps);
+	if(fr->rs.coeffs == NULL) return -1;
+
+	for(r=0; r<rows; ++r)
+	{
+		real *row = fr->rs.coeffs + r*fr->rs.taps;
+		double phi = (double)r/fr->rs.phases;
+		double sum = 0.;
+
+		for(j=0; j<fr->rs.taps; ++j)
+		{
+			double h = kernel(half-1-j+phi, fc, half, i0beta);
+			row[j] = DOUBLE_TO_REAL(h);
+			sum += h;
+		}
+		for(j=0; j<fr->rs.taps; ++j)
+			row[j] = DOUBLE_TO_REAL(SHORT_SCALE*REAL_TO_DOUBLE(row[j])/sum);
+	}
+	return 0;
+}
+
+int resample_setup(mpg123_handle *fr)
+{
+	long in  = frame_freq(fr);
+	long out = fr->af.rate;
+	size_t bufsize;
+
+	if(in <= 0 || out <= 0 || in > NTOM_MAX_FREQ || out > NTOM_MAX_FREQ)
+	{
+		if(NOQUIET) error("resampler: illegal rates");
+		fr->err = MPG123_BAD_RATE;
+		return -1;
+	}
+	if(out > NTOM_MAX*in)
+	{
+		if(NOQUIET) error1("max. 1:%i conversion allowed!", NTOM_MAX);
+		fr->err = MPG123_BAD_RATE;
+		return -1;
+	}
+
+	if(FALSE){}
+#ifndef NO_16BIT
+	else if(fr->af.dec_enc & MPG123_ENC_16)
+	fr->rs.format = f_16;
+#endif
+#ifndef NO_8BIT
+	else if(fr->af.dec_enc & MPG123_ENC_8)
+	fr->rs.format = f_8;
+#endif
+	else if(fr->af.dec_enc & MPG123_ENC_FLOAT)
+	fr->rs.format = f_real;
+#ifndef NO_32BIT
+	else if(fr->af.dec_enc & MPG123_ENC_32)
+	fr->rs.format = f_32;
+#endif
+	else
+	{
+		if(NOQUIET) error("resampler: This output format is disabled in this build!");
+		fr->err = MPG123_BAD_OUTFORMAT;
+		return -1;
+	}
+
+	/* The filter stays around for the next track with the same rates. */
+	if(fr->rs.coeffs == NULL || in != fr->rs.in_rate || out != fr->rs.out_rate)
+	{
+		long g = gcd(in, out);
+		fr->rs.n = in/g;
+		fr->rs.m = out/g;
+		fr->rs.in_rate = fr->rs.out_rate = 0;
+		if(make_table(fr) != 0)
+		{
+			fr->err = MPG123_OUT_OF_MEM;
+			return -1;
+		}
+		/* Synth output and history for up to two channels. */
+		bufsize = sizeof(real)*2*(RS_MAXSPF + fr->rs.taps + RS_MAXSPF);
+		if(fr->rs.in != NULL) free(fr->rs.in);
+		fr->rs.in = malloc(bufsize);
+		if(fr->rs.in == NULL)
+		{
+			fr->err = MPG123_OUT_OF_MEM;
+			return -1;
+		}
+		fr->rs.hist = fr->rs.in + 2*RS_MAXSPF;
+		fr->rs.bytes = bufsize + sizeof(real)*fr->rs.taps
+		*	(fr->rs.phases + (fr->rs.exact ? 0 : 1));
+		fr->rs.in_rate  = in;
+		fr->rs.out_rate = out;
+	}
+	if(VERBOSE2)
+		fprintf(stderr, "Init resampler: %ld->%ld with %ld taps, %ld %s phases\n"
+		,	in, out, fr->rs.taps, fr->rs.phases
+		,	fr->rs.exact ? "exact" : "interpolated" );
+	fr->rs.next = -1;
+	return 0;
+}
+
+void resample_free(mpg123_handle *fr)
+{
+	if(fr->rs.coeffs != NULL) free(fr->rs.coeffs);
+	if(fr->rs.in != NULL) free(fr->rs.in);
+	fr->rs.coeffs = NULL;
+	fr->rs.in = NULL;
+	fr->rs.hist = NULL;
+	fr->rs.bytes = 0;
+	fr->rs.in_rate = fr->rs.out_rate = 0;
+}
+
+long resample_preframes(mpg123_handle *fr)
+{
+	return (fr->rs.taps + fr->spf - 1)/fr->spf;
+}
+
+/* ceil(ins*m/n), without the big product */
+off_t resample_ins2outs(mpg123_handle *fr, off_t ins)
+{
+	long q, r;
+	off_t outs;
+
+	if(ins <= 0) return 0;
+	muldiv((long)(ins % fr->rs.n), fr->rs.m, fr->rs.n, &q, &r);
+	outs = (ins / fr->rs.n) * fr->rs.m + q;
+	return r ? outs+1 : outs;
+}
+
+/* floor(outs*n/m), the last input sample output number outs needs */
+static off_t outs2ins(mpg123_handle *fr, off_t outs, long *phase)
+{
+	long q, r;
+
+	muldiv((long)(outs % fr->rs.m), fr->rs.n, fr->rs.m, &q, &r);
+	if(phase != NULL) *phase = r;
+	return (outs / fr->rs.m) * fr->rs.n + q;
+}
+
+off_t resample_frmouts(mpg123_handle *fr, off_t frame)
+{
+	return resample_ins2outs(fr, frame*fr->spf);
+}
+
+off_t resample_frame_outsamples(mpg123_handle *fr)
+{
+	return resample_frmouts(fr, fr->num+1) - resample_frmouts(fr, fr->num);
+}
+
+/* The frame that produces output sample soff. */
+off_t resample_frameoff(mpg123_handle *fr, off_t soff)
+{
+	if(soff <= 0) return 0;
+	return outs2ins(fr, soff, NULL)/fr->spf;
+}
+
+/* Start over with empty history at the beginning of the given frame. */
+static void start(mpg123_handle *fr, off_t frame)
+{
+	long ch;
+	off_t outs = resample_frmouts(fr, frame);
+
+	fr->rs.pos = (long)(outs2ins(fr, outs, &fr->rs.phase) - frame*fr->spf);
+	for(ch=0; ch<fr->af.channels; ++ch)
+		memset( fr->rs.hist + ch*(fr->rs.taps+RS_MAXSPF), 0
+		,	sizeof(real)*fr->rs.taps );
+}
+
+/* Store the computed block in the decoder format, with clipping.
+   Planar output goes through a piece of interleaved samples. */
+static int store(mpg123_handle *fr, real *block, size_t count)
+{
+	int clip = 0;
+	size_t i;
+	size_t bytes;
+	real planebuf[RS_BLOCK];
+	unsigned char *out = fr->af.planar
+	?	(unsigned char*)planebuf
+	:	fr->buffer.data + fr->buffer.fill;
+
+	switch(fr->rs.format)
+	{
+#ifndef NO_16BIT
+		case f_16:
+		{
+			short *samples = (short*)out;
+			for(i=0; i<count; ++i)
+			{
+				WRITE_SHORT_SAMPLE(samples+i, block[i], clip);
+			}
+			bytes = count*sizeof(short);
+		}
+		break;
+#endif
+#ifndef NO_8BIT
+		case f_8:
+		{
+			unsigned char *samples = out;
+			for(i=0; i<count; ++i)
+			{
+				WRITE_8BIT_SAMPLE(samples+i, block[i], clip);
+			}
+			bytes = count;
+		}
+		break;
+#endif
+#ifndef NO_32BIT
+		case f_32:
+		{
+			int32_t *samples = (int32_t*)out;
+			for(i=0; i<count; ++i)
+			{
+				WRITE_S32_SAMPLE(samples+i, block[i], clip);
+			}
+			bytes = count*sizeof(int32_t);
+		}
+		break;
+#endif
+		default:
+		{
+			real *samples = (real*)out;
+			for(i=0; i<count; ++i)
+			{
+				WRITE_REAL_SAMPLE(samples+i, block[i], clip);
+			}
+			bytes = count*sizeof(real);
+		}
+	}
+	if(fr->af.planar)
+		planar_store(fr, out, bytes);
+	else
+		fr->buffer.fill += bytes;
+	return clip;
+}
+
+/* Produce all output samples that need input up to the end of the current frame. */
+static int run(mpg123_handle *fr)
+{
+	real block[RS_BLOCK];
+	int clip = 0;
+	size_t fill = 0;
+	long channels = fr->af.channels;
+	long stride = fr->rs.taps + RS_MAXSPF;
+	long taps = fr->rs.taps;
+	long step = fr->rs.n / fr->rs.m;
+	long rest = fr->rs.n % fr->rs.m;
+	long ch;
+
+	while(fr->rs.pos < fr->spf)
+	{
+		const real *in = fr->rs.hist + fr->rs.pos + 1;
+		if(fr->rs.exact)
+		{
+			const real *row = fr->rs.coeffs + fr->rs.phase*taps;
+			for(ch=0; ch<channels; ++ch)
+				block[fill++] = RS_DOT(in+ch*stride, row, taps);
+		}
+		else
+		{
+			long t = fr->rs.phase*RS_PHASES;
+			long r = t / fr->rs.m;
+			real frac = (real)(t - r*fr->rs.m)/fr->rs.m;
+			const real *row = fr->rs.coeffs + r*taps;
+			for(ch=0; ch<channels; ++ch)
+			{
+				real a = RS_DOT(in+ch*stride, row, taps);
+				real b = RS_DOT(in+ch*stride, row+taps, taps);
+				block[fill++] = a + frac*(b-a);
+			}
+		}
+		fr->rs.pos   += step;
+		fr->rs.phase += rest;
+		if(fr->rs.phase >= fr->rs.m)
+		{
+			fr->rs.phase -= fr->rs.m;
+			++fr->rs.pos;
+		}
+		if(fill+channels > RS_BLOCK)
+		{
+			clip += store(fr, block, fill);
+			fill = 0;
+		}
+	}
+	if(fill) clip += store(fr, block, fill);
+
+	return clip;
+}
+
+int resample_decode(mpg123_handle *fr)
+{
+	int clip;
+	long ch, i;
+	long channels = fr->af.channels;
+	long stride = fr->rs.taps + RS_MAXSPF;
+	size_t got;
+	unsigned char *data = fr->buffer.data;
+	size_t fill = fr->buffer.fill;
+	size_t size = fr->buffer.size;
+
+	/* Let the synth write full rate real samples to the private buffer. */
+	fr->buffer.data = (unsigned char*)fr->rs.in;
+	fr->buffer.fill = 0;
+	fr->buffer.size = sizeof(real)*2*RS_MAXSPF;
+	clip = (fr->do_layer)(fr);
+	got = fr->buffer.fill/(sizeof(real)*channels);
+	fr->buffer.data = data;
+	fr->buffer.fill = fill;
+	fr->buffer.size = size;
+	/* Fill up a broken frame with silence, as decode_the_frame() does. */
+	if(got < (size_t)fr->spf)
+		memset( fr->rs.in+got*channels, 0
+		,	sizeof(real)*(fr->spf-got)*channels );
+
+	if(fr->num != fr->rs.next) start(fr, fr->num);
+	for(ch=0; ch<channels; ++ch)
+	{
+		real *hist = fr->rs.hist + ch*stride + fr->rs.taps;
+		const real *in = fr->rs.in + ch;
+		for(i=0; i<fr->spf; ++i)
+			hist[i] = in[i*channels];
+	}
+	clip += run(fr);
+	/* Keep the last taps input samples as history for the next frame. */
+	for(ch=0; ch<channels; ++ch)
+		memmove( fr->rs.hist + ch*stride, fr->rs.hist + ch*stride + fr->spf
+		,	sizeof(real)*fr->rs.taps );
+	fr->rs.pos -= fr->spf;
+	fr->rs.next = fr->num+1;
+
+	return clip;
+}
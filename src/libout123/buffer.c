@@ -369,6 +369,13 @@ size_t buffer_fill(out123_handle *ao)
 	return xfermem_get_usedspace(ao->buffermem);
 }
 
+long buffer_latency(out123_handle *ao)
+{
+	txfermem *xf = ao->buffermem;
+	long frames = xfermem_get_usedspace(xf)/ao->framesize;
+	return frames + audible_frames(ao, xf->audible);
+}
+
 void buffer_ndrain(out123_handle *ao, size_t bytes)
 {
 	size_t oldfill;
@@ -486,6 +493,7 @@ static void buffer_play(out123_handle *ao, size_t bytes)
 	written = out123_play(ao, (unsigned char*)xf->data+xf->readindex, bytes);
 	/* Advance read pointer by the amount of written bytes. */
 	xf->readindex = (xf->readindex + written) % xf->size;
+	xf->audible = audible_time(ao);
 	/* Detect a fatal error by proxy. */
 	if(ao->errcode == OUT123_DEV_PLAY)
 		out123_close(ao);
@@ -608,7 +616,7 @@ int buffer_loop(out123_handle *ao)
 	   too). */
 	enum playstate mystate = ao->state;
 
-	ao->flags &= ~OUT123_KEEP_PLAYING; /* No need for that here. */
+	ao->flags &= ~(OUT123_KEEP_PLAYING|OUT123_PLANAR); /* No need for that here, data is interleaved. */
 	/* Be prepared to use SIGINT for communication. */
 	catchsignal (SIGINT, catch_interrupt);
 	/* sigprocmask (SIG_SETMASK, oldsigset, NULL); */
@@ -710,7 +718,7 @@ int buffer_loop(out123_handle *ao)
 					/* If that does not work, communication is broken anyway and
 					   writer will notice soon enough. */
 					read_parameters(ao, XF_READER, cmd, &i, cmdcount);
-					ao->flags &= ~OUT123_KEEP_PLAYING; /* No need for that here. */
+					ao->flags &= ~(OUT123_KEEP_PLAYING|OUT123_PLANAR); /* No need for that here, data is interleaved. */
 					xfermem_putcmd(my_fd, XF_CMD_OK);
 				break;
 				case BUF_CMD_OPEN:
@@ -957,6 +965,7 @@ int buffer_loop(out123_handle *ao)
 					draining = FALSE;
 					xf->readindex = xf->freeindex;
 					out123_drop(ao);
+					xf->audible = 0;
 					xfermem_putcmd(my_fd, XF_CMD_OK);
 				break;
 				default:
@@ -53,6 +53,8 @@ size_t buffer_write(out123_handle *ao, void *buffer, size_t bytes);
 
 /* Thin wrapper over xfermem giving the current buffer fill. */
 size_t buffer_fill(out123_handle *ao);
+/* Frames in the buffer and in the device behind it. */
+long buffer_latency(out123_handle *ao);
 
 /* Special handler to safely read values from command channel with
    an additional buffer handed in. Exported for read_parameters(). */
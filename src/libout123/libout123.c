@@ -6,6 +6,9 @@
 	initially written by Michael Hipp
 */
 
+/* Needed for clock_gettime() from time.h. */
+#define _POSIX_C_SOURCE 200112L
+
 #include "out123_int.h"
 #include "wav.h"
 #ifndef NOXFERMEM
@@ -15,7 +18,16 @@ static int have_buffer(out123_handle *ao)
 	return (ao->buffer_pid != -1);
 }
 #endif
+#ifdef BUFFER_THREAD
+#include "threadbuf.h"
+#include "tee.h"
+#endif
 #include "stringlists.h"
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#elif defined(HAVE_SYS_TIME_H)
+#include <sys/time.h>
+#endif
 
 #include "debug.h"
 
@@ -25,6 +37,10 @@ static int have_buffer(out123_handle *ao)
   (    (ao)->propflags & OUT123_PROP_LIVE \
   && !((ao)->propflags & OUT123_PROP_PERSISTENT) )
 
+/* Size of out123_play_begin() storage without a device period to go by,
+   the samples of one MPEG frame. */
+#define STAGING_FRAMES 1152
+
 static const char *default_name = "out123";
 
 static int modverbose(out123_handle *ao)
@@ -48,6 +64,9 @@ static void out123_clear_module(out123_handle *ao)
 	ao->drain = NULL;
 	ao->close = NULL;
 	ao->deinit = NULL;
+	ao->begin = NULL;
+	ao->commit = NULL;
+	ao->delay = NULL;
 
 	ao->module = NULL;
 	ao->userptr = NULL;
@@ -81,6 +100,9 @@ out123_handle* attribute_align_arg out123_new(void)
 	ao->buffer_fd[1] = -1;
 	ao->buffermem = NULL;
 #endif
+#ifdef BUFFER_THREAD
+	ao->threadbuf = NULL;
+#endif
 
 	out123_clear_module(ao);
 	ao->name = compat_strdup(default_name);
@@ -94,12 +116,23 @@ out123_handle* attribute_align_arg out123_new(void)
 	ao->channels = -1;
 	ao->format = -1;
 	ao->framesize = 0;
+	ao->planar = 0;
+	ao->interleaved = NULL;
+	ao->interleaved_size = 0;
+	ao->staging = NULL;
+	ao->staging_size = 0;
+	ao->direct = 0;
+	ao->begun = 0;
+	ao->begun_bytes = 0;
+	ao->period_frames = 0;
+	ao->device_frames = 0;
 	ao->state = play_dead;
 	ao->auxflags = 0;
 	ao->preload = 0.;
 	ao->verbose = 0;
 	ao->device_buffer = 0.;
 	ao->bindir = NULL;
+	ao->fanout_buffer = 0;
 	return ao;
 }
 
@@ -117,6 +150,10 @@ void attribute_align_arg out123_del(out123_handle *ao)
 		free(ao->name);
 	if(ao->bindir)
 		free(ao->bindir);
+	if(ao->interleaved)
+		free(ao->interleaved);
+	if(ao->staging)
+		free(ao->staging);
 	free(ao);
 }
 
@@ -135,6 +172,7 @@ static const char *const errstring[OUT123_ERRCOUNT] =
 ,	"failed to open device"
 ,	"buffer (communication) error"
 ,	"basic module system error"
+,	"bad function arguments"
 ,	"unknown parameter code"
 ,	"attempt to set read-only parameter"
 ,	"invalid out123 handle"
@@ -185,12 +223,30 @@ out123_set_buffer(out123_handle *ao, size_t buffer_bytes)
 	   then start new buffer process with newly allocated storage if given
 	   size is non-zero. */
 	out123_close(ao);
+#ifdef BUFFER_THREAD
+	threadbuf_exit(ao);
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_exit(ao);
+#endif
+	ao->fanout_buffer = buffer_bytes;
 	if(buffer_bytes)
+	{
+#ifdef BUFFER_THREAD
+		/* Each output of the fan-out gets a buffer of that size instead. */
+		if(ao->flags & OUT123_FANOUT)
+			return 0;
+#ifndef NOXFERMEM
+		/* The thread is also the fallback if there is no fork(). */
+		if(!(ao->flags & OUT123_BUFFER_THREAD) && !buffer_init(ao, buffer_bytes))
+			return 0;
+#endif
+		return threadbuf_init(ao, buffer_bytes);
+#elif !defined(NOXFERMEM)
 		return buffer_init(ao, buffer_bytes);
 #endif
+	}
 	return 0;
 }
 
@@ -223,6 +279,8 @@ out123_param( out123_handle *ao, enum out123_parms code
 			ao->device_buffer = fvalue;
 		break;
 		case OUT123_PROPFLAGS:
+		case OUT123_PERIODFRAMES:
+		case OUT123_DEVICEFRAMES:
 			ao->errcode = OUT123_SET_RO_PARAM;
 			ret = OUT123_ERR;
 		break;
@@ -241,6 +299,10 @@ out123_param( out123_handle *ao, enum out123_parms code
 			if(!AOQUIET) error1("bad parameter code %i", (int)code);
 			ret = OUT123_ERR;
 	}
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_sync_param(ao);
+#endif
 #ifndef NOXFERMEM
 	/* If there is a buffer, it needs to update its copy of parameters. */
 	if(have_buffer(ao))
@@ -286,6 +348,12 @@ out123_getparam( out123_handle *ao, enum out123_parms code
 		case OUT123_PROPFLAGS:
 			value = ao->propflags;
 		break;
+		case OUT123_PERIODFRAMES:
+			value = ao->period_frames;
+		break;
+		case OUT123_DEVICEFRAMES:
+			value = ao->device_frames;
+		break;
 		case OUT123_NAME:
 			svalue = ao->realname ? ao->realname : ao->name;
 		break;
@@ -390,6 +458,14 @@ out123_open(out123_handle *ao, const char* driver, const char* device)
 	ao->channels = -1;
 	ao->format = -1;
 
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+	{
+		if(threadbuf_open(ao, driver, device))
+			return OUT123_ERR;
+	}
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 	{
@@ -414,6 +490,27 @@ out123_open(out123_handle *ao, const char* driver, const char* device)
 			return out123_seterr(ao, OUT123_DOOM);
 		}
 
+#ifdef BUFFER_THREAD
+		/* Not one of them, but all at once. */
+		if(ao->flags & OUT123_FANOUT)
+		{
+			int err = tee_open(ao, names, device, ao->fanout_buffer);
+			if(!err && !(ao->driver = compat_strdup(names)))
+			{
+				if(!AOQUIET) error("OOM driver name");
+				ao->errcode = OUT123_DOOM;
+				err = -1;
+			}
+			if(err)
+			{
+				err = ao->errcode;
+				out123_close(ao);
+				return out123_seterr(ao, err);
+			}
+			ao->state = play_stopped;
+			return OUT123_OK;
+		}
+#endif
 		if(!(modnames = compat_strdup(names)))
 		{
 			out123_close(ao); /* Frees ao->device, too. */
@@ -471,6 +568,11 @@ void attribute_align_arg out123_close(out123_handle *ao)
 	out123_drain(ao);
 	out123_stop(ao);
 
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_close(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_close(ao);
@@ -519,7 +621,26 @@ out123_start(out123_handle *ao, long rate, int channels, int encoding)
 	ao->channels  = channels;
 	ao->format    = encoding;
 	ao->framesize = out123_encsize(encoding)*channels;
-
+	ao->planar    = 0;
+	ao->direct    = 0;
+	ao->begun     = 0;
+	ao->begun_bytes = 0;
+	ao->period_frames = 0;
+	ao->device_frames = 0;
+
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+	{
+		if(!threadbuf_start(ao))
+		{
+			ao->state = play_live;
+			return OUT123_OK;
+		}
+		else
+			return OUT123_ERR;
+	}
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 	{
@@ -534,8 +655,18 @@ out123_start(out123_handle *ao, long rate, int channels, int encoding)
 	else
 #endif
 	{
+		/* The driver knows about planes only without a buffer in between. */
+		ao->planar = ao->flags & OUT123_PLANAR && channels > 1
+		&&	ao->propflags & OUT123_PROP_PLANAR;
 		if(aoopen(ao) < 0)
+		{
+			ao->planar = 0;
 			return out123_seterr(ao, OUT123_DEV_OPEN);
+		}
+		/* Planar data needs to go through interleaving first. */
+		ao->direct = ao->begin && ao->commit
+		&&	ao->propflags & OUT123_PROP_MMAP
+		&&	!(ao->flags & OUT123_PLANAR && channels > 1);
 		ao->state = play_live;
 		return OUT123_OK;
 	}
@@ -547,6 +678,10 @@ void attribute_align_arg out123_pause(out123_handle *ao)
 	,	(void*)ao, ao ? (int)ao->state : -1 );
 	if(ao && ao->state == play_live)
 	{
+#ifdef BUFFER_THREAD
+		if(ao->threadbuf) threadbuf_pause(ao);
+		else
+#endif
 #ifndef NOXFERMEM
 		if(have_buffer(ao)){ debug("pause with buffer"); buffer_pause(ao); }
 		else
@@ -568,6 +703,10 @@ void attribute_align_arg out123_continue(out123_handle *ao)
 	,	(void*)ao, ao ? (int)ao->state : -1 );
 	if(ao && ao->state == play_paused)
 	{
+#ifdef BUFFER_THREAD
+		if(ao->threadbuf) threadbuf_continue(ao);
+		else
+#endif
 #ifndef NOXFERMEM
 		if(have_buffer(ao)) buffer_continue(ao);
 		else
@@ -593,6 +732,11 @@ void attribute_align_arg out123_stop(out123_handle *ao)
 	ao->errcode = 0;
 	if(!(ao->state == play_paused || ao->state == play_live))
 		return;
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_stop(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_stop(ao);
@@ -605,6 +749,51 @@ void attribute_align_arg out123_stop(out123_handle *ao)
 			error("trouble closing device");
 	}
 	ao->state = play_stopped;
+	/* A buffer started later does not get planes. */
+	ao->planar = 0;
+}
+
+/* Planar data for a driver or buffer that wants interleaved samples.
+   Returns the interleaved copy, NULL on error. */
+static void *interleave(out123_handle *ao, const unsigned char *planes, size_t count)
+{
+	size_t samplesize = ao->framesize/ao->channels;
+	size_t frames = count/ao->framesize;
+	size_t plane = frames*samplesize;
+	size_t i;
+	int c;
+
+	if(ao->interleaved_size < count)
+	{
+		unsigned char *buf = realloc(ao->interleaved, count);
+		if(!buf)
+		{
+			ao->errcode = OUT123_DOOM;
+			return NULL;
+		}
+		ao->interleaved = buf;
+		ao->interleaved_size = count;
+	}
+	for(c=0; c<ao->channels; ++c)
+	{
+		const unsigned char *in = planes + c*plane;
+		unsigned char *out = ao->interleaved + c*samplesize;
+		switch(samplesize)
+		{
+			case 2:
+				for(i=0; i<frames; ++i)
+					((int16_t*)out)[i*ao->channels] = ((const int16_t*)in)[i];
+			break;
+			case 4:
+				for(i=0; i<frames; ++i)
+					((int32_t*)out)[i*ao->channels] = ((const int32_t*)in)[i];
+			break;
+			default:
+				for(i=0; i<frames; ++i)
+					memcpy(out+i*ao->framesize, in+i*samplesize, samplesize);
+		}
+	}
+	return ao->interleaved;
 }
 
 size_t attribute_align_arg
@@ -634,6 +823,30 @@ out123_play(out123_handle *ao, void *bytes, size_t count)
 	count -= count % ao->framesize;
 	if(!count) return 0;
 
+	if(ao->flags & OUT123_PLANAR && ao->channels > 1)
+	{
+		if(ao->planar)
+		{
+			/* No resuming in the middle of planes. */
+			written = ao->write(ao, (unsigned char*)bytes, (int)count);
+			if(written < 0)
+			{
+				ao->errcode = OUT123_DEV_PLAY;
+				if(!AOQUIET)
+					error1("Error in writing audio (%s?)!", strerror(errno));
+				return 0;
+			}
+			return written;
+		}
+		if(!(bytes = interleave(ao, bytes, count)))
+			return 0;
+	}
+
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		return threadbuf_write(ao, bytes, count);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		return buffer_write(ao, bytes, count);
@@ -662,6 +875,89 @@ out123_play(out123_handle *ao, void *bytes, size_t count)
 	return sum;
 }
 
+int attribute_align_arg
+out123_play_begin(out123_handle *ao, void **buffer, size_t *bytes)
+{
+	debug3( "[%ld]out123_play_begin(%p) (%i)", (long)getpid()
+	,	(void*)ao, ao ? (int)ao->state : -1 );
+	if(!ao)
+		return OUT123_ERR;
+	ao->errcode = 0;
+	if(!buffer || !bytes)
+		return out123_seterr(ao, OUT123_ARG_ERROR);
+	/* If paused, automatically continue, as out123_play() does. */
+	if(ao->state != play_live)
+	{
+		if(ao->state == play_paused)
+			out123_continue(ao);
+		if(ao->state != play_live)
+			return out123_seterr(ao, OUT123_NOT_LIVE);
+	}
+
+	if(ao->direct)
+	{
+		unsigned char *mem;
+		if(ao->begin(ao, &mem, bytes) < 0)
+			return out123_seterr(ao, OUT123_DEV_PLAY);
+		*buffer = mem;
+	}
+	else
+	{
+		size_t size = ao->framesize
+		*	(ao->period_frames > 0 ? (size_t)ao->period_frames : STAGING_FRAMES);
+		if(ao->staging_size < size)
+		{
+			unsigned char *mem = realloc(ao->staging, size);
+			if(!mem)
+				return out123_seterr(ao, OUT123_DOOM);
+			ao->staging = mem;
+			ao->staging_size = size;
+		}
+		*buffer = ao->staging;
+		*bytes = size;
+	}
+	ao->begun = 1;
+	ao->begun_bytes = *bytes;
+	return OUT123_OK;
+}
+
+size_t attribute_align_arg
+out123_play_commit(out123_handle *ao, size_t bytes)
+{
+	int written;
+
+	debug3( "[%ld]out123_play_commit(%p, %"SIZE_P")", (long)getpid()
+	,	(void*)ao, (size_p)bytes );
+	if(!ao)
+		return 0;
+	ao->errcode = 0;
+	if(!ao->begun)
+	{
+		ao->errcode = OUT123_ARG_ERROR;
+		return 0;
+	}
+	ao->begun = 0;
+	/* More than handed out would read past the memory. */
+	if(bytes > ao->begun_bytes)
+	{
+		ao->errcode = OUT123_ARG_ERROR;
+		return 0;
+	}
+	if(!ao->direct)
+		return out123_play(ao, ao->staging, bytes);
+
+	bytes -= bytes % ao->framesize;
+	written = ao->commit(ao, bytes);
+	if(written < 0)
+	{
+		ao->errcode = OUT123_DEV_PLAY;
+		if(!AOQUIET)
+			error1("Error in writing audio (%s?)!", strerror(errno));
+		return 0;
+	}
+	return written;
+}
+
 /* Drop means to flush it down. Quickly. */
 void attribute_align_arg out123_drop(out123_handle *ao)
 {
@@ -669,6 +965,11 @@ void attribute_align_arg out123_drop(out123_handle *ao)
 	if(!ao)
 		return;
 	ao->errcode = 0;
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_drop(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_drop(ao);
@@ -695,6 +996,11 @@ void attribute_align_arg out123_drain(out123_handle *ao)
 		if(ao->state != play_live)
 			return;
 	}
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_drain(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_drain(ao);
@@ -721,6 +1027,11 @@ void attribute_align_arg out123_ndrain(out123_handle *ao, size_t bytes)
 		if(ao->state != play_live)
 			return;
 	}
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		threadbuf_ndrain(ao, bytes);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		buffer_ndrain(ao, bytes);
@@ -993,6 +1304,11 @@ out123_encodings(out123_handle *ao, long rate, int channels)
 
 	ao->channels = channels;
 	ao->rate     = rate;
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		return threadbuf_encodings(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		return buffer_encodings(ao);
@@ -1049,6 +1365,12 @@ out123_formats( out123_handle *ao, const long *rates, int ratecount
 		return out123_seterr(ao, OUT123_ARG_ERROR);
 	*fmtlist = NULL; /* Initialize so free(fmtlist) is always allowed. */
 
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		return threadbuf_formats( ao, rates, ratecount
+		                        , minchannels, maxchannels, fmtlist );
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 		return buffer_formats( ao, rates, ratecount
@@ -1111,12 +1433,31 @@ out123_formats( out123_handle *ao, const long *rates, int ratecount
 }
 
 
+int attribute_align_arg out123_sink_stats( out123_handle *ao, int sink
+,	long *dropped, long *underruns )
+{
+	debug2("out123_sink_stats(%p, %i)", (void*)ao, sink);
+	if(!ao)
+		return OUT123_ERR;
+	ao->errcode = 0;
+#ifdef BUFFER_THREAD
+	if(!tee_stats(ao, sink, dropped, underruns))
+		return OUT123_OK;
+#endif
+	return out123_seterr(ao, OUT123_ARG_ERROR);
+}
+
 size_t attribute_align_arg out123_buffered(out123_handle *ao)
 {
 	debug2("[%ld]out123_buffered(%p)", (long)getpid(), (void*)ao);
 	if(!ao)
 		return 0;
 	ao->errcode = 0;
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		return threadbuf_fill(ao);
+	else
+#endif
 #ifndef NOXFERMEM
 	if(have_buffer(ao))
 	{
@@ -1126,7 +1467,85 @@ size_t attribute_align_arg out123_buffered(out123_handle *ao)
 	}
 	else
 #endif
+	{
+		size_t fill = 0;
+#ifdef BUFFER_THREAD
+		/* A fan-out keeps its buffers in the sinks. */
+		tee_buffered(ao, &fill);
+#endif
+		return fill;
+	}
+}
+
+/* Microseconds, wrapping around. Only differences count. */
+static unsigned long out123_clock(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec*1000000UL
+	+	(unsigned long)(now.tv_nsec/1000);
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (unsigned long)now.tv_sec*1000000UL
+	+	(unsigned long)now.tv_usec;
+#endif
+}
+
+/* Buffers call this after each write to the driver, so that the latency
+   can be computed later without asking the device again. An integer, so
+   that storing it is one plain word even in the forked buffer's shared
+   memory. Never 0, that means no time stamp yet. */
+unsigned long audible_time(out123_handle *ao)
+{
+	long delay = ao->delay ? ao->delay(ao) : -1;
+	unsigned long when = out123_clock();
+	if(delay > 0 && ao->rate > 0)
+		when += (unsigned long)((double)delay/ao->rate*1e6+0.5);
+	return when ? when : 1;
+}
+
+long audible_frames(out123_handle *ao, unsigned long when)
+{
+	unsigned long left = when - out123_clock();
+	/* Half the range or more is a time in the past, wrapped around. */
+	if(!when || left > ULONG_MAX/2)
 		return 0;
+	return (long)((double)left*1e-6*ao->rate+0.5);
+}
+
+int attribute_align_arg out123_latency( out123_handle *ao
+,	long *frames, double *seconds )
+{
+	long delay;
+
+	if(!ao)
+		return OUT123_ERR;
+	ao->errcode = 0;
+	if(!(ao->state == play_paused || ao->state == play_live))
+		return out123_seterr(ao, OUT123_NOT_LIVE);
+#ifdef BUFFER_THREAD
+	if(ao->threadbuf)
+		delay = threadbuf_latency(ao);
+	else
+#endif
+#ifndef NOXFERMEM
+	if(have_buffer(ao))
+		delay = buffer_latency(ao);
+	else
+#endif
+	{
+		delay = ao->delay ? ao->delay(ao) : 0;
+		if(delay < 0)
+			delay = 0;
+	}
+	debug2("out123_latency(%p) = %ld", (void*)ao, delay);
+	if(frames)
+		*frames = delay;
+	if(seconds)
+		*seconds = ao->rate > 0 ? (double)delay/ao->rate : 0.;
+	return OUT123_OK;
 }
 
 int attribute_align_arg out123_getformat( out123_handle *ao
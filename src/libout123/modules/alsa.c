@@ -5,6 +5,11 @@
 	see COPYING and AUTHORS files in distribution or http://mpg123.org
 
 	initially written by Clemens Ladisch <clemens@ladisch.de>
+
+	With OUT123_MMAP, the device buffer is accessed via snd_pcm_mmap_begin()
+	and snd_pcm_mmap_commit(). Writes wait for a free period and copy right
+	into the ring, out123_play_begin() hands out the period itself. Normal
+	writes do not change with that.
 */
 
 /* ALSA headers define struct timeval if no POSIX macro is set,
@@ -80,7 +85,15 @@ static int initialize_device(out123_handle *ao)
 		if(!AOQUIET) error("initialize_device(): no configuration available");
 		return -1;
 	}
-	if (snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
+	ao->propflags &= ~OUT123_PROP_MMAP;
+	if (ao->flags & OUT123_MMAP) {
+		if (snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)
+			ao->propflags |= OUT123_PROP_MMAP;
+		else if(AOVERBOSE(1))
+			fprintf(stderr, "Note: device does not support mmap access, using normal writes.\n");
+	}
+	if (!(ao->propflags & OUT123_PROP_MMAP)
+	 && snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
 		if(!AOQUIET) error("initialize_device(): device does not support interleaved access");
 		return -1;
 	}
@@ -129,6 +142,9 @@ static int initialize_device(out123_handle *ao)
 		if(!AOQUIET) error("initialize_device(): cannot set hw params");
 		return -1;
 	}
+	/* The near values are what got installed. */
+	ao->period_frames = (long)period_size;
+	ao->device_frames = (long)buffer_size;
 
 	snd_pcm_sw_params_alloca(&sw);
 	if (snd_pcm_sw_params_current(pcm, sw) < 0) {
@@ -140,8 +156,9 @@ static int initialize_device(out123_handle *ao)
 		if(!AOQUIET) error("initialize_device(): cannot set start threshold");
 		return -1;
 	}
-	/* wake up on every interrupt */
-	if (snd_pcm_sw_params_set_avail_min(pcm, sw, 1) < 0) {
+	/* Wake up on every interrupt, or when a whole period can be mapped. */
+	if (snd_pcm_sw_params_set_avail_min( pcm, sw
+	,	ao->propflags & OUT123_PROP_MMAP ? period_size : 1 ) < 0) {
 		if(!AOQUIET) error("initialize_device(): cannot set min available");
 		return -1;
 	}
@@ -182,6 +199,7 @@ static int open_alsa(out123_handle *ao)
 		return -1;
 	}
 	ao->userptr = pcm;
+	ao->propflags &= ~OUT123_PROP_MMAP;
 	if (ao->format != -1) {
 		/* we're going to play: initalize sample format */
 		return initialize_device(ao);
@@ -221,12 +239,103 @@ static int get_formats_alsa(out123_handle *ao)
 	return supported_formats;
 }
 
+/* Wait for want frames of room in the device buffer, then map the next
+   free part of it, up to limit frames. */
+static int mmap_region( out123_handle *ao, snd_pcm_uframes_t want
+,	snd_pcm_uframes_t limit, unsigned char **buf
+,	snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames )
+{
+	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_sframes_t avail;
+	int err;
+
+	while(1)
+	{
+		avail = snd_pcm_avail_update(pcm);
+		if(avail < 0)
+			err = (int)avail;
+		else if((snd_pcm_uframes_t)avail < want)
+			err = snd_pcm_wait(pcm, -1);
+		else
+		{
+			*frames = (snd_pcm_uframes_t)avail < limit ? (snd_pcm_uframes_t)avail : limit;
+			/* This gives less at the end of the ring. */
+			err = snd_pcm_mmap_begin(pcm, &areas, offset, frames);
+			if(err >= 0)
+			{
+				*buf = (unsigned char*)areas[0].addr + areas[0].first/8
+				+	*offset*(areas[0].step/8);
+				return 0;
+			}
+		}
+		/* snd_pcm_wait() returns 1 when there is room. */
+		if(err < 0 && snd_pcm_recover(pcm, err, AOQUIET) < 0)
+			return err;
+		debug1("waited or recovered from alsa issue %i", err);
+	}
+}
+
+/* Hand the mapped frames to the device, returns the count actually taken. */
+static int mmap_done( out123_handle *ao, snd_pcm_uframes_t offset
+,	snd_pcm_uframes_t frames )
+{
+	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
+	snd_pcm_sframes_t done;
+
+	done = snd_pcm_mmap_commit(pcm, offset, frames);
+	if(done < 0 || (snd_pcm_uframes_t)done != frames)
+	{
+		/* An underrun in between lost the data, nothing played. */
+		int err = done < 0 ? (int)done : -EPIPE;
+		debug2("recovering from alsa issue %i after mapping %lu frames", err, (unsigned long)frames);
+		if(snd_pcm_recover(pcm, err, AOQUIET) < 0)
+			return err;
+		return 0;
+	}
+	return (int)done;
+}
+
+static int write_mmap(out123_handle *ao, unsigned char *buf, int bytes)
+{
+	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
+	snd_pcm_uframes_t period = (snd_pcm_uframes_t)ao->period_frames;
+	snd_pcm_uframes_t left = snd_pcm_bytes_to_frames(pcm, bytes);
+	snd_pcm_uframes_t written = 0;
+
+	while(left)
+	{
+		unsigned char *area;
+		snd_pcm_uframes_t offset, frames;
+		int err = mmap_region( ao, left < period ? left : period
+		,	left, &area, &offset, &frames );
+		if(err >= 0)
+		{
+			memcpy(area, buf, snd_pcm_frames_to_bytes(pcm, frames));
+			err = mmap_done(ao, offset, frames);
+		}
+		if(err < 0)
+		{
+			error1("Fatal problem with alsa output, error %i.", err);
+			if(!written)
+				return -1;
+			break;
+		}
+		buf  += snd_pcm_frames_to_bytes(pcm, err);
+		left -= err;
+		written += err;
+	}
+	return snd_pcm_frames_to_bytes(pcm, written);
+}
+
 static int write_alsa(out123_handle *ao, unsigned char *buf, int bytes)
 {
 	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
 	snd_pcm_uframes_t frames;
 	snd_pcm_sframes_t written;
 
+	if(ao->propflags & OUT123_PROP_MMAP)
+		return write_mmap(ao, buf, bytes);
 	frames = snd_pcm_bytes_to_frames(pcm, bytes);
 	while
 	( /* Try to write, recover if error, try again if recovery successful. */
@@ -244,6 +353,43 @@ static int write_alsa(out123_handle *ao, unsigned char *buf, int bytes)
 	else return snd_pcm_frames_to_bytes(pcm, written);
 }
 
+/* out123_play_begin(): a period of the ring, only with OUT123_PROP_MMAP */
+static int begin_alsa(out123_handle *ao, unsigned char **buf, size_t *bytes)
+{
+	snd_pcm_uframes_t period = (snd_pcm_uframes_t)ao->period_frames;
+	snd_pcm_uframes_t offset, frames;
+	int err;
+
+	err = mmap_region(ao, period, period, buf, &offset, &frames);
+	if(err < 0)
+	{
+		error1("Fatal problem with alsa output, error %i.", err);
+		return -1;
+	}
+	*bytes = snd_pcm_frames_to_bytes((snd_pcm_t*)ao->userptr, frames);
+	return 0;
+}
+
+static int commit_alsa(out123_handle *ao, size_t bytes)
+{
+	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames = snd_pcm_bytes_to_frames(pcm, bytes);
+	int done;
+
+	/* Without a commit in between, mapping again gives the same offset. */
+	done = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+	if(done >= 0)
+		done = mmap_done(ao, offset, frames);
+	if(done < 0)
+	{
+		error1("Fatal problem with alsa output, error %i.", done);
+		return -1;
+	}
+	return snd_pcm_frames_to_bytes(pcm, done);
+}
+
 static void flush_alsa(out123_handle *ao)
 {
 	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
@@ -264,6 +410,15 @@ static void drain_alsa(out123_handle *ao)
 	snd_pcm_drain(pcm);
 }
 
+static long delay_alsa(out123_handle *ao)
+{
+	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
+	snd_pcm_sframes_t frames;
+	if(pcm == NULL || snd_pcm_delay(pcm, &frames) < 0)
+		return -1; /* Also after an underrun, nothing queued then. */
+	return frames > 0 ? (long)frames : 0;
+}
+
 static int close_alsa(out123_handle *ao)
 {
 	snd_pcm_t *pcm=(snd_pcm_t*)ao->userptr;
@@ -287,6 +442,9 @@ static int init_alsa(out123_handle* ao)
 	ao->write = write_alsa;
 	ao->get_formats = get_formats_alsa;
 	ao->close = close_alsa;
+	ao->begin = begin_alsa;
+	ao->commit = commit_alsa;
+	ao->delay = delay_alsa;
 
 	/* Success */
 	return 0;
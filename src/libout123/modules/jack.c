@@ -10,6 +10,10 @@
 	to 99 channels. Only float input (ensures that libmpg123 selects f32
 	encoding). This is still a hack to shoehorn the JACK API into our model.
 
+	With planar input (OUT123_PLANAR), there is one ringbuffer per channel
+	instead, which the processing callback reads straight into the port
+	buffers, no deinterleaving anywhere.
+
 	Damn. I'm wary of he semaphore. I'm sure I constructed a deadlock there.
 	There's always a deadlock. --ThOr
 */
@@ -34,10 +38,12 @@ typedef struct {
 	int channels;
 	int encoding;
 	int framesize;
+	int planar; /* one ringbuffer per channel */
 	jack_default_audio_sample_t **ports_buf;
 	jack_port_t **ports;
-	jack_ringbuffer_t *rb;
-	size_t rb_size; /* in bytes */
+	jack_ringbuffer_t **rb; /* rb_count of them */
+	int rb_count;
+	size_t rb_size; /* in bytes, each */
 	jack_client_t *client;
 	char *procbuf;
 	size_t procbuf_frames; /* in PCM frames */
@@ -54,16 +60,20 @@ static jack_handle_t* alloc_jack_handle(out123_handle *ao)
 	handle->channels = ao->channels;
 	handle->encoding = ao->format;
 	handle->framesize = ao->framesize;
-	handle->rb = NULL;
+	handle->planar = ao->planar;
+	handle->rb_count = handle->planar ? ao->channels : 1;
+	handle->rb = malloc(sizeof(jack_ringbuffer_t*)*handle->rb_count);
 	handle->ports_buf = malloc( sizeof(jack_default_audio_sample_t*)
 	*	ao->channels );
 	handle->ports = malloc(sizeof(jack_port_t*)*ao->channels);
-	if(!handle->ports_buf || !handle->ports)
+	if(!handle->ports_buf || !handle->ports || !handle->rb)
 	{
 		if(handle->ports_buf)
 			free(handle->ports_buf);
 		if(handle->ports)
 			free(handle->ports);
+		if(handle->rb)
+			free(handle->rb);
 		free(handle);
 		return NULL;
 	}
@@ -72,12 +82,15 @@ static jack_handle_t* alloc_jack_handle(out123_handle *ao)
 		handle->ports_buf[i] = NULL;
 		handle->ports[i] = NULL;
 	}
+	for(i=0; i<handle->rb_count; ++i)
+		handle->rb[i] = NULL;
 	if(sem_init(&handle->sem, 0, 0))
 	{
 		if(!AOQUIET)
 			error("Semaphore init failed.");
 		free(handle->ports_buf);
 		free(handle->ports);
+		free(handle->rb);
 		free(handle);
 		return NULL;
 	}
@@ -108,9 +121,14 @@ static void free_jack_handle( jack_handle_t* handle )
 	}
 	if(handle->ports_buf)
 		free(handle->ports_buf);
-	/* Free up the ring buffer for channel*/
+	/* Free up the ring buffers */
 	if(handle->rb)
-		jack_ringbuffer_free(handle->rb);
+	{
+		for(i=0; i<handle->rb_count; ++i)
+			if(handle->rb[i])
+				jack_ringbuffer_free(handle->rb[i]);
+		free(handle->rb);
+	}
 	if (handle->client)
 		jack_client_close(handle->client);
 	if (handle->procbuf)
@@ -120,6 +138,55 @@ static void free_jack_handle( jack_handle_t* handle )
 }
 
 
+/* Planar: Each channel has its own ringbuffer, all with the same fill,
+   read right into the port buffers (via conversion from double). */
+static void process_planar(jack_handle_t *handle, size_t nframes)
+{
+	int c;
+	size_t samplesize = handle->framesize/handle->channels;
+	size_t got = jack_ringbuffer_read_space(handle->rb[0]);
+
+	/* The writer might be in the middle of filling them. */
+	for(c=1; c<handle->channels; ++c)
+	{
+		size_t space = jack_ringbuffer_read_space(handle->rb[c]);
+		if(space < got)
+			got = space;
+	}
+	got /= samplesize;
+	if(got > nframes)
+		got = nframes;
+	for(c=0; c<handle->channels; ++c)
+	{
+		jack_default_audio_sample_t *dst = handle->ports_buf[c];
+		if(handle->encoding == MPG123_ENC_FLOAT_32)
+			jack_ringbuffer_read(handle->rb[c], (char*)dst, got*sizeof(float));
+		else /* MPG123_ENC_FLOAT_64 */
+		{
+			size_t done = 0;
+			double *src = (double*)handle->procbuf;
+			while(done < got)
+			{
+				size_t n;
+				size_t piece = got-done;
+				if(piece > handle->procbuf_frames)
+					piece = handle->procbuf_frames;
+				jack_ringbuffer_read( handle->rb[c]
+				,	handle->procbuf, piece*sizeof(double) );
+				for(n=0; n<piece; ++n)
+					dst[done+n] = src[n];
+				done += piece;
+			}
+		}
+		if(nframes > got)
+		{
+			debug("filling up with zeros");
+			bzero(dst+got, (nframes-got)*sizeof(jack_default_audio_sample_t));
+		}
+	}
+	sem_post(&handle->sem);
+}
+
 static int process_callback( jack_nframes_t nframes, void *arg )
 {
 	int c;
@@ -130,6 +197,12 @@ static int process_callback( jack_nframes_t nframes, void *arg )
 		handle->ports_buf[c] =
 			jack_port_get_buffer(handle->ports[c], nframes);
 
+	if(handle->planar)
+	{
+		process_planar(handle, nframes);
+		return 0;
+	}
+
 	/* One ringbuffer to rule them all, getting interleaved data piecewise
 	   and appending to non-interleaved buffers. */
 	while(to_read)
@@ -143,8 +216,8 @@ static int process_callback( jack_nframes_t nframes, void *arg )
 		:	to_read;
 		/* Ensure we get only full PCM frames by checking available byte count
 		   and reducing expectation. */
-		avail_piece = jack_ringbuffer_read_space(handle->rb)/handle->framesize;
-		got_piece = jack_ringbuffer_read( handle->rb
+		avail_piece = jack_ringbuffer_read_space(handle->rb[0])/handle->framesize;
+		got_piece = jack_ringbuffer_read( handle->rb[0]
 		,	handle->procbuf, (avail_piece > piece ? piece : avail_piece)
 		*	handle->framesize ) / handle->framesize;
 		debug2( "fetched %"SIZE_P" frames from ringbuffer (wanted %"SIZE_P")"
@@ -359,11 +432,12 @@ static void drain_jack(out123_handle *ao)
 	do errno = 0;
 	while(sem_trywait(&handle->sem) == 0 || errno == EINTR);
 	/* For some reason, a single byte is reserved by JACK?! */
-	while(  handle && handle->alive && handle->rb
-	     && jack_ringbuffer_write_space(handle->rb)+1 < handle->rb_size )
+	/* Planar ringbuffers are all drained together. */
+	while(  handle && handle->alive && handle->rb[0]
+	     && jack_ringbuffer_write_space(handle->rb[0])+1 < handle->rb_size )
 	{
 		debug2( "JACK close wait %"SIZE_P" < %"SIZE_P"\n"
-		,	(size_p)jack_ringbuffer_write_space(handle->rb)
+		,	(size_p)jack_ringbuffer_write_space(handle->rb[0])
 		,	(size_p)handle->rb_size );
 		sem_wait(&handle->sem);
 	}
@@ -488,10 +562,14 @@ static int open_jack(out123_handle *ao)
 		handle->rb_size = 2*handle->procbuf_frames;
 	debug1("JACK ringbuffer for %"SIZE_P" PCM frames", (size_p)handle->rb_size);
 	/* Convert to bytes. */
-	handle->rb_size *= handle->framesize;
-	handle->rb = jack_ringbuffer_create(handle->rb_size);
+	handle->rb_size *= handle->framesize/handle->rb_count;
+	for(i=0; i<handle->rb_count; ++i)
+	{
+		if(!(handle->rb[i] = jack_ringbuffer_create(handle->rb_size)))
+			break;
+	}
 	handle->procbuf = malloc(handle->procbuf_frames*handle->framesize);
-	if(!handle->rb || !handle->procbuf)
+	if(i < handle->rb_count || !handle->procbuf)
 	{
 		if(!AOQUIET)
 			error("failed to allocate buffers");
@@ -539,22 +617,58 @@ static int get_formats_jack(out123_handle *ao)
 		return MPG123_ENC_FLOAT_32|MPG123_ENC_FLOAT_64;
 }
 
+/* Equal pieces of all planes go into their ringbuffers, the process
+   callback only takes what all of them have. */
+static size_t write_planes( jack_handle_t *handle, unsigned char *buf
+,	size_t plane, size_t done, size_t bytes )
+{
+	int c;
+	size_t samplesize = handle->framesize/handle->channels;
+	size_t piece = jack_ringbuffer_write_space(handle->rb[0]);
+
+	for(c=1; c<handle->channels; ++c)
+	{
+		size_t space = jack_ringbuffer_write_space(handle->rb[c]);
+		if(space < piece)
+			piece = space;
+	}
+	piece -= piece % samplesize;
+	if(piece > bytes)
+		piece = bytes;
+	for(c=0; c<handle->channels; ++c)
+		jack_ringbuffer_write( handle->rb[c]
+		,	(char*)buf+c*plane+done, piece );
+	return piece;
+}
+
 static int write_jack(out123_handle *ao, unsigned char *buf, int len)
 {
 	jack_handle_t *handle = (jack_handle_t*)ao->userptr;
 	size_t bytes_left;
+	size_t plane = 0;
 	unsigned int strike = 0;
 
 	bytes_left = len;
+	if(handle->planar)
+	{
+		/* Counting bytes of one plane from here on. */
+		plane = bytes_left/handle->channels;
+		bytes_left = plane;
+	}
 	while(bytes_left && handle->alive)
 	{
 		size_t piece;
 
 		debug("writing to ringbuffer");
 		/* No help: piece1 = jack_ringbuffer_write_space(handle->rb); */
-		piece = jack_ringbuffer_write(handle->rb, (char*)buf, bytes_left);
+		if(handle->planar)
+			piece = write_planes(handle, buf, plane, plane-bytes_left, bytes_left);
+		else
+		{
+			piece = jack_ringbuffer_write(handle->rb[0], (char*)buf, bytes_left);
+			buf += piece;
+		}
 		debug1("wrote %"SIZE_P" B", (size_p)piece);
-		buf += piece;
 		bytes_left -= piece;
 		/* Allow nothing being written some times, but not too often. 
 		   Don't know how often in a row that would be supposed to happen. */
@@ -578,14 +692,31 @@ static int write_jack(out123_handle *ao, unsigned char *buf, int len)
 			strike = 0;
 	}
 
+	if(handle->planar)
+		bytes_left *= handle->channels;
 	return len-bytes_left;
 }
 
 static void flush_jack(out123_handle *ao)
 {
 	jack_handle_t *handle = (jack_handle_t*)ao->userptr;
+	int i;
 	/* Reset the ring buffers*/
-	jack_ringbuffer_reset(handle->rb);
+	for(i=0; i<handle->rb_count; ++i)
+		jack_ringbuffer_reset(handle->rb[i]);
+}
+
+/* What waits in the ringbuffer, plus the period JACK is playing. */
+static long delay_jack(out123_handle *ao)
+{
+	jack_handle_t *handle = (jack_handle_t*)ao->userptr;
+	size_t bytes;
+	if(!handle || !handle->rb || !handle->rb[0] || !handle->framesize)
+		return -1;
+	bytes = jack_ringbuffer_read_space(handle->rb[0]);
+	if(handle->planar)
+		bytes *= handle->channels;
+	return (long)(bytes/handle->framesize + handle->procbuf_frames);
 }
 
 static int init_jack(out123_handle* ao)
@@ -599,7 +730,8 @@ static int init_jack(out123_handle* ao)
 	ao->write = write_jack;
 	ao->get_formats = get_formats_jack;
 	ao->close = close_jack;
-	ao->propflags |= OUT123_PROP_PERSISTENT;
+	ao->delay = delay_jack;
+	ao->propflags |= OUT123_PROP_PERSISTENT|OUT123_PROP_PLANAR;
 	/* Success */
 	return 0;
 }
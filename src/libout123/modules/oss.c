@@ -275,6 +275,16 @@ static int write_oss(out123_handle *ao,unsigned char *buf,int len)
 	return write(ao->fn,buf,len);
 }
 
+#ifdef SNDCTL_DSP_GETODELAY
+static long delay_oss(out123_handle *ao)
+{
+	int bytes;
+	if(ao->fn < 0 || ao->framesize < 1 || ioctl(ao->fn, SNDCTL_DSP_GETODELAY, &bytes) < 0)
+		return -1;
+	return bytes/ao->framesize;
+}
+#endif
+
 static int close_oss(out123_handle *ao)
 {
 	close(ao->fn);
@@ -298,6 +308,9 @@ static int init_oss(out123_handle* ao)
 	ao->write = write_oss;
 	ao->get_formats = get_formats_oss;
 	ao->close = close_oss;
+#ifdef SNDCTL_DSP_GETODELAY
+	ao->delay = delay_oss;
+#endif
 	
 	/* Success */
 	return 0;
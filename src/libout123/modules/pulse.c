@@ -136,6 +136,20 @@ static int write_pulse(out123_handle *ao, unsigned char *buf, int len)
 	return len; /* If successful, everything has been written. */
 }
 
+static long delay_pulse(out123_handle *ao)
+{
+	pa_simple *pas = (pa_simple*)ao->userptr;
+	pa_usec_t usec;
+	int err;
+
+	if(!pas)
+		return -1;
+	usec = pa_simple_get_latency(pas, &err);
+	if(usec == (pa_usec_t)-1)
+		return -1;
+	return (long)((double)usec*1e-6*ao->rate);
+}
+
 static int close_pulse(out123_handle *ao)
 {
 	pa_simple *pas = (pa_simple*)ao->userptr;
@@ -173,6 +187,7 @@ static int init_pulse(out123_handle* ao)
 	ao->write = write_pulse;
 	ao->get_formats = get_formats_pulse;
 	ao->close = close_pulse;
+	ao->delay = delay_pulse;
 
 	/* Success */
 	return 0;
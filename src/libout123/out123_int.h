@@ -57,6 +57,10 @@ struct out123_struct
 	int buffer_fd[2];
 	txfermem *buffermem;
 #endif
+#ifdef BUFFER_THREAD
+	/* Alternatively, a thread handles everything (see threadbuf.c). */
+	struct threadbuf *threadbuf;
+#endif
 
 	int fn;			/* filenumber */
 	void *userptr;	/* driver specific pointer */
@@ -69,6 +73,11 @@ struct out123_struct
 	void (*drain)(out123_handle *);
 	int (*close)(out123_handle *);
 	int (*deinit)(out123_handle *);
+	/* Direct access to the device buffer (OUT123_PROP_MMAP), optional. */
+	int (*begin)(out123_handle *, unsigned char **, size_t *);
+	int (*commit)(out123_handle *, size_t);
+	/* Frames written but not audible yet, <0 if unknown, optional. */
+	long (*delay)(out123_handle *);
 	
 	/* the loaded that has set the above */
 	mpg123_module_t *module;
@@ -83,12 +92,23 @@ struct out123_struct
 	int channels;	/* number of channels */
 	int format;		/* encoding (TODO: rename this to "encoding"!) */
 	int framesize;	/* Output needs data in chunks of framesize bytes. */
+	int planar;	/* write() gets planar data (OUT123_PLANAR for this playback) */
+	unsigned char *interleaved; /* for planar data to others */
+	size_t interleaved_size;
+	unsigned char *staging; /* out123_play_begin() without OUT123_PROP_MMAP */
+	size_t staging_size;
+	int direct;    /* out123_play_begin() is the driver's begin() */
+	int begun;     /* waiting for out123_play_commit() */
+	size_t begun_bytes; /* ... of at most that much */
+	long period_frames; /* device geometry, set by driver on open */
+	long device_frames;
 	enum playstate state; /* ... */
 	int auxflags;	/* For now just one: quiet mode (for probing). */
 	int propflags;	/* Property flags, set by driver. */
 	double preload;	/* buffer fraction to preload before play */
 	int verbose;	/* verbosity to stderr */
 	double device_buffer; /* device buffer in seconds */
+	size_t fanout_buffer; /* out123_set_buffer() with OUT123_FANOUT */
 	char *bindir;	/* OUT123_BINDIR */
 /* TODO int intflag;   ... is it really useful/necessary from the outside? */
 };
@@ -107,6 +127,11 @@ struct audio_format_name {
 	char *sname;
 };
 
+/* Time (monotonic microseconds, wrapping) when the next frame given to the
+   driver becomes audible, and the frames until the given time of that kind. */
+unsigned long audible_time(out123_handle *ao);
+long audible_frames(out123_handle *ao, unsigned long when);
+
 int write_parameters(out123_handle *ao, int fd);
 int read_parameters(out123_handle *ao
 ,	int fd, byte *prebuf, int *preoff, int presize);
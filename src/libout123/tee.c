@@ -0,0 +1,333 @@
+/*
+	tee: fan-out of one playback stream to several outputs
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	Each sink is a complete out123 handle with a buffer thread, so that a
+	device or file that takes its time does not hold up the others. The
+	live sinks set the pace: Playback waits for room in their buffers, as
+	it would with only one of them. A file sink that cannot keep up with
+	that gets only the part of the audio that fits and counts the dropped
+	frames. Without any live sink, all of them set the pace and nothing is
+	dropped.
+
+	Starting the handle starts the sinks, stopping or pausing it pauses
+	them, keeping their files and buffered audio for continuing with the
+	same format. Closing the handle drains and deletes them.
+*/
+
+#include "tee.h"
+#include "threadbuf.h"
+#include "debug.h"
+
+/* Buffer of each sink if out123_set_buffer() did not give a size. */
+#define SINK_BUFFER (1024*1024)
+
+struct sink
+{
+	out123_handle *ao;
+	int pace; /* Playback waits for this one. */
+	long dropped; /* in PCM frames */
+};
+
+struct tee
+{
+	int count;
+	struct sink *sinks;
+};
+
+static int fan_open(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int i;
+
+	/* Probing for formats, the sinks get asked in fan_formats(). */
+	if(ao->format < 0)
+		return 0;
+	for(i=0; i<t->count; ++i)
+	{
+		out123_handle *sink = t->sinks[i].ao;
+		long rate;
+		int channels, encoding;
+		/* Live again, so that a new start plays what is buffered first. */
+		out123_continue(sink);
+		if(( sink->state != play_live
+		||	out123_getformat(sink, &rate, &channels, &encoding, NULL)
+		||	rate != ao->rate || channels != ao->channels
+		||	encoding != ao->format )
+		&&	out123_start(sink, ao->rate, ao->channels, ao->format) )
+		{
+			if(!AOQUIET)
+				error2( "cannot start output %i (%s)"
+				,	i, out123_strerror(sink) );
+			ao->errcode = out123_errcode(sink);
+			return -1;
+		}
+		if(t->sinks[i].pace && !ao->period_frames)
+		{
+			out123_getparam_int(sink, OUT123_PERIODFRAMES, &ao->period_frames);
+			out123_getparam_int(sink, OUT123_DEVICEFRAMES, &ao->device_frames);
+		}
+	}
+	return 0;
+}
+
+/* The encodings all sinks can take. */
+static int fan_formats(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int enc = MPG123_ENC_ANY;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+	{
+		int sinkenc = out123_encodings(t->sinks[i].ao, ao->rate, ao->channels);
+		if(sinkenc < 0)
+			return 0;
+		enc &= sinkenc;
+	}
+	return enc;
+}
+
+static int fan_write(out123_handle *ao, unsigned char *buf, int len)
+{
+	struct tee *t = ao->userptr;
+	int good = 0;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+	{
+		struct sink *s = t->sinks + i;
+		size_t bytes = (size_t)len;
+		size_t written = 0;
+		if(!s->pace)
+		{
+			size_t space = threadbuf_space(s->ao);
+			if(bytes > space)
+				bytes = space - space % ao->framesize;
+		}
+		if(bytes)
+			written = out123_play(s->ao, buf, bytes);
+		if(written < (size_t)len)
+			s->dropped += (long)(((size_t)len-written)/ao->framesize);
+		/* A sink with trouble does not stop the others. */
+		if(written || bytes < (size_t)len)
+			++good;
+		else
+			debug2("sink %i failed: %s", i, out123_strerror(s->ao));
+	}
+	return good ? len : -1;
+}
+
+static void fan_flush(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+		out123_drop(t->sinks[i].ao);
+}
+
+static void fan_drain(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+		out123_drain(t->sinks[i].ao);
+}
+
+static int fan_close(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+		out123_pause(t->sinks[i].ao);
+	return 0;
+}
+
+static int fan_deinit(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	int i;
+
+	if(!t)
+		return 0;
+	for(i=0; i<t->count; ++i)
+		out123_del(t->sinks[i].ao);
+	free(t->sinks);
+	free(t);
+	ao->userptr = NULL;
+	return 0;
+}
+
+/* The slowest of the sinks playback waits for. */
+static long fan_delay(out123_handle *ao)
+{
+	struct tee *t = ao->userptr;
+	long delay = 0;
+	int i;
+
+	for(i=0; i<t->count; ++i)
+	{
+		long frames;
+		if( t->sinks[i].pace
+		&&	!out123_latency(t->sinks[i].ao, &frames, NULL)
+		&&	frames > delay )
+			delay = frames;
+	}
+	return delay;
+}
+
+/* The n-th entry of a comma-separated list, empty ones included.
+   Returns NULL for an empty entry or on error. */
+static char *list_entry(const char *list, int n)
+{
+	const char *end;
+	char *entry;
+
+	if(!list)
+		return NULL;
+	for(; n > 0; --n)
+	{
+		list = strchr(list, ',');
+		if(!list)
+			return NULL;
+		++list;
+	}
+	end = strchr(list, ',');
+	if(!end)
+		end = list + strlen(list);
+	if(end == list || !(entry = malloc(end-list+1)))
+		return NULL;
+	memcpy(entry, list, end-list);
+	entry[end-list] = 0;
+	return entry;
+}
+
+int tee_open(out123_handle *ao, const char *drivers, const char *devices
+,	size_t bytes)
+{
+	struct tee *t;
+	const char *c;
+	int count = 1;
+	int live = 0;
+	int i;
+
+	for(c=drivers; *c; ++c)
+		if(*c == ',')
+			++count;
+	if( !(t = malloc(sizeof(*t)))
+	||	!(t->sinks = malloc(sizeof(*t->sinks)*count)) )
+	{
+		if(t)
+			free(t);
+		if(!AOQUIET)
+			error("OOM sinks");
+		ao->errcode = OUT123_DOOM;
+		return -1;
+	}
+	t->count = 0;
+	ao->userptr = t;
+	ao->open = fan_open;
+	ao->get_formats = fan_formats;
+	ao->write = fan_write;
+	ao->flush = fan_flush;
+	ao->drain = fan_drain;
+	ao->close = fan_close;
+	ao->deinit = fan_deinit;
+	ao->delay = fan_delay;
+
+	for(i=0; i<count; ++i)
+	{
+		char *driver = list_entry(drivers, i);
+		char *device = list_entry(devices, i);
+		out123_handle *sink = out123_new();
+		int err = !driver || !sink;
+
+		if(!err)
+		{
+			t->sinks[t->count].ao = sink;
+			t->sinks[t->count].pace = 0;
+			t->sinks[t->count].dropped = 0;
+			++t->count;
+			out123_param_from(sink, ao);
+			sink->flags &= ~(OUT123_FANOUT|OUT123_PLANAR);
+			sink->flags |= OUT123_BUFFER_THREAD;
+			if(AOVERBOSE(2))
+				fprintf( stderr, "Fan-out to output module: %s, device: %s\n"
+				,	driver, device ? device : "<default>" );
+			err = out123_set_buffer(sink, bytes ? bytes : SINK_BUFFER)
+			||	out123_open(sink, driver, device);
+			if(err)
+				ao->errcode = out123_errcode(sink);
+			else if(sink->propflags & OUT123_PROP_LIVE)
+				live = 1;
+		}
+		else
+		{
+			if(sink)
+				out123_del(sink);
+			ao->errcode = driver ? OUT123_DOOM : OUT123_BAD_DRIVER_NAME;
+		}
+		if(err && !AOQUIET)
+			error3( "cannot open output %i (%s) for fan-out: %s"
+			,	i, driver ? driver : "<none>"
+			,	out123_plain_strerror(ao->errcode) );
+		if(driver)
+			free(driver);
+		if(device)
+			free(device);
+		if(err)
+		{
+			fan_deinit(ao);
+			return -1;
+		}
+	}
+	/* The live sinks set the pace, if there are any. */
+	for(i=0; i<t->count; ++i)
+		t->sinks[i].pace = !live || t->sinks[i].ao->propflags & OUT123_PROP_LIVE;
+	ao->propflags = live ? OUT123_PROP_LIVE : 0;
+	return 0;
+}
+
+int tee_stats(out123_handle *ao, int sink, long *dropped, long *underruns)
+{
+	struct tee *t;
+
+	if(ao->open != fan_open)
+		return -1;
+	t = ao->userptr;
+	if(sink < 0 || sink >= t->count)
+		return -1;
+	if(dropped)
+		*dropped = t->sinks[sink].dropped;
+	if(underruns)
+		*underruns = t->sinks[sink].ao->threadbuf
+		?	threadbuf_underruns(t->sinks[sink].ao)
+		:	0;
+	return 0;
+}
+
+/* Like fan_delay(), the sinks others can run ahead of do not count. */
+int tee_buffered(out123_handle *ao, size_t *bytes)
+{
+	struct tee *t;
+	size_t fill = 0;
+	int i;
+
+	if(ao->open != fan_open)
+		return -1;
+	t = ao->userptr;
+	for(i=0; i<t->count; ++i)
+	{
+		size_t sinkfill;
+		if( t->sinks[i].pace && t->sinks[i].ao->threadbuf
+		&&	(sinkfill = threadbuf_fill(t->sinks[i].ao)) > fill )
+			fill = sinkfill;
+	}
+	*bytes = fill;
+	return 0;
+}
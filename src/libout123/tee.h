@@ -0,0 +1,30 @@
+/*
+	tee.h: fan-out of one playback stream to several outputs
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	With OUT123_FANOUT, each driver in the list given to out123_open() gets
+	its own out123 handle with a buffer thread (see threadbuf.c), a sink.
+	The handle opening them gets a set of callbacks, like a builtin driver,
+	that pass everything on to all sinks.
+*/
+
+#ifndef _MPG123_TEE_H_
+#define _MPG123_TEE_H_
+
+#include "out123_int.h"
+
+/* Open all drivers in the comma-separated list, with the devices taken
+   from the equally separated device list, and install the callbacks.
+   Each sink buffers the given amount of bytes. */
+int tee_open(out123_handle *ao, const char *drivers, const char *devices
+,	size_t bytes);
+/* Frames not written to a sink that could not keep up, and times its
+   buffer ran low while playing. Returns -1 if there is no such sink. */
+int tee_stats(out123_handle *ao, int sink, long *dropped, long *underruns);
+/* Bytes in the fullest buffer of the sinks setting the pace.
+   Returns -1 if this is no fan-out. */
+int tee_buffered(out123_handle *ao, size_t *bytes);
+
+#endif
@@ -0,0 +1,608 @@
+/*
+	threadbuf.c: output buffer in a thread
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	The buffer process (buffer.c) costs a fork and a socket round trip for
+	each piece of audio handed over. Here, the writer copies into a ring
+	shared with a playback thread and only touches the lock when one side
+	has to sleep: It is a single-producer/single-consumer ring with the two
+	indices on separate cache lines, each side announcing that it is about
+	to wait, so that the other side only signals when needed.
+
+	The playback thread owns a normal out123 handle for the device. Controls
+	from the calling side (open, start, pause, drain, ...) raise a flag and
+	take the lock, which the thread releases after the current piece of
+	audio, and then simply call the out123 API on that handle.
+*/
+
+/* Needed for pthread_sigmask() from signal.h. */
+#define _POSIX_C_SOURCE 200112L
+
+#include "threadbuf.h"
+#include <pthread.h>
+#include <signal.h>
+#include "debug.h"
+
+/* Largest piece of audio written to the device at once. Smaller than the
+   buffer process' outburst as controls wait for the piece to finish
+   instead of interrupting it. */
+#define BURST 16384
+
+#define CACHELINE 64
+
+/* Indices count bytes modulo twice the size, to tell full from empty. */
+struct ring
+{
+	size_t writeindex; /* [W] */
+	char pad_w[CACHELINE-sizeof(size_t)];
+	size_t readindex;  /* [R] */
+	char pad_r[CACHELINE-sizeof(size_t)];
+	size_t size;     /* whole frames of the current format */
+	size_t capacity; /* allocated */
+	char *data;
+};
+
+struct threadbuf
+{
+	struct ring ring;
+	out123_handle *ao; /* the handle actually doing output */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* for the thread: data or control */
+	pthread_cond_t room; /* for the writer: free space */
+	pthread_cond_t idle; /* for control: thread stopped playing */
+	int control;        /* atomic, control waits for the lock */
+	int worker_waiting; /* atomic, thread sleeps on wake */
+	unsigned long audible; /* atomic, see audible_time() */
+	long underruns;     /* atomic, ring ran low while playing */
+	/* The rest is protected by the lock. */
+	int writer_waiting;
+	int playing;
+	int played; /* since the last control or preload */
+	int preloading;
+	int draining;
+	int terminate;
+	/* Playback state of the buffer, can differ from the device's one. */
+	enum playstate state;
+};
+
+#define ATOMIC_GET(p)         __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define ATOMIC_SET(p, v)      __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_RELEASE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static size_t ring_distance(struct ring *r, size_t from, size_t to)
+{
+	return to >= from ? to - from : 2*r->size - from + to;
+}
+
+static size_t ring_step(struct ring *r, size_t index, size_t count)
+{
+	index += count;
+	return index >= 2*r->size ? index - 2*r->size : index;
+}
+
+static size_t ring_pos(struct ring *r, size_t index)
+{
+	return index >= r->size ? index - r->size : index;
+}
+
+static size_t ring_used(struct ring *r)
+{
+	return ring_distance( r, ATOMIC_ACQUIRE(&r->readindex)
+	,	ATOMIC_ACQUIRE(&r->writeindex) );
+}
+
+/* Writer side: Copy as much as fits, return that count. */
+static size_t ring_write(struct ring *r, const char *buf, size_t count)
+{
+	size_t windex = ATOMIC_ACQUIRE(&r->writeindex);
+	size_t space = r->size - ring_distance(r, ATOMIC_ACQUIRE(&r->readindex), windex);
+	size_t pos = ring_pos(r, windex);
+	size_t first;
+
+	if(count > space)
+		count = space;
+	first = r->size - pos;
+	if(first > count)
+		first = count;
+	memcpy(r->data+pos, buf, first);
+	memcpy(r->data, buf+first, count-first);
+	/* Full barrier: Publish data before checking if the reader sleeps. */
+	ATOMIC_SET(&r->writeindex, ring_step(r, windex, count));
+	return count;
+}
+
+/* Same as in buffer.c. */
+static size_t preload_size(struct threadbuf *tb)
+{
+	size_t preload = 0;
+	if(tb->ao->preload > 0.)     preload = (size_t)(tb->ao->preload*tb->ring.size);
+	if(preload > tb->ring.size/2) preload = tb->ring.size/2;
+
+	return preload;
+}
+
+/* Play one piece of audio from the ring, at most the given amount of bytes.
+   On error, the device is closed, which stops playback. */
+static size_t play_piece(struct threadbuf *tb, size_t bytes)
+{
+	struct ring *r = &tb->ring;
+	size_t rindex = ATOMIC_ACQUIRE(&r->readindex);
+	size_t pos = ring_pos(r, rindex);
+	size_t written;
+
+	if(bytes > r->size - pos)
+		bytes = r->size - pos;
+	if(bytes > BURST)
+		bytes = BURST;
+	bytes -= bytes % tb->ao->framesize;
+	written = out123_play(tb->ao, r->data+pos, bytes);
+	/* Before the bytes leave the ring, so that the latency never misses them. */
+	ATOMIC_SET(&tb->audible, audible_time(tb->ao));
+	ATOMIC_RELEASE(&r->readindex, ring_step(r, rindex, written));
+	if(tb->ao->errcode == OUT123_DEV_PLAY)
+		out123_close(tb->ao);
+	return written;
+}
+
+/* Play up to limit bytes from the ring, stopping early on trouble. */
+static void play_all(struct threadbuf *tb, size_t limit)
+{
+	size_t bytes;
+	while( limit && tb->ao->framesize > 0
+	  && (bytes = ring_used(&tb->ring)) >= (size_t)tb->ao->framesize )
+	{
+		size_t written = play_piece(tb, bytes > limit ? limit : bytes);
+		if(!written)
+			break;
+		limit -= written;
+	}
+}
+
+static void drop_all(struct threadbuf *tb)
+{
+	ATOMIC_RELEASE(&tb->ring.readindex, ATOMIC_ACQUIRE(&tb->ring.writeindex));
+}
+
+/* The playback thread, mirroring buffer_loop(). */
+static void *threadbuf_loop(void *arg)
+{
+	struct threadbuf *tb = arg;
+
+	pthread_mutex_lock(&tb->lock);
+	while(!tb->terminate)
+	{
+		size_t bytes;
+
+		if(ATOMIC_GET(&tb->control))
+		{
+			pthread_cond_wait(&tb->wake, &tb->lock);
+			continue;
+		}
+		bytes = ring_used(&tb->ring);
+		if(tb->state == play_live)
+		{
+			if(tb->preloading)
+				tb->preloading = (bytes < preload_size(tb));
+			if(!tb->preloading)
+			{
+				if(!tb->draining && bytes < BURST)
+				{
+					/* Only a device running dry in the middle of playback counts. */
+					if(tb->played && tb->ao->propflags & OUT123_PROP_LIVE)
+						ATOMIC_SET(&tb->underruns, ATOMIC_GET(&tb->underruns)+1);
+					tb->played = FALSE;
+					tb->preloading = TRUE;
+				}
+				else if(bytes && bytes >= (size_t)tb->ao->framesize)
+				{
+					tb->playing = TRUE;
+					pthread_mutex_unlock(&tb->lock);
+					play_piece(tb, bytes);
+					pthread_mutex_lock(&tb->lock);
+					tb->playing = FALSE;
+					tb->played = TRUE;
+					tb->state = tb->ao->state;
+					if(ATOMIC_GET(&tb->control))
+						pthread_cond_signal(&tb->idle);
+					if(tb->writer_waiting)
+						pthread_cond_signal(&tb->room);
+					continue;
+				}
+			}
+			/* Be nice and pause the device on preloading. */
+			if(tb->preloading && tb->ao->state == play_live)
+				out123_pause(tb->ao);
+		}
+		/* Nothing to do: Sleep until the writer or control wakes us. The flag
+		   is set before checking the ring again, the writer sets the index
+		   before checking the flag, so one of us sees the other. */
+		ATOMIC_SET(&tb->worker_waiting, TRUE);
+		if(!ATOMIC_GET(&tb->control) && ring_used(&tb->ring) == bytes)
+			pthread_cond_wait(&tb->wake, &tb->lock);
+		ATOMIC_SET(&tb->worker_waiting, FALSE);
+	}
+	pthread_mutex_unlock(&tb->lock);
+	return NULL;
+}
+
+/* Get hold of the thread's handle, waiting for the current piece of
+   playback to finish. */
+static void control_begin(struct threadbuf *tb)
+{
+	ATOMIC_SET(&tb->control, TRUE);
+	pthread_mutex_lock(&tb->lock);
+	while(tb->playing)
+		pthread_cond_wait(&tb->idle, &tb->lock);
+}
+
+static void control_end(struct threadbuf *tb)
+{
+	tb->played = FALSE;
+	ATOMIC_SET(&tb->control, FALSE);
+	pthread_cond_signal(&tb->wake);
+	pthread_mutex_unlock(&tb->lock);
+}
+
+/* After a drain, the device is paused, but the buffer shall continue as soon
+   as there is new data, just like the buffer process on XF_CMD_DATA. */
+static void drain_state(struct threadbuf *tb)
+{
+	tb->state = tb->ao->state == play_paused ? play_live : tb->ao->state;
+	tb->draining = FALSE;
+}
+
+static void threadbuf_free(struct threadbuf *tb)
+{
+	pthread_cond_destroy(&tb->idle);
+	pthread_cond_destroy(&tb->room);
+	pthread_cond_destroy(&tb->wake);
+	pthread_mutex_destroy(&tb->lock);
+	if(tb->ao)
+		out123_del(tb->ao);
+	if(tb->ring.data)
+		free(tb->ring.data);
+	free(tb);
+}
+
+int threadbuf_init(out123_handle *ao, size_t bytes)
+{
+	struct threadbuf *tb;
+	sigset_t all, old;
+	int err;
+
+	threadbuf_exit(ao);
+	if(bytes < 2*BURST) bytes = 2*BURST;
+
+	if(!(tb = malloc(sizeof(*tb))))
+	{
+		ao->errcode = OUT123_DOOM;
+		return -1;
+	}
+	tb->ring.writeindex = 0;
+	tb->ring.readindex = 0;
+	tb->ring.size = bytes;
+	tb->ring.capacity = bytes;
+	tb->ring.data = malloc(bytes);
+	tb->ao = out123_new();
+	pthread_mutex_init(&tb->lock, NULL);
+	pthread_cond_init(&tb->wake, NULL);
+	pthread_cond_init(&tb->room, NULL);
+	pthread_cond_init(&tb->idle, NULL);
+	tb->control = FALSE;
+	tb->worker_waiting = FALSE;
+	tb->audible = 0;
+	tb->underruns = 0;
+	tb->writer_waiting = FALSE;
+	tb->playing = FALSE;
+	tb->played = FALSE;
+	tb->preloading = FALSE;
+	tb->draining = FALSE;
+	tb->terminate = FALSE;
+	tb->state = play_dead;
+	if(!tb->ring.data || !tb->ao)
+	{
+		threadbuf_free(tb);
+		ao->errcode = OUT123_DOOM;
+		return -1;
+	}
+	out123_param_from(tb->ao, ao);
+	tb->ao->flags &= ~(OUT123_KEEP_PLAYING|OUT123_PLANAR); /* No need for that here, data is interleaved. */
+
+	/* Signals are for the main program, the thread inherits this mask. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&tb->thread, NULL, threadbuf_loop, tb);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err)
+	{
+		if(!AOQUIET)
+			error1("cannot start buffer thread (%i)", err);
+		threadbuf_free(tb);
+		ao->errcode = OUT123_BUFFER_ERROR;
+		return -1;
+	}
+	ao->threadbuf = tb;
+	return 0;
+}
+
+void threadbuf_exit(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	if(!tb)
+		return;
+
+	debug("ending buffer thread");
+	threadbuf_stop(ao);
+	control_begin(tb);
+	tb->terminate = TRUE;
+	control_end(tb);
+	pthread_join(tb->thread, NULL);
+	threadbuf_free(tb);
+	ao->threadbuf = NULL;
+}
+
+int threadbuf_sync_param(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	out123_param_from(tb->ao, ao);
+	tb->ao->flags &= ~(OUT123_KEEP_PLAYING|OUT123_PLANAR);
+	control_end(tb);
+	return 0;
+}
+
+int threadbuf_open(out123_handle *ao, const char* driver, const char* device)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	int ret = 0;
+
+	control_begin(tb);
+	tb->draining = FALSE;
+	if(out123_open(tb->ao, driver, device))
+	{
+		ao->errcode = tb->ao->errcode;
+		ret = -1;
+	}
+	else if(
+		(tb->ao->driver   && !(ao->driver   = compat_strdup(tb->ao->driver)))
+	||	(tb->ao->device   && !(ao->device   = compat_strdup(tb->ao->device)))
+	||	(tb->ao->realname && !(ao->realname = compat_strdup(tb->ao->realname)))
+	){
+		ao->errcode = OUT123_DOOM;
+		ret = -1;
+	}
+	ao->propflags = tb->ao->propflags;
+	tb->state = tb->ao->state;
+	control_end(tb);
+	return ret;
+}
+
+int threadbuf_encodings(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	int encodings;
+
+	control_begin(tb);
+	encodings = out123_encodings(tb->ao, ao->rate, ao->channels);
+	if(encodings < 0)
+		ao->errcode = tb->ao->errcode;
+	tb->state = tb->ao->state;
+	control_end(tb);
+	return encodings;
+}
+
+int threadbuf_formats( out123_handle *ao, const long *rates, int ratecount
+                     , int minchannels, int maxchannels
+                     , struct mpg123_fmt **fmtlist )
+{
+	struct threadbuf *tb = ao->threadbuf;
+	int fmtcount;
+
+	control_begin(tb);
+	fmtcount = out123_formats( tb->ao, rates, ratecount
+	,	minchannels, maxchannels, fmtlist );
+	if(fmtcount < 0)
+		ao->errcode = tb->ao->errcode;
+	tb->state = tb->ao->state;
+	control_end(tb);
+	return fmtcount;
+}
+
+int threadbuf_start(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	int ret = 0;
+
+	control_begin(tb);
+	tb->draining = FALSE;
+	/* Stopping emptied the ring. Frames must not wrap around its end, as
+	   play_piece() only hands whole frames in one piece to the device. */
+	tb->ring.writeindex = 0;
+	tb->ring.readindex = 0;
+	tb->ring.size = tb->ring.capacity;
+	if(ao->framesize > 0)
+		tb->ring.size -= tb->ring.size % ao->framesize;
+	if(!out123_start(tb->ao, ao->rate, ao->channels, ao->format))
+	{
+		out123_pause(tb->ao); /* Be nice, start only on play_piece(). */
+		tb->state = play_live;
+		ao->period_frames = tb->ao->period_frames;
+		ao->device_frames = tb->ao->device_frames;
+		tb->preloading = TRUE;
+	}
+	else
+	{
+		tb->state = tb->ao->state;
+		ao->errcode = tb->ao->errcode;
+		ret = -1;
+	}
+	control_end(tb);
+	return ret;
+}
+
+void threadbuf_stop(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	if(tb->state == play_live) /* Drain is implied! */
+		play_all(tb, (size_t)-1);
+	drop_all(tb);
+	out123_stop(tb->ao);
+	tb->draining = FALSE;
+	tb->state = tb->ao->state;
+	control_end(tb);
+}
+
+void threadbuf_close(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	out123_close(tb->ao);
+	tb->draining = FALSE;
+	tb->state = tb->ao->state;
+	control_end(tb);
+}
+
+void threadbuf_continue(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	tb->state = play_live; /* We'll get errors reported later if that is not right. */
+	tb->preloading = FALSE; /* It should continue without delay. */
+	tb->draining = FALSE; /* But the burst size should be cared for. */
+	control_end(tb);
+}
+
+void threadbuf_drain(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	if(tb->state == play_live)
+	{
+		play_all(tb, (size_t)-1);
+		out123_drain(tb->ao);
+	}
+	drain_state(tb);
+	control_end(tb);
+}
+
+void threadbuf_ndrain(out123_handle *ao, size_t bytes)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	/* Expect further calls to ndrain, avoid prebuffering. */
+	tb->draining = TRUE;
+	tb->preloading = FALSE;
+	if(tb->state == play_live)
+	{
+		play_all(tb, bytes);
+		/* Only drain hardware if the end was reached. */
+		if(ring_used(&tb->ring) < (size_t)tb->ao->framesize)
+		{
+			out123_drain(tb->ao);
+			drain_state(tb);
+		}
+	}
+	control_end(tb);
+}
+
+void threadbuf_pause(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	tb->draining = FALSE;
+	if(tb->state == play_live)
+	{
+		out123_pause(tb->ao);
+		tb->state = play_paused;
+	}
+	control_end(tb);
+}
+
+void threadbuf_drop(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+
+	control_begin(tb);
+	tb->draining = FALSE;
+	drop_all(tb);
+	out123_drop(tb->ao);
+	ATOMIC_SET(&tb->audible, 0);
+	control_end(tb);
+}
+
+/* Hand over audio, blocking while the ring is full. */
+size_t threadbuf_write(out123_handle *ao, void *buffer, size_t bytes)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	size_t written = 0;
+
+	while(written < bytes)
+	{
+		size_t piece = ring_write(&tb->ring, (char*)buffer+written, bytes-written);
+		if(piece)
+		{
+			written += piece;
+			if(ATOMIC_GET(&tb->worker_waiting))
+			{
+				pthread_mutex_lock(&tb->lock);
+				pthread_cond_signal(&tb->wake);
+				pthread_mutex_unlock(&tb->lock);
+			}
+		}
+		else
+		{
+			int full;
+			pthread_mutex_lock(&tb->lock);
+			tb->writer_waiting = TRUE;
+			while((full = (ring_used(&tb->ring) == tb->ring.size)) && tb->state == play_live)
+			{
+				pthread_cond_signal(&tb->wake);
+				pthread_cond_wait(&tb->room, &tb->lock);
+			}
+			tb->writer_waiting = FALSE;
+			pthread_mutex_unlock(&tb->lock);
+			if(full)
+			{
+				if(!AOQUIET)
+					error("buffer thread is not playing");
+				ao->errcode = OUT123_NOT_LIVE;
+				break;
+			}
+		}
+	}
+	return written;
+}
+
+size_t threadbuf_fill(out123_handle *ao)
+{
+	return ring_used(&ao->threadbuf->ring);
+}
+
+size_t threadbuf_space(out123_handle *ao)
+{
+	return ao->threadbuf->ring.size - ring_used(&ao->threadbuf->ring);
+}
+
+long threadbuf_underruns(out123_handle *ao)
+{
+	return ATOMIC_GET(&ao->threadbuf->underruns);
+}
+
+long threadbuf_latency(out123_handle *ao)
+{
+	struct threadbuf *tb = ao->threadbuf;
+	long frames = ring_used(&tb->ring)/ao->framesize;
+	return frames + audible_frames(ao, ATOMIC_GET(&tb->audible));
+}
@@ -0,0 +1,47 @@
+/*
+	threadbuf.h: output buffer in a thread
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	The same job as buffer.[hc], without a second process: A thread plays
+	audio from a lock-free single-producer/single-consumer ring, using its
+	own out123 handle for the device. The calling handle is just a proxy,
+	as with the buffer process. Controls park the thread between pieces of
+	audio and act on its handle directly instead of passing messages.
+*/
+
+#ifndef _MPG123_THREADBUF_H_
+#define _MPG123_THREADBUF_H_
+
+#include "out123_int.h"
+
+int  threadbuf_init(out123_handle *ao, size_t bytes);
+void threadbuf_exit(out123_handle *ao);
+
+int threadbuf_sync_param(out123_handle *ao);
+int threadbuf_open(out123_handle *ao, const char* driver, const char* device);
+int threadbuf_encodings(out123_handle *ao);
+int threadbuf_formats( out123_handle *ao, const long *rates, int ratecount
+                     , int minchannels, int maxchannels
+                     , struct mpg123_fmt **fmtlist );
+int threadbuf_start(out123_handle *ao);
+void threadbuf_ndrain(out123_handle *ao, size_t bytes);
+
+void threadbuf_stop(out123_handle *ao);
+void threadbuf_close(out123_handle *ao);
+void threadbuf_continue(out123_handle *ao);
+void threadbuf_drain(out123_handle *ao);
+void threadbuf_pause(out123_handle *ao);
+void threadbuf_drop(out123_handle *ao);
+
+size_t threadbuf_write(out123_handle *ao, void *buffer, size_t bytes);
+size_t threadbuf_fill(out123_handle *ao);
+/* Bytes that can be written without blocking. */
+size_t threadbuf_space(out123_handle *ao);
+/* Times the ring ran low during playback, making the thread preload again. */
+long threadbuf_underruns(out123_handle *ao);
+/* Frames in the ring and in the device behind it. */
+long threadbuf_latency(out123_handle *ao);
+
+#endif
@@ -22,14 +22,46 @@
 	of what stood the test of time minimal. One still can add a module to
 	libout123 that uses sndfile and similar libraries for more choice on writing
 	output files.
+
+	Output goes to a plain file descriptor now, collected into pieces of
+	WRITE_SIZE bytes, with byte order flipped while copying into that buffer
+	instead of in place. Optionally, with OUT123_DIRECT_IO, the file is opened
+	with O_DIRECT to bypass the page cache. WAV headers reserve a JUNK chunk
+	that becomes the ds64 chunk of RF64 (EBU Tech 3306) when the sizes do not
+	fit into 32 bits anymore, as is only known when patching the header at the
+	end.
 */
 
+/* O_DIRECT is an extension with glibc. */
+#define _GNU_SOURCE
 #include "out123_int.h"
 #include "wav.h"
 
 #include <errno.h>
 #include "debug.h"
 
+#if defined(O_DIRECT) && defined(HAVE_POSIX_MEMALIGN)
+#define DIRECT_IO
+#endif
+
+/* Output is written in pieces of that size, a multiple of all sample sizes
+   (2, 3, 4 bytes) and of DIRECT_ALIGN. Bigger writes without byte flipping
+   go out in one go. */
+#define WRITE_SIZE (3*128*1024)
+/* Buffer address, file offset and write size alignment for O_DIRECT. */
+#define DIRECT_ALIGN 4096
+/* In 32 bit size fields: unknown or too big, look elsewhere. */
+#define BIGSIZE 0xffffffffUL
+
+/* Sizes of an RF64 file, in the place of the JUNK chunk. */
+struct ds64
+{
+	byte riffsize[8];
+	byte datasize[8];
+	byte samplecount[8];
+	byte tablelen[4];
+};
+
 /* Create the two WAV headers. */
 
 #define WAVE_FORMAT 1
@@ -63,11 +95,15 @@ struct auhead {
 
 struct wavdata
 {
-	FILE *wavfp;
-	long datalen;
+	int fd;
+	int close_fd; /* not for stdout */
+	int direct; /* O_DIRECT is set */
+	off_t datalen;
 	int flipendian;
 	int bytes_per_sample;
 	int floatwav; /* If we write a floating point WAV file. */
+	unsigned char *buf; /* WRITE_SIZE bytes collecting the output */
+	size_t fill;
 	/* 
 		Open routines only prepare a header, stored here and written on first
 		actual data write. If no data is written at all, proper files will
@@ -76,6 +112,7 @@ struct wavdata
 	*/
 	void *the_header;
 	size_t the_header_size;
+	int header_done;
 };
 
 static struct wavdata* wavdata_new(void)
@@ -83,13 +120,18 @@ static struct wavdata* wavdata_new(void)
 	struct wavdata *wdat = malloc(sizeof(struct wavdata));
 	if(wdat)
 	{
-		wdat->wavfp = NULL;
+		wdat->fd = -1;
+		wdat->close_fd = 0;
+		wdat->direct = 0;
 		wdat->datalen = 0;
 		wdat->flipendian = 0;
 		wdat->bytes_per_sample = -1;
 		wdat->floatwav = 0;
+		wdat->buf = NULL;
+		wdat->fill = 0;
 		wdat->the_header = NULL;
 		wdat->the_header_size = 0;
+		wdat->header_done = 0;
 	}
 	return wdat;
 }
@@ -97,8 +139,10 @@ static struct wavdata* wavdata_new(void)
 static void wavdata_del(struct wavdata *wdat)
 {
 	if(!wdat) return;
-	if(wdat->wavfp && wdat->wavfp != stdout)
-		compat_fclose(wdat->wavfp);
+	if(wdat->fd >= 0 && wdat->close_fd)
+		compat_close(wdat->fd);
+	if(wdat->buf)
+		free(wdat->buf);
 	if(wdat->the_header)
 		free(wdat->the_header);
 	free(wdat);
@@ -133,6 +177,22 @@ static void long2bigendian(long inval,byte *outval,int b)
   }
 }
 
+/* For off_t values that may well exceed long. */
+static void off2littleendian(off_t inval, byte *outval, int b)
+{
+	int i;
+	for(i=0;i<b;++i)
+	{
+		outval[i] = inval & 0xff;
+		inval >>= 8;
+	}
+}
+
+static int fits32(off_t size)
+{
+	return !(size >> 16 >> 16);
+}
+
 static long from_little(byte *inval, int b)
 {
 	long ret = 0;
@@ -161,8 +221,35 @@ static int testEndian(void)
   return ret;
 }
 
+#ifdef DIRECT_IO
+static void direct_off(struct wavdata *wdat)
+{
+	int flags = fcntl(wdat->fd, F_GETFL);
+	if(flags >= 0)
+		fcntl(wdat->fd, F_SETFL, flags & ~O_DIRECT);
+	wdat->direct = 0;
+}
+#endif
+
 /* return: 0 is good, -1 is bad */
-static int open_file(struct wavdata *wdat, char *filename)
+static int open_buffer(struct wavdata *wdat)
+{
+#ifdef DIRECT_IO
+	if(wdat->direct)
+	{
+		void *mem;
+		if(posix_memalign(&mem, DIRECT_ALIGN, WRITE_SIZE))
+			return -1;
+		wdat->buf = mem;
+	}
+	else
+#endif
+	wdat->buf = malloc(WRITE_SIZE);
+	return wdat->buf ? 0 : -1;
+}
+
+/* return: 0 is good, -1 is bad */
+static int open_file(struct wavdata *wdat, char *filename, int direct)
 {
 	debug2("open_file(%p, %s)", (void*)wdat, filename ? filename : "<nil>");
 	if(!wdat)
@@ -175,24 +262,175 @@ static int open_file(struct wavdata *wdat, char *filename)
 #endif
 	if(!filename || !strcmp("-",filename) || !strcmp("", filename))
 	{
-		wdat->wavfp = stdout;
+		wdat->fd = STDOUT_FILENO;
+		wdat->close_fd = 0;
 #ifdef WIN32
 		_setmode(STDOUT_FILENO, _O_BINARY);
 #endif
+		/* Nothing buffered in stdio shall come after our data. */
+		fflush(stdout);
 		/* If stdout is redirected to a file, seeks suddenly can work.
 		Doing one here to ensure that such a file has the same output
 		it had when opening directly as such. */
-		fseek(wdat->wavfp, 0L, SEEK_SET);
-		return 0;
+		lseek(wdat->fd, 0, SEEK_SET);
 	}
 	else
 	{
-		wdat->wavfp = compat_fopen(filename, "wb");
-		if(!wdat->wavfp)
+		int flags = O_CREAT|O_WRONLY|O_TRUNC;
+#ifdef DIRECT_IO
+		if(direct)
+		{
+			wdat->fd = compat_open(filename, flags|O_DIRECT);
+			/* Not all file systems can do that. */
+			wdat->direct = wdat->fd >= 0;
+		}
+		if(wdat->fd < 0)
+#endif
+		wdat->fd = compat_open(filename, flags);
+		if(wdat->fd < 0)
 			return -1;
+		wdat->close_fd = 1;
+	}
+	return open_buffer(wdat);
+}
+
+/* Write it all or complain. return: 0 is good, -1 is bad */
+static int write_all(out123_handle *ao, const unsigned char *data, size_t bytes)
+{
+	struct wavdata *wdat = ao->userptr;
+	size_t done = unintr_write(wdat->fd, data, bytes);
+#ifdef DIRECT_IO
+	/* The file system might refuse direct I/O only now. */
+	if(done < bytes && wdat->direct && errno == EINVAL)
+	{
+		direct_off(wdat);
+		done += unintr_write(wdat->fd, data+done, bytes-done);
+	}
+#endif
+	if(done < bytes)
+	{
+		if(!AOQUIET)
+			error1("cannot write to output file: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Write out the collected output. With direct I/O, only whole blocks go
+   out, unless everything is demanded. That ends direct I/O, also for the
+   header update that comes next.
+   return: 0 is good, -1 is bad */
+static int flush_buffer(out123_handle *ao, int all)
+{
+	struct wavdata *wdat = ao->userptr;
+	size_t bytes = wdat->fill;
+	int ret;
+
+#ifdef DIRECT_IO
+	if(wdat->direct && all)
+		direct_off(wdat);
+	else if(wdat->direct)
+		bytes -= bytes % DIRECT_ALIGN;
+#endif
+	if(!bytes)
+		return 0;
+	ret = write_all(ao, wdat->buf, bytes);
+	/* On error, the data is lost anyway. */
+	if(ret < 0)
+		bytes = wdat->fill;
+	memmove(wdat->buf, wdat->buf+bytes, wdat->fill-bytes);
+	wdat->fill -= bytes;
+	return ret;
+}
+
+static int flip_size(struct wavdata *wdat)
+{
+	return wdat->bytes_per_sample > 2 ? wdat->bytes_per_sample : 2;
+}
+
+/* Copy samples with reversed byte order. For 16 and 32 bits, whole words are
+   swapped in a loop the compiler can vectorize. */
+static void flip_copy(unsigned char *out, const unsigned char *in, size_t bytes, int size)
+{
+	size_t i = 0;
+	uint32_t w;
+
+	switch(size)
+	{
+		case 4:
+			for(; i+4 <= bytes; i+=4)
+			{
+				memcpy(&w, in+i, 4);
+				w = (w>>24) | ((w>>8)&0xff00UL) | ((w&0xff00UL)<<8) | (w<<24);
+				memcpy(out+i, &w, 4);
+			}
+		break;
+		case 3:
+			for(; i+3 <= bytes; i+=3)
+			{
+				out[i]   = in[i+2];
+				out[i+1] = in[i+1];
+				out[i+2] = in[i];
+			}
+		break;
+		default:
+			for(; i+4 <= bytes; i+=4)
+			{
+				memcpy(&w, in+i, 4);
+				w = ((w&0x00ff00ffUL)<<8) | ((w>>8)&0x00ff00ffUL);
+				memcpy(out+i, &w, 4);
+			}
+			if(i+2 <= bytes)
+			{
+				out[i]   = in[i+1];
+				out[i+1] = in[i];
+			}
+	}
+}
+
+/* Collect output, writing out full buffers. return: 0 is good, -1 is bad */
+static int put_data(out123_handle *ao, const unsigned char *data, size_t bytes, int flip)
+{
+	struct wavdata *wdat = ao->userptr;
+	int size = flip ? flip_size(wdat) : 1;
+
+	while(bytes)
+	{
+		size_t room = WRITE_SIZE - wdat->fill;
+		size_t piece = bytes < room ? bytes : room;
+
+		/* Nothing to do with big pieces but writing them. */
+		if(!flip && !wdat->fill && !wdat->direct && bytes >= WRITE_SIZE)
+			return write_all(ao, data, bytes);
+		piece -= piece % size;
+		if(piece)
+		{
+			if(flip)
+				flip_copy(wdat->buf+wdat->fill, data, piece, size);
+			else
+				memcpy(wdat->buf+wdat->fill, data, piece);
+			wdat->fill += piece;
+			data  += piece;
+			bytes -= piece;
+		}
 		else
-			return 0;
+		{
+			/* A sample across the end of the buffer. */
+			unsigned char sample[4];
+			flip_copy(sample, data, size, size);
+			memcpy(wdat->buf+wdat->fill, sample, room);
+			wdat->fill += room;
+			if(flush_buffer(ao, 0) < 0)
+				return -1;
+			memcpy(wdat->buf+wdat->fill, sample+room, size-room);
+			wdat->fill += size-room;
+			data  += size;
+			bytes -= size;
+		}
+		if(wdat->fill == WRITE_SIZE && flush_buffer(ao, 0) < 0)
+			return -1;
 	}
+	return 0;
 }
 
 /* return: 0 is good, -1 is bad
@@ -203,9 +441,11 @@ static int close_file(out123_handle *ao)
 	struct wavdata *wdat = ao->userptr;
 	int ret = 0;
 
-	if(wdat->wavfp != NULL && wdat->wavfp != stdout)
+	if(wdat->fd >= 0 && flush_buffer(ao, 1))
+		ret = -1;
+	if(wdat->fd >= 0 && wdat->close_fd)
 	{
-		if(compat_fclose(wdat->wavfp))
+		if(compat_close(wdat->fd))
 		{
 			if(!AOQUIET)
 				error1("problem closing the audio file, probably because of flushing to disk: %s\n", strerror(errno));
@@ -214,13 +454,14 @@ static int close_file(out123_handle *ao)
 	}
 
 	/* Always cleanup here. */
-	wdat->wavfp = NULL;
+	wdat->fd = -1;
 	wavdata_del(wdat);
 	ao->userptr = NULL;
 	return ret;
 }
 
-/* return: 0 is good, -1 is bad */
+/* Final header at the beginning, after flushing and rewinding the file.
+   return: 0 is good, -1 is bad */
 static int write_header(out123_handle *ao)
 {
 	struct wavdata *wdat = ao->userptr;
@@ -230,10 +471,8 @@ static int write_header(out123_handle *ao)
 
 	if(
 		wdat->the_header_size > 0
-	&&	(
-			fwrite(wdat->the_header, wdat->the_header_size, 1, wdat->wavfp) != 1
-		|| fflush(wdat->wavfp)
-		)
+	&&	unintr_write(wdat->fd, wdat->the_header, wdat->the_header_size)
+		!= wdat->the_header_size
 	)
 	{
 		if(!AOQUIET)
@@ -243,6 +482,21 @@ static int write_header(out123_handle *ao)
 	else return 0;
 }
 
+/* Sizes beyond 32 bits make it RF64, with the real values in the ds64
+   chunk in place of the JUNK one. Returns 1 in that case. */
+static int rf64_sizes( byte *riffheader, byte *junkheader, struct ds64 *ds64
+,	off_t riffsize, off_t datasize, off_t samples )
+{
+	if(fits32(riffsize))
+		return 0;
+	memcpy(riffheader, "RF64", 4);
+	memcpy(junkheader, "ds64", 4);
+	off2littleendian(riffsize, ds64->riffsize, sizeof(ds64->riffsize));
+	off2littleendian(datasize, ds64->datasize, sizeof(ds64->datasize));
+	off2littleendian(samples, ds64->samplecount, sizeof(ds64->samplecount));
+	return 1;
+}
+
 int au_open(out123_handle *ao)
 {
 	struct wavdata *wdat   = NULL;
@@ -303,7 +557,7 @@ int au_open(out123_handle *ao)
 	long2bigendian(ao->rate,auhead->rate,sizeof(auhead->rate));
 	long2bigendian(ao->channels,auhead->channels,sizeof(auhead->channels));
 
-	if(open_file(wdat, ao->device) < 0)
+	if(open_file(wdat, ao->device, ao->flags & OUT123_DIRECT_IO) < 0)
 		goto au_open_bad;
 
 	wdat->datalen = 0;
@@ -353,7 +607,7 @@ int cdr_open(out123_handle *ao)
 
 	wdat->flipendian = !testEndian(); /* big end */
 
-	if(open_file(wdat, ao->device) < 0)
+	if(open_file(wdat, ao->device, ao->flags & OUT123_DIRECT_IO) < 0)
 	{
 		if(!AOQUIET)
 			error("cannot open file for writing");
@@ -387,7 +641,7 @@ int raw_open(out123_handle *ao)
 		goto raw_open_bad;
 	}
 
-	if(open_file(wdat, ao->device) < 0)
+	if(open_file(wdat, ao->device, ao->flags & OUT123_DIRECT_IO) < 0)
 		goto raw_open_bad;
 
 	ao->userptr = wdat;
@@ -510,7 +764,7 @@ int wav_open(out123_handle *ao)
 		,	sizeof(inthead->WAVE.fmt.BlockAlign) );
 	}
 
-	if(open_file(wdat, ao->device) < 0)
+	if(open_file(wdat, ao->device, ao->flags & OUT123_DIRECT_IO) < 0)
 		goto wav_open_bad;
 
 	if(wdat->floatwav)
@@ -550,65 +804,31 @@ wav_open_bad:
 int wav_write(out123_handle *ao, unsigned char *buf, int len)
 {
 	struct wavdata *wdat = ao->userptr;
-	int temp;
-	int i;
 
-	if(!wdat || !wdat->wavfp)
+	if(!wdat || wdat->fd < 0)
 		return 0; /* Really? Zero? */
 
-	if(wdat->datalen == 0 && write_header(ao) < 0)
-		return -1;
-
-	/* Endianess conversion. Not fancy / optimized. */
-	if(wdat->flipendian)
+	if(!wdat->header_done)
 	{
-		if(wdat->bytes_per_sample == 4) /* 32 bit */
-		{
-			if(len & 3)
-			{
-				if(!AOQUIET)
-					error("Number of bytes no multiple of 4 (32bit)!");
-				return -1;
-			}
-			for(i=0;i<len;i+=4)
-			{
-				int j;
-				unsigned char tmp[4];
-				for(j = 0; j<=3; ++j) tmp[j] = buf[i+j];
-				for(j = 0; j<=3; ++j) buf[i+j] = tmp[3-j];
-			}
-		}
-		else /* 16 bit */
-		{
-			if(len & 1)
-			{
-				error("Odd number of bytes!");
-				return -1;
-			}
-			for(i=0;i<len;i+=2)
-			{
-				unsigned char tmp;
-				tmp = buf[i+0];
-				buf[i+0] = buf[i+1];
-				buf[i+1] = tmp;
-			}
-		}
+		if(put_data(ao, wdat->the_header, wdat->the_header_size, 0) < 0)
+			return -1;
+		wdat->header_done = 1;
 	}
+	if(len <= 0)
+		return 0;
 
-	temp = fwrite(buf, 1, len, wdat->wavfp);
-	if(temp <= 0) return temp;
-/* That would kill it of early when running out of disk space. */
-#if 0
-if(fflush(wdat->wavfp))
-{
-	if(!AOQUIET)
-		error1("flushing failed: %s\n", strerror(errno));
-	return -1;
-}
-#endif
-	wdat->datalen += temp;
+	/* Endianess conversion on the way into the buffer. */
+	if(wdat->flipendian && len % flip_size(wdat))
+	{
+		if(!AOQUIET)
+			error1("Number of bytes no multiple of %i!", flip_size(wdat));
+		return -1;
+	}
+	if(put_data(ao, buf, len, wdat->flipendian) < 0)
+		return -1;
+	wdat->datalen += len;
 
-	return temp;
+	return len;
 }
 
 int wav_close(out123_handle *ao)
@@ -618,45 +838,72 @@ int wav_close(out123_handle *ao)
 	if(!wdat) /* Special case: Opened only for format query. */
 		return 0;
 
-	if(!wdat || !wdat->wavfp)
+	if(!wdat || wdat->fd < 0)
 		return -1;
 
 	/* flush before seeking to catch out-of-disk explicitly at least at the end */
-	if(fflush(wdat->wavfp))
-	{
-		if(!AOQUIET)
-			error1("cannot flush WAV stream: %s", strerror(errno));
+	if(flush_buffer(ao, 1))
 		return close_file(ao);
-	}
-	if(fseek(wdat->wavfp, 0L, SEEK_SET) >= 0)
+	if(lseek(wdat->fd, 0, SEEK_SET) == 0)
 	{
 		if(wdat->floatwav)
 		{
 			struct riff_float *floathead = wdat->the_header;
-			long2littleendian(wdat->datalen
-			,	floathead->WAVE.data.datalen
-			,	sizeof(floathead->WAVE.data.datalen));
-			long2littleendian(wdat->datalen+sizeof(floathead->WAVE)
-			,	floathead->WAVElen
-			,	sizeof(floathead->WAVElen));
-			long2littleendian( wdat->datalen
+			off_t samples = wdat->datalen
 			/	(
 					from_little(floathead->WAVE.fmt.Channels,2)
 				*	from_little(floathead->WAVE.fmt.BitsPerSample,2)/8
-				)
-			,	floathead->WAVE.fact.samplelen
-			,	sizeof(floathead->WAVE.fact.samplelen) );
+				);
+			if(rf64_sizes( floathead->riffheader, floathead->WAVE.junkheader
+			,	&floathead->WAVE.ds64, wdat->datalen+sizeof(floathead->WAVE)
+			,	wdat->datalen, samples ))
+			{
+				off2littleendian(BIGSIZE, floathead->WAVE.data.datalen
+				,	sizeof(floathead->WAVE.data.datalen));
+				off2littleendian(BIGSIZE, floathead->WAVElen
+				,	sizeof(floathead->WAVElen));
+				off2littleendian(BIGSIZE, floathead->WAVE.fact.samplelen
+				,	sizeof(floathead->WAVE.fact.samplelen));
+			}
+			else
+			{
+				off2littleendian(wdat->datalen
+				,	floathead->WAVE.data.datalen
+				,	sizeof(floathead->WAVE.data.datalen));
+				off2littleendian(wdat->datalen+sizeof(floathead->WAVE)
+				,	floathead->WAVElen
+				,	sizeof(floathead->WAVElen));
+				off2littleendian( samples, floathead->WAVE.fact.samplelen
+				,	sizeof(floathead->WAVE.fact.samplelen) );
+			}
 		}
 		else
 		{
 			struct riff *inthead = wdat->the_header;
-			long2littleendian(wdat->datalen, inthead->WAVE.data.datalen
-			,	sizeof(inthead->WAVE.data.datalen));
-			long2littleendian(wdat->datalen+sizeof(inthead->WAVE), inthead->WAVElen
-			,	sizeof(inthead->WAVElen));
+			off_t samples = wdat->datalen
+			/	(
+					from_little(inthead->WAVE.fmt.Channels,2)
+				*	from_little(inthead->WAVE.fmt.BitsPerSample,2)/8
+				);
+			if(rf64_sizes( inthead->riffheader, inthead->WAVE.junkheader
+			,	&inthead->WAVE.ds64, wdat->datalen+sizeof(inthead->WAVE)
+			,	wdat->datalen, samples ))
+			{
+				off2littleendian(BIGSIZE, inthead->WAVE.data.datalen
+				,	sizeof(inthead->WAVE.data.datalen));
+				off2littleendian(BIGSIZE, inthead->WAVElen
+				,	sizeof(inthead->WAVElen));
+			}
+			else
+			{
+				off2littleendian(wdat->datalen, inthead->WAVE.data.datalen
+				,	sizeof(inthead->WAVE.data.datalen));
+				off2littleendian(wdat->datalen+sizeof(inthead->WAVE), inthead->WAVElen
+				,	sizeof(inthead->WAVElen));
+			}
 		}
 		/* Always (over)writing the header here; also for stdout, when
-		   fseek worked, this overwrite works. */
+		   seeking worked, this overwrite works. */
 		write_header(ao);
 	}
 	else if(!AOQUIET)
@@ -672,22 +919,20 @@ int au_close(out123_handle *ao)
 	if(!wdat) /* Special case: Opened only for format query. */
 		return 0;
 
-	if(!wdat->wavfp)
+	if(wdat->fd < 0)
 		return -1;
 
 	/* flush before seeking to catch out-of-disk explicitly at least at the end */
-	if(fflush(wdat->wavfp))
-	{
-		if(!AOQUIET)
-			error1("cannot flush WAV stream: %s", strerror(errno));
+	if(flush_buffer(ao, 1))
 		return close_file(ao);
-	}
-	if(fseek(wdat->wavfp, 0L, SEEK_SET) >= 0)
+	if(lseek(wdat->fd, 0, SEEK_SET) == 0)
 	{
 		struct auhead *auhead = wdat->the_header;
-		long2bigendian(wdat->datalen, auhead->datalen, sizeof(auhead->datalen));
+		/* Too big is as good as unknown. */
+		off_t datalen = fits32(wdat->datalen) ? wdat->datalen : (off_t)BIGSIZE;
+		long2bigendian(datalen, auhead->datalen, sizeof(auhead->datalen));
 		/* Always (over)writing the header here; also for stdout, when
-		   fseek worked, this overwrite works. */
+		   seeking worked, this overwrite works. */
 		write_header(ao);
 	}
 	else if(!AOQUIET)
@@ -704,7 +949,7 @@ int raw_close(out123_handle *ao)
 	if(!wdat) /* Special case: Opened only for format query. */
 		return 0;
 
-	if(!wdat->wavfp)
+	if(wdat->fd < 0)
 		return -1;
 
 	return close_file(ao);
@@ -743,14 +988,14 @@ int wav_formats(out123_handle *ao)
 /* Draining is flushing to disk. Words do suck at times.
    One could call fsync(), too, but to be safe, that would need to
    be called on the directory, too. Also, apps randomly calling
-   fsync() can cause annoying issues in a system. */
+   fsync() can cause annoying issues in a system.
+   With direct I/O, a partial block stays until more data or closing. */
 void wav_drain(out123_handle *ao)
 {
 	struct wavdata *wdat = ao->userptr;
 
-	if(!wdat)
+	if(!wdat || wdat->fd < 0)
 		return;
 
-	if(fflush(wdat->wavfp) && !AOQUIET)
-		error1("flushing failed: %s\n", strerror(errno));
+	flush_buffer(ao, 0);
 }
@@ -13,6 +13,10 @@ struct RIFF_STRUCT_NAME
 	struct
 	{
 		byte WAVEID[4];
+		/* Room for the ds64 chunk of RF64, if the data gets that big. */
+		byte junkheader[4];
+		byte junklen[4];
+		struct ds64 ds64;
 		byte fmtheader[4];
 		byte fmtlen[4];
 		struct
@@ -48,6 +52,11 @@ struct RIFF_STRUCT_NAME
 	{ sizeof(RIFF_NAME.WAVE),0,0,0 } , 
 	{
 		{ 'W','A','V','E' },
+		{ 'J','U','N','K' },
+		{ sizeof(RIFF_NAME.WAVE.ds64),0,0,0 } ,
+		{
+			{0,0,0,0,0,0,0,0} , {0,0,0,0,0,0,0,0} , {0,0,0,0,0,0,0,0} , {0,0,0,0}
+		} ,
 		{ 'f','m','t',' ' },
 		{ sizeof(RIFF_NAME.WAVE.fmt),0,0,0 } ,
 		{
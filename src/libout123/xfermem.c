@@ -78,6 +78,7 @@ void xfermem_init (txfermem **xf, size_t bufsize, size_t msize, size_t skipbuf)
 		exit (1);
 	}
 	(*xf)->freeindex = (*xf)->readindex = 0;
+	(*xf)->audible = 0;
 	(*xf)->data = ((char *) *xf) + sizeof(txfermem) + msize;
 	(*xf)->metadata = ((char *) *xf) + sizeof(txfermem);
 	(*xf)->size = bufsize;
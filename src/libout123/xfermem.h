@@ -25,6 +25,7 @@
 typedef struct {
 	size_t freeindex;	/* [W] next free index */
 	size_t readindex;	/* [R] next index to read */
+	unsigned long audible;	/* [R] when the last written frame plays (see audible_time()) */
 	int fd[2];
 	char *data;
 	char *metadata;
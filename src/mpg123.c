@@ -595,6 +595,7 @@ topt opts[] = {
 	{0, "rva-radio",         GLO_INT,  0, &param.rva, 1 },
 	{0, "rva-album",         GLO_INT,  0, &param.rva, 2 },
 	{0, "rva-audiophile",         GLO_INT,  0, &param.rva, 2 },
+	{0, "rva-scan", GLO_INT, set_frameflag, &frameflag, MPG123_SCAN_LOUDNESS},
 	{0, "no-icy-meta",      GLO_INT,  0, &param.talk_icy, 0 },
 	{0, "long-tag",         GLO_INT,  0, &param.long_id3, 1 },
 #ifdef FIFO
@@ -615,6 +616,8 @@ topt opts[] = {
 	{0, "fuzzy", GLO_INT,  set_frameflag, &frameflag, MPG123_FUZZY},
 	{0, "index-size", GLO_ARG|GLO_LONG, 0, &param.index_size, 0},
 	{0, "no-seekbuffer", GLO_INT, unset_frameflag, &frameflag, MPG123_SEEKBUFFER},
+	{0, "mmap", GLO_INT, set_frameflag, &frameflag, MPG123_MMAP},
+	{0, "readahead", GLO_INT, set_frameflag, &frameflag, MPG123_READAHEAD},
 	{'e', "encoding", GLO_ARG|GLO_CHAR, 0, &param.force_encoding, 0},
 	{0, "preframes", GLO_ARG|GLO_LONG, 0, &param.preframes, 0},
 	{0, "skip-id3v2", GLO_INT, set_frameflag, &frameflag, MPG123_SKIP_ID3V2},
@@ -1263,7 +1266,7 @@ int main(int sys_argc, char ** sys_argv)
 		}
 
 		if(!param.quiet) fprintf(stderr, "\n");
-		if(param.index)
+		if(param.index || frameflag & MPG123_SCAN_LOUDNESS)
 		{
 			if(param.verbose) fprintf(stderr, "indexing...\r");
 			mpg123_scan(mh);
@@ -1510,6 +1513,8 @@ static void long_usage(int err)
 	fprintf(o,"        --ignore-mime      ignore HTTP MIME types (content-type)\n");
 #endif
 	fprintf(o,"        --no-seekbuffer    disable seek buffer\n");
+	fprintf(o,"        --mmap             map local files into memory instead of reading\n");
+	fprintf(o,"        --readahead        read input in a separate thread, ahead of decoding\n");
 	fprintf(o," -@ <f> --list <f>         play songs in playlist <f> (plain list, m3u, pls (shoutcast))\n");
 	fprintf(o," -l <n> --listentry <n>    play nth title in playlist; show whole playlist for n < 0\n");
 	fprintf(o,"        --continue         playlist continuation mode (see man page)\n");
@@ -1552,6 +1557,7 @@ static void long_usage(int err)
 	fprintf(o,"        --rva-radio        use RVA2/ReplayGain values for mix/radio mode\n");
 	fprintf(o,"        --rva-album,\n");
 	fprintf(o,"        --rva-audiophile   use RVA2/ReplayGain values for album/audiophile mode\n");
+	fprintf(o,"        --rva-scan         measure loudness for tracks without RVA/ReplayGain values\n");
 	fprintf(o," -0     --left --single0   play only left channel\n");
 	fprintf(o," -1     --right --single1  play only right channel\n");
 	fprintf(o," -m     --mono --mix       mix stereo to mono\n");
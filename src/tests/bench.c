@@ -0,0 +1,806 @@
+/*
+	bench: Decoding and seeking benchmark on synthetic streams.
+
+	copyright 2016 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+
+	arguments: [seconds per measurement] [decoder ...]
+
+	For each MPEG version (1, 2, 2.5) and layer (I, II, III), a stream is
+	generated in memory. Layer III streams carry valid Huffman data, scale
+	factors and bit reservoir use; layer I ones valid allocations and samples;
+	layer II ones random data behind valid headers. Each stream is decoded
+	with every given decoder (default: all of mpg123_supported_decoders()).
+
+	Output is one tab-separated line per result, preceded by a header line:
+
+	decoder stream metric value
+
+	Metrics:
+	frames_per_sec      decoding throughput from memory via mpg123_decode_frame()
+	ns_per_synth        decoding time per call of the synth filter
+	                    (32 samples of one channel, all decoding stages included)
+	feed_frames_per_sec throughput with mpg123_feed() in 4096 byte chunks
+	feed_overhead_pct   extra time of feeding compared to frames_per_sec
+	seek_us_index       mpg123_seek() plus decoding the next frame, full index
+	seek_us_noindex     the same without frame index
+	seek_us_fuzzy       the same without frame index, with MPG123_FUZZY
+
+	Finally, BATCH_HANDLES feeders decode all streams at once, interleaved,
+	stream "mixed":
+	loop_frames_per_sec  all frames per second, one mpg123_decode_frame()
+	                     for each handle in turn
+	batch_frames_per_sec the same with mpg123_decode_batch(), as reported
+	                     by mpg123_batch_stats(), taking turns with the loop
+	batch_gain_pct       how much faster the batch is
+*/
+
+#include "compat.h"
+#include <mpg123.h>
+#include "debug.h"
+
+/* The Huffman trees, to derive the codes from. */
+#include "../libmpg123/huffman.h"
+
+#define FRAMES 400
+#define SEEKS  40
+#define FEED_CHUNK 4096
+#define BATCH_HANDLES 144
+
+static unsigned long rng = 1;
+
+static unsigned int rnd(void)
+{
+	rng = (rng*1103515245UL + 12345UL) & 0xffffffffUL;
+	return (unsigned int)(rng >> 16);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+/* Generation of synthetic streams. */
+
+struct bitwriter
+{
+	unsigned char *p;
+	size_t bit;
+};
+
+static void put(struct bitwriter *b, unsigned long val, int n)
+{
+	while(n-- > 0)
+	{
+		if((val>>n)&1) b->p[b->bit>>3] |= 0x80>>(b->bit&7);
+		else b->p[b->bit>>3] &= ~(0x80>>(b->bit&7));
+		b->bit++;
+	}
+}
+
+struct code
+{
+	unsigned long bits;
+	int len;
+};
+static struct code hcode[32][16][16];
+static int hmax[32];
+static struct code ccode[2][16];
+
+/* Walk a decoder tree to get the code for each value (pair). */
+static void walk(const short *tab, int pos, unsigned long code, int len, struct code *out, int pairs, int *maxv)
+{
+	short v = tab[pos++];
+	if(v >= 0)
+	{
+		if(pairs)
+		{
+			int x = v>>4, y = v&15;
+			out[x*16+y].bits = code;
+			out[x*16+y].len = len;
+			if(x > *maxv) *maxv = x;
+			if(y > *maxv) *maxv = y;
+		}
+		else
+		{
+			out[v].bits = code;
+			out[v].len = len;
+		}
+		return;
+	}
+	walk(tab, pos, code<<1, len+1, out, pairs, maxv);
+	walk(tab, pos-v, (code<<1)|1, len+1, out, pairs, maxv);
+}
+
+static void init_codes(void)
+{
+	int t, dummy;
+	for(t=0; t<32; ++t)
+	{
+		hmax[t] = 0;
+		if(t==0 || t==4 || t==14) continue;
+		walk(ht[t].table, 0, 0, 0, &hcode[t][0][0], 1, &hmax[t]);
+	}
+	walk(htc[0].table, 0, 0, 0, ccode[0], 0, &dummy);
+	walk(htc[1].table, 0, 0, 0, ccode[1], 0, &dummy);
+}
+
+/* Mostly small values, like in real music. */
+static int pick(int maxv)
+{
+	int r = rnd()%100, v;
+	if(r < 40) v = 0;
+	else if(r < 70) v = 1;
+	else if(r < 85) v = 2 + rnd()%2;
+	else v = rnd()%(maxv+1);
+	return v > maxv ? maxv : v;
+}
+
+static int pair_cost(int t, int x, int y)
+{
+	int c = hcode[t][x>15?15:x][y>15?15:y].len;
+	if(x) c++;
+	if(y) c++;
+	if(x>=15) c += ht[t].linbits;
+	if(y>=15) c += ht[t].linbits;
+	return c;
+}
+
+static void put_pair(struct bitwriter *b, int t, int x, int y)
+{
+	int lb = ht[t].linbits;
+	struct code c = hcode[t][x>15?15:x][y>15?15:y];
+	put(b, c.bits, c.len);
+	if(x>=15 && lb) put(b, x-15, lb);
+	if(x) put(b, rnd()&1, 1);
+	if(y>=15 && lb) put(b, y-15, lb);
+	if(y) put(b, rnd()&1, 1);
+}
+
+struct granule
+{
+	int part2_3, big_values, global_gain, scalefac_compress;
+	int window_switching, block_type, mixed, table, count1_table, preflag;
+	int x[576];
+	int nquads;
+	int quad[144];
+};
+
+static const unsigned char slen[2][16] =
+{
+	{0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4},
+	{0, 1, 2, 3, 0, 1, 2, 3, 1, 2, 3, 1, 2, 3, 2, 3}
+};
+
+/* Choose granule content that fits into the given bit budget. */
+static void make_granule(struct granule *g, int lsf, long budget)
+{
+	int t, maxv, maxq, target;
+	long cost = 0;
+
+	g->window_switching = rnd()%5 == 0;
+	g->block_type = g->window_switching ? 1+rnd()%3 : 0;
+	g->mixed = g->block_type == 2 ? rnd()%4 == 0 : 0;
+	do t = rnd()%32; while(t==0 || t==4 || t==14);
+	g->table = t;
+	g->count1_table = rnd()&1;
+	g->global_gain = 120 + rnd()%50;
+	g->preflag = lsf ? 0 : rnd()&1;
+	/* LSF scale factors are left at zero length. */
+	g->scalefac_compress = lsf ? 0 : rnd()%16;
+	if(!lsf)
+	{
+		int n0 = slen[0][g->scalefac_compress];
+		int n1 = slen[1][g->scalefac_compress];
+		if(g->block_type == 2) cost = g->mixed ? n0*17+n1*18 : (n0+n1)*18;
+		else cost = (n0+n1)*10+n0;
+	}
+	maxv = ht[t].linbits ? 15+(1<<ht[t].linbits)-1 : hmax[t];
+	g->big_values = 0;
+	target = rnd()%289;
+	while(g->big_values < target)
+	{
+		int x = pick(maxv), y = pick(maxv);
+		int c = pair_cost(t, x, y);
+		if(cost+c > budget) break;
+		g->x[2*g->big_values]   = x;
+		g->x[2*g->big_values+1] = y;
+		cost += c;
+		g->big_values++;
+	}
+	g->nquads = 0;
+	maxq = ((288-g->big_values)>>1) - 4;
+	if(maxq < 0) maxq = 0;
+	target = rnd()%(maxq+1);
+	while(g->nquads < target)
+	{
+		int q = rnd()%4 ? 0 : rnd()&15;
+		int c = ccode[g->count1_table][q].len
+		+	!!(q&8) + !!(q&4) + !!(q&2) + !!(q&1);
+		if(cost+c > budget) break;
+		g->quad[g->nquads++] = q;
+		cost += c;
+	}
+	g->part2_3 = (int)cost;
+}
+
+static void write_granule(struct bitwriter *b, struct granule *g, int lsf)
+{
+	int i, k;
+	if(!lsf)
+	{
+		int n0 = slen[0][g->scalefac_compress];
+		int n1 = slen[1][g->scalefac_compress];
+		if(g->block_type == 2)
+		{
+			for(i=0; i<(g->mixed ? 17 : 18); ++i) put(b, rnd(), n0);
+			for(i=0; i<18; ++i) put(b, rnd(), n1);
+		}
+		else
+		{
+			for(i=0; i<11; ++i) put(b, rnd(), n0);
+			for(i=0; i<10; ++i) put(b, rnd(), n1);
+		}
+	}
+	for(i=0; i<g->big_values; ++i)
+	put_pair(b, g->table, g->x[2*i], g->x[2*i+1]);
+	for(i=0; i<g->nquads; ++i)
+	{
+		int q = g->quad[i];
+		put(b, ccode[g->count1_table][q].bits, ccode[g->count1_table][q].len);
+		for(k=0; k<4; ++k)
+		if(q & (8>>k)) put(b, rnd()&1, 1);
+	}
+}
+
+static const int bitrates[2][3][15] =
+{
+	{
+		{0,32,64,96,128,160,192,224,256,288,320,352,384,416,448},
+		{0,32,48,56,64,80,96,112,128,160,192,224,256,320,384},
+		{0,32,40,48,56,64,80,96,112,128,160,192,224,256,320}
+	},
+	{
+		{0,32,48,56,64,80,96,112,128,144,160,176,192,224,256},
+		{0,8,16,24,32,40,48,56,64,80,96,112,128,144,160},
+		{0,8,16,24,32,40,48,56,64,80,96,112,128,144,160}
+	}
+};
+static const long rates[3] = { 44100, 22050, 11025 };
+/* Bit rate indices per version and layer. */
+static const int bitrate_index[3][3] = { {12, 12, 9}, {12, 10, 8}, {12, 10, 8} };
+
+/* Layer III side info and main data. Main data may begin in earlier frames. */
+struct l3state
+{
+	unsigned char md[8192];
+	long reservoir; /* bytes at the end of earlier frame bodies not used yet */
+	size_t segoff[16]; /* body positions of the last frames in the output */
+	long seglen[16];
+	int nseg;
+};
+
+static void make_layer3( struct bitwriter *b, int lsf, int size
+,	unsigned char *out, size_t outfill, struct l3state *st )
+{
+	int ch, gr, i;
+	int ngr = lsf ? 1 : 2;
+	int ssize = lsf ? 17 : 32;
+	int body = size-4-ssize;
+	int maxres = lsf ? 255 : 511;
+	long mdb = st->reservoir > maxres ? maxres : st->reservoir;
+	long avail = (mdb+body)*8;
+	long used, left, k;
+	struct granule g[2][2];
+	struct bitwriter mb;
+
+	put(b, mdb, lsf ? 8 : 9);
+	put(b, 0, lsf ? 2 : 3);
+	if(!lsf) for(ch=0; ch<2; ++ch) put(b, 0, 4); /* no scfsi */
+	/* Use a random share of what is available. */
+	avail = avail/2 + rnd()%(avail/2+1);
+	for(gr=0; gr<ngr; ++gr) for(ch=0; ch<2; ++ch)
+	{
+		long share = avail/(ngr*2);
+		if(share > 4095) share = 4095;
+		make_granule(&g[gr][ch], lsf, share);
+	}
+	for(gr=0; gr<ngr; ++gr) for(ch=0; ch<2; ++ch)
+	{
+		struct granule *gg = &g[gr][ch];
+		put(b, gg->part2_3, 12);
+		put(b, gg->big_values, 9);
+		put(b, gg->global_gain, 8);
+		put(b, gg->scalefac_compress, lsf ? 9 : 4);
+		put(b, gg->window_switching, 1);
+		if(gg->window_switching)
+		{
+			put(b, gg->block_type, 2);
+			put(b, gg->mixed, 1);
+			put(b, gg->table, 5);
+			put(b, gg->table, 5);
+			for(i=0; i<3; ++i) put(b, rnd()&3, 3);
+		}
+		else
+		{
+			for(i=0; i<3; ++i) put(b, gg->table, 5);
+			put(b, rnd()&15, 4);
+			put(b, rnd()&7, 3);
+		}
+		if(!lsf) put(b, gg->preflag, 1);
+		put(b, rnd()&1, 1);
+		put(b, gg->count1_table, 1);
+	}
+	memset(st->md, 0, mdb+body+16);
+	mb.p = st->md;
+	mb.bit = 0;
+	for(gr=0; gr<ngr; ++gr) for(ch=0; ch<2; ++ch)
+	write_granule(&mb, &g[gr][ch], lsf);
+	used = (long)((mb.bit+7)/8);
+	/* Stuffing after the main data. */
+	for(i=used; i<mdb+body; ++i) st->md[i] = rnd();
+	/* The first mdb bytes go into the tails of earlier frame bodies. */
+	left = mdb;
+	k = st->nseg;
+	while(left > 0 && k > 0)
+	{
+		long n;
+		--k;
+		n = st->seglen[k] < left ? st->seglen[k] : left;
+		memcpy(out+st->segoff[k]+st->seglen[k]-n, st->md+left-n, n);
+		left -= n;
+	}
+	memcpy(b->p+4+ssize, st->md+mdb, body);
+	st->reservoir = mdb+body-used;
+	if(st->nseg == 16)
+	{
+		memmove(st->segoff, st->segoff+1, 15*sizeof(size_t));
+		memmove(st->seglen, st->seglen+1, 15*sizeof(long));
+		--st->nseg;
+	}
+	st->segoff[st->nseg] = outfill+4+ssize;
+	st->seglen[st->nseg] = body;
+	++st->nseg;
+}
+
+/* Layer I: allocations, scale factors and samples that fit the frame. */
+static void make_layer1(struct bitwriter *b, int size)
+{
+	int sb, ch, s;
+	int budget = size*8 - 32;
+	int alloc[2][32];
+	int used = 32*2*4;
+	for(sb=0; sb<32; ++sb) for(ch=0; ch<2; ++ch)
+	{
+		int a = rnd()%15;
+		int c = a ? 6 + 12*(a+1) : 0;
+		if(sb > 26 || used + c > budget) a = c = 0;
+		alloc[ch][sb] = a;
+		used += c;
+	}
+	for(sb=0; sb<32; ++sb) for(ch=0; ch<2; ++ch)
+	put(b, alloc[ch][sb], 4);
+	for(sb=0; sb<32; ++sb) for(ch=0; ch<2; ++ch)
+	if(alloc[ch][sb]) put(b, rnd()%63, 6);
+	for(s=0; s<12; ++s) for(sb=0; sb<32; ++sb) for(ch=0; ch<2; ++ch)
+	if(alloc[ch][sb])
+	{
+		int n = alloc[ch][sb]+1;
+		unsigned long v;
+		do v = rnd() & ((1UL<<n)-1);
+		while(v == (1UL<<n)-1);
+		put(b, v, n);
+	}
+	for(s=(int)((b->bit+7)/8); s<size; ++s) b->p[s] = rnd();
+}
+
+/* Stereo stream of given MPEG version (0: 1, 1: 2, 2: 2.5) and layer. */
+static unsigned char* make_stream(int ver, int lay, long frames, size_t *len)
+{
+	int lsf = ver > 0;
+	long rate = rates[ver];
+	long bitrate = bitrates[lsf][lay-1][bitrate_index[ver][lay-1]]*1000L;
+	int size;
+	long f;
+	unsigned char *out;
+	size_t outfill = 0;
+	static struct l3state st;
+
+	if(lay == 1) size = (int)(12*bitrate/rate)*4;
+	else if(lay == 3 && lsf) size = (int)(72*bitrate/rate);
+	else size = (int)(144*bitrate/rate);
+	out = malloc((size_t)size*frames);
+	if(out == NULL) return NULL;
+	st.reservoir = 0;
+	st.nseg = 0;
+	rng = 1 + ver*3 + lay;
+	for(f=0; f<frames; ++f)
+	{
+		struct bitwriter b;
+		b.p = out+outfill;
+		b.bit = 0;
+		memset(b.p, 0, size);
+		put(&b, 0x7ff, 11);
+		put(&b, ver==0 ? 3 : (ver==1 ? 2 : 0), 2);
+		put(&b, 4-lay, 2);
+		put(&b, 1, 1); /* no CRC */
+		put(&b, bitrate_index[ver][lay-1], 4);
+		put(&b, 0, 2); /* first sampling rate */
+		put(&b, 0, 2); /* no padding, private bit */
+		/* Joint stereo with MS for layer III, plain stereo otherwise. */
+		put(&b, lay==3 ? 1 : 0, 2);
+		put(&b, lay==3 ? (rnd()&2) : 0, 2);
+		put(&b, 0, 4);
+		if(lay == 3) make_layer3(&b, lsf, size, out, outfill, &st);
+		else if(lay == 1) make_layer1(&b, size);
+		else
+		{
+			int i;
+			for(i=4; i<size; ++i) b.p[i] = rnd();
+		}
+		outfill += size;
+	}
+	*len = outfill;
+	return out;
+}
+
+/* Reading from memory. */
+
+struct memstream
+{
+	unsigned char *data;
+	size_t size;
+	size_t pos;
+};
+
+static ssize_t mem_read(void *handle, void *buf, size_t count)
+{
+	struct memstream *ms = handle;
+	if(ms->pos >= ms->size) return 0;
+	if(count > ms->size - ms->pos) count = ms->size - ms->pos;
+	memcpy(buf, ms->data+ms->pos, count);
+	ms->pos += count;
+	return (ssize_t)count;
+}
+
+static off_t mem_lseek(void *handle, off_t offset, int whence)
+{
+	struct memstream *ms = handle;
+	off_t pos;
+	switch(whence)
+	{
+		case SEEK_SET: pos = offset; break;
+		case SEEK_CUR: pos = (off_t)ms->pos + offset; break;
+		case SEEK_END: pos = (off_t)ms->size + offset; break;
+		default: return -1;
+	}
+	/* Like lseek(), allow positions beyond the end. */
+	if(pos < 0) return -1;
+	ms->pos = (size_t)pos;
+	return pos;
+}
+
+/* Handle for given decoder, reading from the stream, index size as given. */
+static mpg123_handle* open_mem( const char *decoder, struct memstream *ms
+,	long index_size, long flags )
+{
+	mpg123_handle *mh = mpg123_new(decoder, NULL);
+	if(mh == NULL) return NULL;
+	mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET|flags, 0.);
+	mpg123_param(mh, MPG123_INDEX_SIZE, index_size, 0.);
+	ms->pos = 0;
+	if(  mpg123_replace_reader_handle(mh, mem_read, mem_lseek, NULL) != MPG123_OK
+	  || mpg123_open_handle(mh, ms) != MPG123_OK )
+	{
+		mpg123_delete(mh);
+		return NULL;
+	}
+	return mh;
+}
+
+static void report(const char *decoder, const char *stream, const char *metric, double value)
+{
+	printf("%s\t%s\t%s\t%.6g\n", decoder, stream, metric, value);
+}
+
+/* Decode whole stream repeatedly for at least mintime, return seconds per frame. */
+static double bench_decode(const char *decoder, struct memstream *ms, double mintime, long *frames)
+{
+	double start = now();
+	double elapsed = 0.;
+	long total = 0;
+	do
+	{
+		mpg123_handle *mh = open_mem(decoder, ms, 0, 0);
+		off_t num;
+		unsigned char *audio;
+		size_t bytes;
+		int ret;
+		if(mh == NULL) return -1.;
+		while((ret = mpg123_decode_frame(mh, &num, &audio, &bytes)) != MPG123_DONE)
+		{
+			if(ret == MPG123_OK) ++total;
+			else if(ret != MPG123_NEW_FORMAT) break;
+		}
+		mpg123_delete(mh);
+		elapsed = now() - start;
+	} while(elapsed < mintime);
+	*frames = total;
+	return total ? elapsed/total : -1.;
+}
+
+/* The same using the feeder. */
+static double bench_feed(const char *decoder, struct memstream *ms, double mintime)
+{
+	double start = now();
+	double elapsed = 0.;
+	long total = 0;
+	do
+	{
+		mpg123_handle *mh = mpg123_new(decoder, NULL);
+		size_t pos;
+		off_t num;
+		unsigned char *audio;
+		size_t bytes;
+		if(mh == NULL) return -1.;
+		mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0.);
+		mpg123_open_feed(mh);
+		for(pos=0; pos < ms->size; pos += FEED_CHUNK)
+		{
+			int ret;
+			size_t chunk = ms->size-pos < FEED_CHUNK ? ms->size-pos : FEED_CHUNK;
+			mpg123_feed(mh, ms->data+pos, chunk);
+			while((ret = mpg123_decode_frame(mh, &num, &audio, &bytes)) != MPG123_NEED_MORE)
+			{
+				if(ret != MPG123_OK && ret != MPG123_NEW_FORMAT) break;
+				if(ret == MPG123_OK) ++total;
+			}
+		}
+		mpg123_delete(mh);
+		elapsed = now() - start;
+	} while(elapsed < mintime);
+	return total ? elapsed/total : -1.;
+}
+
+/* Mean time of a seek to a random position plus decoding the frame there. */
+static double bench_seek(const char *decoder, struct memstream *ms, long index_size, long flags)
+{
+	mpg123_handle *mh = open_mem(decoder, ms, index_size, flags);
+	off_t length;
+	off_t num;
+	unsigned char *audio;
+	size_t bytes;
+	double start;
+	int i;
+
+	if(mh == NULL) return -1.;
+	if(index_size) mpg123_scan(mh);
+	length = mpg123_length(mh);
+	if(length <= 0)
+	{
+		mpg123_delete(mh);
+		return -1.;
+	}
+	rng = 4711;
+	start = now();
+	for(i=0; i<SEEKS; ++i)
+	{
+		off_t target = (off_t)(((double)rnd()/0x10000)*length);
+		if(mpg123_seek(mh, target, SEEK_SET) < 0) break;
+		mpg123_decode_frame(mh, &num, &audio, &bytes);
+	}
+	start = now() - start;
+	mpg123_delete(mh);
+	return i == SEEKS ? start/SEEKS : -1.;
+}
+
+/* Feeders for all streams, handle i on stream i%nstreams. */
+struct feeders
+{
+	mpg123_handle *mh[BATCH_HANDLES];
+	size_t pos[BATCH_HANDLES];
+	int status[BATCH_HANDLES];
+	unsigned char *audio[BATCH_HANDLES];
+	size_t bytes[BATCH_HANDLES];
+};
+
+static int open_feeders(const char *decoder, struct feeders *f)
+{
+	int i;
+	for(i=0; i<BATCH_HANDLES; ++i)
+	{
+		f->mh[i] = mpg123_new(decoder, NULL);
+		if(f->mh[i] == NULL) return -1;
+		mpg123_param(f->mh[i], MPG123_ADD_FLAGS, MPG123_QUIET, 0.);
+		mpg123_open_feed(f->mh[i]);
+		f->pos[i] = 0;
+		f->status[i] = MPG123_NEED_MORE;
+	}
+	return 0;
+}
+
+/* Feed the handles that need it, return how many are still going. */
+static int feed_feeders(struct feeders *f, struct memstream *ms, int nstreams)
+{
+	int active = 0;
+	int i;
+	for(i=0; i<BATCH_HANDLES; ++i)
+	{
+		struct memstream *s = ms + i%nstreams;
+		if(f->status[i] == MPG123_NEED_MORE && f->pos[i] < s->size)
+		{
+			size_t chunk = s->size-f->pos[i] < FEED_CHUNK ? s->size-f->pos[i] : FEED_CHUNK;
+			mpg123_feed(f->mh[i], s->data+f->pos[i], chunk);
+			f->pos[i] += chunk;
+			++active;
+		}
+		else if(f->status[i] == MPG123_OK || f->status[i] == MPG123_NEW_FORMAT)
+			++active;
+	}
+	return active;
+}
+
+/* Frames per second of a loop over the handles and of the batch, taking
+   turns round by round, so that both see the same machine. Only the
+   decoding is timed, feeding happens in between. */
+static int bench_batch( const char *decoder, struct memstream *ms
+,	int nstreams, double mintime, double *loop_fps, double *batch_fps )
+{
+	static struct feeders loop, batch;
+	double elapsed = 0.;
+	double batchtime = 0.;
+	long total = 0;
+	long batchframes = 0;
+	long round = 0;
+	int i;
+
+	do
+	{
+		mpg123_batch *mb;
+		int going;
+		if(open_feeders(decoder, &loop) || open_feeders(decoder, &batch))
+			return -1;
+		if((mb = mpg123_new_batch(batch.mh, BATCH_HANDLES, NULL)) == NULL)
+			return -1;
+		do
+		{
+			double start;
+			going  = feed_feeders(&loop, ms, nstreams);
+			going += feed_feeders(&batch, ms, nstreams);
+			/* Whoever goes second finds the code in the cache, take turns. */
+			if(round & 1)
+				mpg123_decode_batch(mb, batch.status, batch.audio, batch.bytes);
+			start = now();
+			for(i=0; i<BATCH_HANDLES; ++i)
+			{
+				loop.status[i] = mpg123_decode_frame( loop.mh[i], NULL
+				,	loop.audio+i, loop.bytes+i );
+				if(loop.status[i] == MPG123_OK) ++total;
+			}
+			elapsed += now() - start;
+			if(!(round++ & 1))
+				mpg123_decode_batch(mb, batch.status, batch.audio, batch.bytes);
+		} while(going);
+		{
+			long frames;
+			double seconds;
+			mpg123_batch_stats(mb, &frames, &seconds, NULL);
+			batchframes += frames;
+			batchtime += seconds;
+		}
+		mpg123_delete_batch(mb);
+		for(i=0; i<BATCH_HANDLES; ++i)
+		{
+			mpg123_delete(loop.mh[i]);
+			mpg123_delete(batch.mh[i]);
+		}
+	} while(elapsed < mintime);
+	if(!total || total != batchframes || elapsed <= 0. || batchtime <= 0.)
+		return -1;
+	*loop_fps = total/elapsed;
+	*batch_fps = batchframes/batchtime;
+	return 0;
+}
+
+static const struct
+{
+	const char *metric;
+	long index_size;
+	long flags;
+} seekmodes[] =
+{
+	{ "seek_us_index",   1000, 0 }
+,	{ "seek_us_noindex", 0,    0 }
+,	{ "seek_us_fuzzy",   0,    MPG123_FUZZY }
+};
+
+int main(int argc, char **argv)
+{
+	const char **decoders;
+	const char *given[64];
+	double mintime = 0.2;
+	struct memstream streams[9];
+	int ver, lay, d, ret = 0;
+	size_t m;
+	const char *vername[3] = { "mpeg1", "mpeg2", "mpeg2.5" };
+	const char *layname[3] = { "layer1", "layer2", "layer3" };
+
+	if(argc > 1) mintime = atof(argv[1]);
+	if(argc > 2)
+	{
+		for(d=0; d<argc-2 && d<63; ++d) given[d] = argv[d+2];
+		given[d] = NULL;
+		decoders = given;
+	}
+	else decoders = mpg123_supported_decoders();
+	mpg123_init();
+	init_codes();
+	printf("decoder\tstream\tmetric\tvalue\n");
+	for(ver=0; ver<3; ++ver) for(lay=1; lay<=3; ++lay)
+	{
+		struct memstream ms;
+		char stream[32];
+		ms.data = make_stream(ver, lay, FRAMES, &ms.size);
+		if(ms.data == NULL)
+		{
+			error("out of memory");
+			return 1;
+		}
+		streams[ver*3+lay-1] = ms;
+		sprintf(stream, "%s_%s", vername[ver], layname[lay-1]);
+		for(d=0; decoders[d] != NULL; ++d)
+		{
+			long frames = 0;
+			/* Synth calls per frame: channels times samples per frame over 32. */
+			int synths = 2*(lay == 1 ? 384 : (lay == 3 && ver ? 576 : 1152))/32;
+			double spf = bench_decode(decoders[d], &ms, mintime, &frames);
+			double feed;
+			if(spf <= 0.)
+			{
+				fprintf(stderr, "%s: %s failed to decode\n", decoders[d], stream);
+				ret = 1;
+				continue;
+			}
+			report(decoders[d], stream, "frames_per_sec", 1./spf);
+			report(decoders[d], stream, "ns_per_synth", 1e9*spf/synths);
+			feed = bench_feed(decoders[d], &ms, mintime);
+			if(feed > 0.)
+			{
+				report(decoders[d], stream, "feed_frames_per_sec", 1./feed);
+				report(decoders[d], stream, "feed_overhead_pct", 100.*(feed/spf-1.));
+			}
+			for(m=0; m<sizeof(seekmodes)/sizeof(*seekmodes); ++m)
+			{
+				double seek = bench_seek( decoders[d], &ms
+				,	seekmodes[m].index_size, seekmodes[m].flags );
+				if(seek < 0.)
+				{
+					fprintf(stderr, "%s: %s failed to seek\n", decoders[d], stream);
+					ret = 1;
+				}
+				else report(decoders[d], stream, seekmodes[m].metric, 1e6*seek);
+			}
+			fflush(stdout);
+		}
+	}
+	for(d=0; decoders[d] != NULL; ++d)
+	{
+		double loop, batch;
+		if(bench_batch(decoders[d], streams, 9, mintime, &loop, &batch))
+		{
+			fprintf(stderr, "%s: mixed failed to decode\n", decoders[d]);
+			ret = 1;
+			continue;
+		}
+		report(decoders[d], "mixed", "loop_frames_per_sec", loop);
+		report(decoders[d], "mixed", "batch_frames_per_sec", batch);
+		report(decoders[d], "mixed", "batch_gain_pct", 100.*(batch/loop-1.));
+		fflush(stdout);
+	}
+	for(m=0; m<9; ++m)
+		free(streams[m].data);
+	mpg123_exit();
+	return ret;
+}
@@ -0,0 +1,161 @@
+#include "compat.h"
+#include <mpg123.h>
+#include "debug.h"
+
+/* Room for a few minutes of 44.1 kHz stereo. */
+#define CACHE_BYTES (256*1024*1024)
+/* Bytes compared after each seek. */
+#define SEEK_BYTES  (64*1024)
+
+/* Where to seek to, as fractions of the track length. */
+static const double seekpoints[] = { 0.5, 0.1, 0.9, 0., 0.33, 0.999 };
+
+mpg123_handle* open_handle(const char* path, mpg123_cache* cache, long flags)
+{
+	int err = MPG123_OK;
+	mpg123_handle* mh = NULL;
+
+	mh = mpg123_new(NULL, &err);
+	if(mh == NULL) return NULL;
+	if(  mpg123_param(mh, MPG123_ADD_FLAGS, flags|MPG123_QUIET, 0.) != MPG123_OK
+	  || mpg123_set_cache(mh, cache) != MPG123_OK
+	  || mpg123_open(mh, path) != MPG123_OK )
+	{
+		error1("cannot open: %s", mpg123_strerror(mh));
+		mpg123_delete(mh);
+		return NULL;
+	}
+	return mh;
+}
+
+/* Decode up to limit bytes from the current position, all if limit is 0. */
+unsigned char* decode(mpg123_handle* mh, size_t limit, size_t* fill)
+{
+	unsigned char* buf = NULL;
+	size_t size = 0;
+	int err = MPG123_OK;
+
+	*fill = 0;
+	while(err == MPG123_OK && (!limit || *fill < limit))
+	{
+		size_t got = 0;
+		if(size - *fill < 16384)
+		{
+			unsigned char* nbuf = realloc(buf, size += 1024*1024);
+			if(nbuf == NULL){ free(buf); return NULL; }
+			buf = nbuf;
+		}
+		err = mpg123_read(mh, buf + *fill, limit && limit-*fill < 16384 ? limit-*fill : 16384, &got);
+		*fill += got;
+		if(err == MPG123_NEW_FORMAT) err = MPG123_OK;
+	}
+	if(err != MPG123_OK && err != MPG123_DONE)
+	{
+		error1("decoding failed: %s", mpg123_strerror(mh));
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+int same(const unsigned char* a, size_t afill, const unsigned char* b, size_t bfill)
+{
+	return a != NULL && b != NULL && afill == bfill && !memcmp(a, b, afill);
+}
+
+/* Whole track and seeks with the cache must give the same as without. */
+int test_cache(const char* path, mpg123_cache* cache, long flags, int expect_hits)
+{
+	mpg123_handle* plain = NULL;
+	mpg123_handle* mh = NULL;
+	unsigned char* ref = NULL;
+	unsigned char* buf = NULL;
+	size_t reffill, fill;
+	long hits = 0;
+	double dummy;
+	off_t length;
+	size_t i;
+	int ret = -1;
+
+	if(  (plain = open_handle(path, NULL, flags)) == NULL
+	  || (mh = open_handle(path, cache, flags)) == NULL )
+		goto end;
+	if((ref = decode(plain, 0, &reffill)) == NULL || !reffill)
+		goto end;
+	buf = decode(mh, 0, &fill);
+	mpg123_getstate(mh, MPG123_CACHED_FRAMES, &hits, &dummy);
+	fprintf(stdout, "%lu bytes, %ld frames from the cache\n", (unsigned long)fill, hits);
+	if(!same(ref, reffill, buf, fill))
+	{
+		error("whole track differs");
+		goto end;
+	}
+	if(expect_hits ? hits < 1 : hits != 0)
+	{
+		error1("%s frames from the cache", expect_hits ? "no" : "unexpected");
+		goto end;
+	}
+	length = mpg123_length(plain);
+	for(i=0; i<sizeof(seekpoints)/sizeof(*seekpoints); ++i)
+	{
+		off_t pos = (off_t)(seekpoints[i]*length);
+		free(ref);
+		free(buf);
+		ref = buf = NULL;
+		if(  mpg123_seek(plain, pos, SEEK_SET) != pos
+		  || mpg123_seek(mh, pos, SEEK_SET) != pos )
+		{
+			error1("seek to %"OFF_P" failed", (off_p)pos);
+			goto end;
+		}
+		ref = decode(plain, SEEK_BYTES, &reffill);
+		buf = decode(mh, SEEK_BYTES, &fill);
+		if(!same(ref, reffill, buf, fill))
+		{
+			error1("output after seek to %"OFF_P" differs", (off_p)pos);
+			goto end;
+		}
+	}
+	ret = 0;
+end:
+	free(ref);
+	free(buf);
+	if(mh) mpg123_delete(mh);
+	if(plain) mpg123_delete(plain);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0, errsum = 0;
+	mpg123_cache* cache;
+	if(argc < 2)
+	{
+		printf("Gimme a MPEG file name...\n");
+		return 0;
+	}
+	mpg123_init();
+	cache = mpg123_new_cache(CACHE_BYTES, NULL, NULL, NULL, &err);
+	if(cache == NULL)
+	{
+		error1("no cache: %s", mpg123_plain_strerror(err));
+		return -1;
+	}
+	fprintf(stderr, "Decoding into the cache: ");
+	err = test_cache(argv[1], cache, 0, 0);
+	fprintf(stdout, "%s\n", err == 0 ? "PASS" : "FAIL");
+	errsum += err;
+	fprintf(stderr, "Decoding from the cache: ");
+	err = test_cache(argv[1], cache, 0, 1);
+	fprintf(stdout, "%s\n", err == 0 ? "PASS" : "FAIL");
+	errsum += err;
+	/* Frames are counted differently with that, another key. */
+	fprintf(stderr, "Ignoring the Info frame: ");
+	err = test_cache(argv[1], cache, MPG123_IGNORE_INFOFRAME, 0);
+	fprintf(stdout, "%s\n", err == 0 ? "PASS" : "FAIL");
+	errsum += err;
+	mpg123_delete_cache(cache);
+	mpg123_exit();
+	printf("%s\n", errsum ? "FAIL" : "PASS");
+	return errsum;
+}